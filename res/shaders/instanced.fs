@@ -0,0 +1,12 @@
+// This variables comes from the vertex shader
+varying vec3 v_world_normal;
+varying vec3 v_color;
+
+void main()
+{
+	// Simple lighting from above tinted with the color of the instance
+	vec3 N = normalize(v_world_normal);
+	float light = 0.5 + 0.5 * N.y;
+
+	gl_FragColor = vec4( v_color * light, 1.0 );
+}
@@ -0,0 +1,29 @@
+// Global variables from the CPU
+uniform mat4 u_viewprojection;
+
+// Per instance attributes (see Mesh::RenderInstanced)
+attribute mat4 a_model;
+attribute vec3 a_color;
+
+// Variables to pass to the fragment shader
+varying vec2 v_uv;
+varying vec3 v_world_position;
+varying vec3 v_world_normal;
+varying vec3 v_color;
+
+void main()
+{	
+	v_uv = gl_MultiTexCoord0.xy;
+	v_color = a_color;
+
+	// Convert local position and normal to world space using the matrix of this instance
+	vec3 world_position = (a_model * vec4( gl_Vertex.xyz, 1.0)).xyz;
+	vec3 world_normal = (a_model * vec4( gl_Normal.xyz, 0.0)).xyz;
+
+	// Pass them to the fragment shader interpolated
+	v_world_position = world_position;
+	v_world_normal = world_normal;
+
+	// Project the vertex using the model view projection matrix
+	gl_Position = u_viewprojection * vec4(world_position, 1.0); //output of the vertex shader
+}
@@ -1,6 +1,198 @@
 #include "picopng.h"
+#include "../framework/framework.h"
+#include <algorithm>
+#include <iostream>
 
-int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32)
+static unsigned char paethPredictor(short a, short b, short c) //Paeth predicter, used by PNG filter type 4
+{
+	short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
+	return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
+}
+
+// Byte by byte unfiltering of any format, false for an unknown filter type
+static bool unFilterScanlineScalar(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
+{
+	switch (filterType)
+	{
+	case 0: for (size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
+	case 1:
+		for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
+		for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+		break;
+	case 2:
+		if (precon) for (size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
+		else       for (size_t i = 0; i < length; i++) recon[i] = scanline[i];
+		break;
+	case 3:
+		if (precon)
+		{
+			for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
+			for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
+		}
+		else
+		{
+			for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
+			for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
+		}
+		break;
+	case 4:
+		if (precon)
+		{
+			for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
+			for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
+		}
+		else
+		{
+			for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
+			for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], 0, 0);
+		}
+		break;
+	default: return false; //unexisting filter type
+	}
+	return true;
+}
+
+#if defined(USE_SSE2)
+// Unfiltering of 8 bit RGB and RGBA rows with SSE2. Sub, Average and Paeth depend on the pixel on the left, so
+// a row is still done one pixel at a time but all its channels are computed together. Pixels are read and
+// written with exactly BPP bytes because rows are unfiltered in place, a few bytes before the filtered data.
+// (3 bytes are put together in a register, a partial memcpy goes through the stack and stalls the loop)
+template <size_t BPP> static inline __m128i loadPixel(const unsigned char* p)
+{
+	int value;
+	if (BPP == 4) memcpy(&value, p, 4);
+	else value = p[0] | p[1] << 8 | p[2] << 16;
+	return _mm_cvtsi32_si128(value);
+}
+
+template <size_t BPP> static inline void storePixel(unsigned char* p, __m128i v)
+{
+	int value = _mm_cvtsi128_si32(v);
+	if (BPP == 4) memcpy(p, &value, 4);
+	else { p[0] = (unsigned char)value; p[1] = (unsigned char)(value >> 8); p[2] = (unsigned char)(value >> 16); }
+}
+
+static inline __m128i select16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i abs16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+template <size_t BPP> static void unFilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t length)
+{
+	__m128i a = _mm_setzero_si128();
+	for (size_t i = 0; i + BPP <= length; i += BPP)
+	{
+		a = _mm_add_epi8(a, loadPixel<BPP>(scanline + i));
+		storePixel<BPP>(recon + i, a);
+	}
+}
+
+template <size_t BPP> static void unFilterAverageSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length)
+{
+	// _mm_avg_epu8 rounds up, PNG rounds down: one less when the sum is odd
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	for (size_t i = 0; i + BPP <= length; i += BPP)
+	{
+		__m128i b = loadPixel<BPP>(precon + i);
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(loadPixel<BPP>(scanline + i), average);
+		storePixel<BPP>(recon + i, a);
+	}
+}
+
+template <size_t BPP> static void unFilterPaethSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t length)
+{
+	// With p = a + b - c the distances are |b - c|, |a - c| and |a + b - 2c|, computed in 16 bits
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+	for (size_t i = 0; i + BPP <= length; i += BPP)
+	{
+		__m128i b = _mm_unpacklo_epi8(loadPixel<BPP>(precon + i), zero);
+		__m128i pa = _mm_sub_epi16(b, c), pb = _mm_sub_epi16(a, c), pc = _mm_add_epi16(pa, pb);
+		pa = abs16(pa);
+		pb = abs16(pb);
+		pc = abs16(pc);
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		__m128i predictor = select16(_mm_cmpeq_epi16(pa, smallest), a, select16(_mm_cmpeq_epi16(pb, smallest), b, c));
+		__m128i pixel = _mm_add_epi8(loadPixel<BPP>(scanline + i), _mm_packus_epi16(predictor, predictor));
+		storePixel<BPP>(recon + i, pixel);
+		a = _mm_unpacklo_epi8(pixel, zero);
+		c = b;
+	}
+}
+
+// Returns false for the cases left to the scalar code
+static bool unFilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
+{
+	if (filterType == 2 && precon)
+	{
+		// Up does not depend on the left pixel, 16 bytes at a time (loaded before storing, for the in place case)
+		size_t i = 0;
+		for (; i + 16 <= length; i += 16)
+			_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(scanline + i)), _mm_loadu_si128((const __m128i*)(precon + i))));
+		for (; i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		return true;
+	}
+	if (bytewidth != 3 && bytewidth != 4)
+		return false;
+	if (filterType == 1)
+		bytewidth == 3 ? unFilterSubSSE2<3>(recon, scanline, length) : unFilterSubSSE2<4>(recon, scanline, length);
+	else if (filterType == 3 && precon)
+		bytewidth == 3 ? unFilterAverageSSE2<3>(recon, scanline, precon, length) : unFilterAverageSSE2<4>(recon, scanline, precon, length);
+	else if (filterType == 4 && precon)
+		bytewidth == 3 ? unFilterPaethSSE2<3>(recon, scanline, precon, length) : unFilterPaethSSE2<4>(recon, scanline, precon, length);
+	else
+		return false;
+	return true;
+}
+
+#endif
+
+bool checkPNGUnfilter()
+{
+	// The decoder unfilters in place, writing the row one byte (or more) before its filtered data
+	const size_t MAX_PIXELS = 67, MAX_LENGTH = 8 * MAX_PIXELS;
+	std::vector<unsigned char> scanline(MAX_LENGTH + 1), precon(MAX_LENGTH), expected(MAX_LENGTH), recon(MAX_LENGTH);
+	unsigned long seed = 12345;
+	bool ok = true;
+	for (size_t bytewidth = 1; bytewidth <= 8; bytewidth++)
+		for (size_t pixels = 1; pixels <= MAX_PIXELS; pixels += 3)
+			for (unsigned long filterType = 0; filterType <= 4; filterType++)
+				for (int variant = 0; variant < 3; variant++) //previous row, first row, in place
+				{
+					size_t length = pixels * bytewidth;
+					for (size_t i = 0; i <= length; i++) { seed = seed * 1103515245 + 12345; scanline[i] = (unsigned char)(seed >> 16); }
+					for (size_t i = 0; i < length; i++) { seed = seed * 1103515245 + 12345; precon[i] = (unsigned char)(seed >> 16); }
+					const unsigned char* prev = variant == 1 ? 0 : &precon[0];
+					unFilterScanlineScalar(&expected[0], &scanline[1], prev, bytewidth, filterType, length);
+
+					unsigned char* out = variant == 2 ? &scanline[0] : &recon[0];
+#if defined(USE_SSE2)
+					if (!unFilterScanlineSSE2(out, &scanline[1], prev, bytewidth, filterType, length))
+#endif
+						unFilterScanlineScalar(out, &scanline[1], prev, bytewidth, filterType, length);
+					if (memcmp(out, &expected[0], length) != 0)
+					{
+						std::cerr << "PNG unfiltering differs from the scalar code: filter " << filterType << ", " << bytewidth << " bytes per pixel, " << pixels << " pixels"
+							<< (variant == 1 ? ", first row" : variant == 2 ? ", in place" : "") << std::endl;
+						ok = false;
+					}
+				}
+	return ok;
+}
+
+// native: keeps 8 bit RGB and RGBA as they are and converts everything else to RGBA, 'channels' tells which one
+// flip_y: returns the rows bottom to top (OpenGL order)
+// on_header, on_row: decodes as a stream (see decodePNGStream) instead of into out_image
+static int decodePNGImpl(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, unsigned int& channels, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32, bool native, bool flip_y,
+	const PNGHeaderCallback* on_header = 0, const PNGRowCallback* on_row = 0)
 {
 	// picoPNG version 20101224
 	// Copyright (c) 2005-2010 Lode Vandevenne
@@ -35,68 +227,114 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 	static const unsigned long CLCL[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 }; //code length code lengths
 	struct Zlib //nested functions for zlib decompression
 	{
-		static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result; }
-		static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
+		struct OutputSink //receives the decompressed bytes while inflating, so they don't have to be kept until the end
 		{
-			unsigned long result = 0;
-			for (size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-			return result;
-		}
-		struct HuffmanTree
+			virtual ~OutputSink() {}
+			virtual size_t consume(const unsigned char* data, size_t size) = 0; //returns how many of the bytes it used, the rest are given again
+		};
+		struct BitReader //keeps up to 64 bits of the stream in a register instead of reading the bytes bit by bit
 		{
+			const unsigned char* in; size_t size, pos; unsigned long long buffer; unsigned int count;
+			BitReader(const unsigned char* in, size_t size) : in(in), size(size), pos(0), buffer(0), count(0) {}
+			void refill() //leaves at least 56 bits in the buffer, past the end of the input it reads zeros
+			{
+				if (pos + 8 <= size) //fast path: 8 bytes at once, only the ones that fit are kept
+				{
+					unsigned long long bytes = 0;
+					for (int i = 7; i >= 0; i--) bytes = (bytes << 8) | in[pos + i];
+					buffer |= bytes << count; pos += (63 - count) >> 3; count |= 56;
+				}
+				else while (count <= 56) { buffer |= (unsigned long long)(pos < size ? in[pos] : 0) << count; pos++; count += 8; }
+			}
+			unsigned long peek(unsigned int n) const { return (unsigned long)(buffer & ((1ull << n) - 1)); }
+			void consume(unsigned int n) { buffer >>= n; count -= n; }
+			unsigned long readBits(unsigned int n) { if (count < n) refill(); unsigned long result = peek(n); consume(n); return result; } //n <= 32
+			bool overrun() const { return pos - count / 8 > size; } //bits beyond the end of the input were used
+			size_t bytePosition() const { return pos - count / 8; } //after alignToByte
+			void alignToByte() { consume(count & 7); }
+			void seekByte(size_t p) { pos = p; buffer = 0; count = 0; }
+		};
+		struct HuffmanTable //codes of up to PRIMARY_BITS bits are decoded with one lookup, longer ones with a second one in a subtable
+		{
+			enum { PRIMARY_BITS = 10, LINK = 0x80000000 };
+			//entry: symbol (or subtable offset) in the low 16 bits, code length (or subtable bits) in bits 16-23, 0 length = invalid code
+			std::vector<unsigned long> table;
+			static unsigned long reverseBits(unsigned long code, unsigned long length) { unsigned long result = 0; for (unsigned long i = 0; i < length; i++) { result = (result << 1) | (code & 1); code >>= 1; } return result; }
 			int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-			{ //make tree given the lengths
-				unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-				std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-				for (unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
+			{ //make the table given the lengths of the canonical codes
+				unsigned long numcodes = (unsigned long)(bitlen.size());
+				std::vector<unsigned long> blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0), code(numcodes, 0);
+				for (unsigned long n = 0; n < numcodes; n++) blcount[bitlen[n]]++; //count number of instances of each code length
+				blcount[0] = 0; long left = 1;
+				for (unsigned long bits = 1; bits <= maxbitlen; bits++) { left = (left << 1) - (long)blcount[bits]; if (left < 0) return 55; } //more codes than fit in the lengths
 				for (unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-				for (unsigned long n = 0; n < numcodes; n++) if (bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-				tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-				for (unsigned long n = 0; n < numcodes; n++) //the codes
-					for (unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
+				for (unsigned long n = 0; n < numcodes; n++) if (bitlen[n] != 0) code[n] = reverseBits(nextcode[bitlen[n]]++, bitlen[n]); //the stream gives the codes from their first bit
+				table.assign(1 << PRIMARY_BITS, 0);
+				std::vector<unsigned long> subbits(1 << PRIMARY_BITS, 0); //size of the subtable of every prefix
+				for (unsigned long n = 0; n < numcodes; n++)
+					if (bitlen[n] > PRIMARY_BITS) { unsigned long prefix = code[n] & ((1 << PRIMARY_BITS) - 1); subbits[prefix] = std::max(subbits[prefix], bitlen[n] - PRIMARY_BITS); }
+				for (unsigned long prefix = 0; prefix < subbits.size(); prefix++)
+					if (subbits[prefix]) { table[prefix] = LINK | (subbits[prefix] << 16) | (unsigned long)table.size(); table.resize(table.size() + (1 << subbits[prefix]), 0); }
+				for (unsigned long n = 0; n < numcodes; n++)
+				{
+					unsigned long length = bitlen[n];
+					if (length == 0) continue;
+					if (length <= PRIMARY_BITS) for (unsigned long i = code[n]; i < (1ul << PRIMARY_BITS); i += 1ul << length) table[i] = (length << 16) | n; //all the entries starting with the code
+					else
 					{
-						unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-						if (treepos > numcodes - 2) return 55;
-						if (tree2d[2 * treepos + bit] == 32767) //not yet filled in
-						{
-							if (i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-							else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-						}
-						else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
+						unsigned long link = table[code[n] & ((1 << PRIMARY_BITS) - 1)], offset = link & 0xFFFF, sublength = length - PRIMARY_BITS;
+						for (unsigned long i = code[n] >> PRIMARY_BITS; i < (1ul << ((link >> 16) & 0xFF)); i += 1ul << sublength) table[offset + i] = (sublength << 16) | n;
 					}
+				}
 				return 0;
 			}
-			int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-			{ //Decodes a symbol from the tree
-				unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-				if (treepos >= numcodes) return 11; //error: you appeared outside the codetree
-				result = tree2d[2 * treepos + bit];
-				decoded = (result < numcodes);
-				treepos = decoded ? 0 : result - numcodes;
+			int decode(BitReader& reader, unsigned long& result) const
+			{ //decodes a symbol, the reader must have at least 15 bits
+				unsigned long entry = table[reader.peek(PRIMARY_BITS)];
+				if (entry & LINK) { reader.consume(PRIMARY_BITS); entry = table[(entry & 0xFFFF) + reader.peek((entry >> 16) & 0xFF)]; }
+				unsigned long length = (entry >> 16) & 0xFF;
+				if (length == 0) return 11; //error: the bits are not the code of any symbol
+				reader.consume(length); result = entry & 0xFFFF;
 				return 0;
 			}
-			std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
 		};
 		struct Inflator
 		{
+			enum { WINDOW = 32768 }; //the furthest a distance can go back
 			int error;
+			OutputSink* sink; size_t flushed; //with a sink, out only keeps the bytes from 'flushed' on and the last WINDOW bytes before them
+			Inflator() : error(0), sink(0), flushed(0) {}
+			void reserve(std::vector<unsigned char>& out, size_t& pos, size_t n) //makes room for n more bytes at pos
+			{
+				if (pos + n < out.size()) return;
+				if (sink) //give what we have to the sink and move the last WINDOW bytes to the start
+				{
+					flushed += sink->consume(&out[0] + flushed, pos - flushed);
+					size_t drop = std::min(flushed, pos > WINDOW ? pos - WINDOW : 0);
+					if (drop) { memmove(&out[0], &out[drop], pos - drop); pos -= drop; flushed -= drop; }
+					if (pos + n < out.size()) return;
+				}
+				out.resize((pos + n) * 2);
+			}
 			void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
 			{
-				size_t bp = 0, pos = 0; //bit pointer and byte pointer
-				error = 0;
+				size_t pos = 0; //byte pointer in out
+				error = 0; flushed = 0;
+				BitReader reader(in.empty() ? 0 : &in[inpos], in.size() - inpos);
 				unsigned long BFINAL = 0;
 				while (!BFINAL && !error)
 				{
-					if (bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-					BFINAL = readBitFromStream(bp, &in[inpos]);
-					unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
+					if (reader.bytePosition() >= reader.size) { error = 52; return; } //error, bit pointer will jump past memory
+					BFINAL = reader.readBits(1);
+					unsigned long BTYPE = reader.readBits(2);
 					if (BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-					else if (BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-					else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
+					else if (BTYPE == 0) inflateNoCompression(out, reader, pos);
+					else inflateHuffmanBlock(out, reader, pos, BTYPE);
 				}
+				if (!error && sink) { flushed += sink->consume(&out[0] + flushed, pos - flushed); } //the last bytes
 				if (!error) out.resize(pos); //Only now we know the true size of out, resize it to that
 			}
-			void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
+			void generateFixedTrees(HuffmanTable& tree, HuffmanTable& treeD) //get the tree of a deflated block with fixed tree
 			{
 				std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
 				for (size_t i = 144; i <= 255; i++) bitlen[i] = 9;
@@ -104,36 +342,34 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 				tree.makeFromLengths(bitlen, 15);
 				treeD.makeFromLengths(bitlenD, 15);
 			}
-			HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-			unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
+			HuffmanTable codetree, codetreeD, codelengthcodetree; //the code tables for Huffman codes, dist codes, and code length codes
+			unsigned long huffmanDecodeSymbol(BitReader& reader, const HuffmanTable& codetree)
 			{ //decode a single symbol from given list of bits with given code tree. return value is the symbol
-				bool decoded; unsigned long ct;
-				for (size_t treepos = 0;;)
-				{
-					if ((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-					error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if (error) return 0; //stop, an error happened
-					if (decoded) return ct;
-				}
+				if (reader.count < 15) reader.refill();
+				unsigned long ct = 0;
+				error = codetree.decode(reader, ct); if (error) return 0; //stop, an error happened
+				if (reader.overrun()) { error = 10; return 0; } //error: end reached without endcode
+				return ct;
 			}
-			void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
+			void getTreeInflateDynamic(HuffmanTable& tree, HuffmanTable& treeD, BitReader& reader)
 			{ //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
 				std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-				if (bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-				size_t HLIT = readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-				size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-				size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
+				if (reader.bytePosition() >= reader.size - 2) { error = 49; return; } //the bit pointer is or will go past the memory
+				size_t HLIT = reader.readBits(5) + 257; //number of literal/length codes + 257
+				size_t HDIST = reader.readBits(5) + 1; //number of dist codes + 1
+				size_t HCLEN = reader.readBits(4) + 4; //number of code length codes + 4
 				std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-				for (size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
+				for (size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? reader.readBits(3) : 0;
 				error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if (error) return;
 				size_t i = 0, replength;
 				while (i < HLIT + HDIST)
 				{
-					unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if (error) return;
+					unsigned long code = huffmanDecodeSymbol(reader, codelengthcodetree); if (error) return;
 					if (code <= 15) { if (i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
 					else if (code == 16) //repeat previous
 					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 3 + readBitsFromStream(bp, in, 2);
+						if (i == 0) { error = 54; return; } //error: there is no previous length to repeat
+						replength = 3 + reader.readBits(2);
 						unsigned long value; //set value to the previous code
 						if ((i - 1) < HLIT) value = bitlen[i - 1];
 						else value = bitlenD[i - HLIT - 1];
@@ -145,8 +381,7 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 					}
 					else if (code == 17) //repeat "0" 3-10 times
 					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 3 + readBitsFromStream(bp, in, 3);
+						replength = 3 + reader.readBits(3);
 						for (size_t n = 0; n < replength; n++) //repeat this value in the next lengths
 						{
 							if (i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
@@ -155,8 +390,7 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 					}
 					else if (code == 18) //repeat "0" 11-138 times
 					{
-						if (bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-						replength = 11 + readBitsFromStream(bp, in, 7);
+						replength = 11 + reader.readBits(7);
 						for (size_t n = 0; n < replength; n++) //repeat this value in the next lengths
 						{
 							if (i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
@@ -164,56 +398,67 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 						}
 					}
 					else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
+					if (reader.overrun()) { error = 50; return; } //error, bit pointer jumps past memory
 				}
 				if (bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
 				error = tree.makeFromLengths(bitlen, 15); if (error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
 				error = treeD.makeFromLengths(bitlenD, 15); if (error) return;
 			}
-			void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype)
+			void inflateHuffmanBlock(std::vector<unsigned char>& out, BitReader& reader, size_t& pos, unsigned long btype)
 			{
 				if (btype == 1) { generateFixedTrees(codetree, codetreeD); }
-				else if (btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if (error) return; }
+				else if (btype == 2) { getTreeInflateDynamic(codetree, codetreeD, reader); if (error) return; }
 				for (;;)
 				{
-					unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if (error) return;
-					if (code == 256) return; //end code
+					reader.refill(); //enough bits for a length code, its extra bits, the distance code and its extra bits (48)
+					unsigned long code = 0;
+					error = codetree.decode(reader, code); if (error) return;
+					if (code == 256) { if (reader.overrun()) error = 10; return; } //end code
 					else if (code <= 255) //literal symbol
 					{
-						if (pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
+						if (pos >= out.size()) reserve(out, pos, 1); //reserve more room
 						out[pos++] = (unsigned char)(code);
 					}
 					else if (code >= 257 && code <= 285) //length code
 					{
-						size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-						if ((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-						length += readBitsFromStream(bp, in, numextrabits);
-						unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if (error) return;
+						size_t length = LENBASE[code - 257] + reader.peek(LENEXTRA[code - 257]);
+						reader.consume(LENEXTRA[code - 257]);
+						unsigned long codeD = 0;
+						error = codetreeD.decode(reader, codeD); if (error) return;
 						if (codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-						unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-						if ((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-						dist += readBitsFromStream(bp, in, numextrabitsD);
-						size_t start = pos, back = start - dist; //backwards
-						if (pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-						for (size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if (back >= start) back = start - dist; }
+						size_t dist = DISTBASE[codeD] + reader.peek(DISTEXTRA[codeD]);
+						reader.consume(DISTEXTRA[codeD]);
+						if (reader.overrun()) { error = 51; return; } //error, bit pointer will jump past memory
+						if (dist > pos) { error = 52; return; } //error: the distance goes before the start of the output (or of the window)
+						reserve(out, pos, length); //reserve more room
+						unsigned char* dst = &out[pos];
+						const unsigned char* src = dst - dist;
+						if (dist >= length) memcpy(dst, src, length); //no overlap
+						else for (size_t i = 0; i < length; i++) dst[i] = src[i]; //the copy repeats the last 'dist' bytes
+						pos += length;
 					}
+					else { error = 16; return; } //error: 286 and 287 are not valid length codes
 				}
 			}
-			void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
+			void inflateNoCompression(std::vector<unsigned char>& out, BitReader& reader, size_t& pos)
 			{
-				while ((bp & 0x7) != 0) bp++; //go to first boundary of byte
-				size_t p = bp / 8;
-				if (p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
+				reader.alignToByte(); //go to first boundary of byte
+				size_t p = reader.bytePosition(), inlength = reader.size;
+				const unsigned char* in = reader.in;
+				if (p + 4 >= inlength) { error = 52; return; } //error, bit pointer will jump past memory
 				unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
 				if (LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-				if (pos + LEN >= out.size()) out.resize(pos + LEN);
+				reserve(out, pos, LEN);
 				if (p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-				for (unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-				bp = p * 8;
+				if (LEN) memcpy(&out[pos], &in[p], LEN); //LEN bytes of literal data
+				pos += LEN; p += LEN;
+				reader.seekByte(p);
 			}
 		};
-		int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
+		int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, OutputSink* sink = 0) //returns error value
 		{
 			Inflator inflator;
+			inflator.sink = sink;
 			if (in.size() < 2) { return 53; } //error, size of zlib data too small
 			if ((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
 			unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
@@ -232,13 +477,143 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 			std::vector<unsigned char> palette;
 		} info;
 		int error;
-		void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32)
+		void decode(std::vector<unsigned char>& out, unsigned int& channels, const unsigned char* in, size_t size, bool convert_to_rgba32, bool native, bool flip_y)
 		{
 			error = 0;
 			if (size == 0 || in == 0) { error = 48; return; } //the given data is empty
 			readPngHeader(&in[0], size); if (error) return;
-			size_t pos = 33; //first byte of the first chunk after the header
 			std::vector<unsigned char> idat; //the data from idat chunks
+			readChunks(in, size, idat); if (error) return;
+			unsigned long bpp = getBpp(info);
+			std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
+			Zlib zlib; //decompress with the Zlib decompressor
+			error = zlib.decompress(scanlines, idat); if (error) return; //stop if the zlib decompressor returned an error
+			size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
+			if (info.interlaceMethod == 0 && bpp >= 8) //no interlace and byte per byte: unfilter in place
+			{
+				//every line moves y bytes back (the filter type bytes before it), so the bytes written never
+				//reach the ones still to be read and no second buffer is needed
+				size_t linestart = 0, linelength = info.width * bytewidth;
+				unsigned char* data = scanlines.empty() ? 0 : &scanlines[0];
+				for (unsigned long y = 0; y < info.height; y++)
+				{
+					unsigned long filterType = data[linestart];
+					const unsigned char* prevline = (y == 0) ? 0 : &data[(y - 1) * linelength];
+					unFilterScanline(&data[linestart - y], &data[linestart + 1], prevline, bytewidth, filterType, linelength); if (error) return;
+					linestart += (1 + linelength); //go to start of next scanline
+				}
+				scanlines.resize(outlength);
+				out.swap(scanlines);
+			}
+			else
+			{
+				out.resize(outlength); //time to fill the out buffer
+				unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
+				if (info.interlaceMethod == 0) //no interlace, less than 8 bits per pixel, so fill it up bit per bit
+				{
+					size_t linestart = 0, linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
+					std::vector<unsigned char> templine(linelength), prevtempline(linelength); //only used if bpp < 8
+					for (size_t y = 0, obp = 0; y < info.height; y++)
+					{
+						unsigned long filterType = scanlines[linestart];
+						const unsigned char* prevline = (y == 0) ? 0 : &prevtempline[0]; //the previous line unfiltered, not the packed output
+						unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if (error) return;
+						for (size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
+						templine.swap(prevtempline);
+						linestart += (1 + linelength); //go to start of next scanline
+					}
+				}
+				else //interlaceMethod is 1 (Adam7)
+				{
+					size_t passw[7] = { (info.width + 7) / 8, (info.width + 3) / 8, (info.width + 3) / 4, (info.width + 1) / 4, (info.width + 1) / 2, (info.width + 0) / 2, (info.width + 0) / 1 };
+					size_t passh[7] = { (info.height + 7) / 8, (info.height + 7) / 8, (info.height + 3) / 8, (info.height + 3) / 4, (info.height + 1) / 4, (info.height + 1) / 2, (info.height + 0) / 2 };
+					size_t passstart[7] = { 0 };
+					size_t pattern[28] = { 0,4,0,2,0,1,0,0,0,4,0,2,0,1,8,8,4,4,2,2,1,8,8,8,4,4,2,2 }; //values for the adam7 passes
+					for (int i = 0; i < 6; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
+					std::vector<unsigned char> scanlineo((info.width * bpp + 7) / 8), scanlinen((info.width * bpp + 7) / 8); //"old" and "new" scanline
+					for (int i = 0; i < 7; i++)
+						adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[passstart[i]], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp);
+				}
+			}
+			std::vector<unsigned char>().swap(scanlines); //release it before converting
+			bool is_rgba = info.colorType == 6 && info.bitDepth == 8;
+			bool is_rgb = info.colorType == 2 && info.bitDepth == 8 && !info.key_defined;
+			channels = is_rgb ? 3 : 4;
+			if ((convert_to_rgba32 || native) && !is_rgba && !(native && is_rgb)) //conversion needed
+			{
+				std::vector<unsigned char> data;
+				data.swap(out);
+				error = convert(out, &data[0], info, info.width, info.height); if (error) return;
+			}
+			if (flip_y && info.height > 1) //swap the rows in place
+			{
+				size_t rowlength = out.size() / info.height;
+				std::vector<unsigned char> row(rowlength);
+				for (size_t y = 0; y < info.height / 2; y++)
+				{
+					unsigned char* top = &out[y * rowlength];
+					unsigned char* bottom = &out[(info.height - 1 - y) * rowlength];
+					memcpy(&row[0], top, rowlength);
+					memcpy(top, bottom, rowlength);
+					memcpy(bottom, &row[0], rowlength);
+				}
+			}
+		}
+		struct RowSink : Zlib::OutputSink //unfilters (and converts) every row as soon as it is decompressed
+		{
+			PNG& png; const PNGRowCallback& on_row; bool convert_rows;
+			size_t bytewidth, linelength; unsigned long y;
+			std::vector<unsigned char> row, prevrow, converted;
+			RowSink(PNG& png, const PNGRowCallback& on_row, bool convert_rows) : png(png), on_row(on_row), convert_rows(convert_rows), y(0)
+			{
+				unsigned long bpp = png.getBpp(png.info);
+				bytewidth = (bpp + 7) / 8; linelength = (png.info.width * bpp + 7) / 8;
+				row.resize(linelength); prevrow.resize(linelength);
+			}
+			size_t consume(const unsigned char* data, size_t size)
+			{
+				size_t used = 0;
+				for (; used + 1 + linelength <= size && y < png.info.height; used += 1 + linelength, y++)
+				{
+					png.unFilterScanline(&row[0], &data[used + 1], y ? &prevrow[0] : 0, bytewidth, data[used], linelength); if (png.error) return size;
+					const unsigned char* pixels = &row[0];
+					if (convert_rows) { png.error = png.convert(converted, &row[0], png.info, png.info.width, 1); if (png.error) return size; pixels = &converted[0]; }
+					on_row((unsigned int)y, pixels);
+					row.swap(prevrow);
+				}
+				return (y < png.info.height && !png.error) ? used : size; //anything after the last row is ignored
+			}
+		};
+		void decodeStream(const unsigned char* in, size_t size, unsigned int& channels, const PNGHeaderCallback& on_header, const PNGRowCallback& on_row)
+		{
+			error = 0;
+			if (size == 0 || in == 0) { error = 48; return; } //the given data is empty
+			readPngHeader(&in[0], size); if (error) return;
+			if (info.interlaceMethod == 1) //the rows of Adam7 images are spread over the 7 passes, they are decoded whole and given row by row
+			{
+				std::vector<unsigned char> out;
+				decode(out, channels, in, size, false, true, false); if (error) return;
+				if (!on_header((unsigned int)info.width, (unsigned int)info.height, channels)) { error = 90; return; } //stopped by the header callback
+				for (unsigned long y = 0; y < info.height; y++) on_row((unsigned int)y, &out[y * info.width * channels]);
+				return;
+			}
+			std::vector<unsigned char> idat; //the data from idat chunks
+			readChunks(in, size, idat); if (error) return;
+			bool is_rgba = info.colorType == 6 && info.bitDepth == 8, is_rgb = info.colorType == 2 && info.bitDepth == 8 && !info.key_defined;
+			channels = is_rgb ? 3 : 4;
+			if (!on_header((unsigned int)info.width, (unsigned int)info.height, channels)) { error = 90; return; } //stopped by the header callback
+			RowSink sink(*this, on_row, !is_rgb && !is_rgba);
+			//room for the deflate window and a few rows, the inflator moves the window back to the start when it gets full
+			std::vector<unsigned char> window(Zlib::Inflator::WINDOW + std::max((size_t)65536, 4 * (1 + sink.linelength)));
+			Zlib zlib;
+			int zlib_error = zlib.decompress(window, idat, &sink);
+			if (error) return; //an error while unfiltering or converting
+			error = zlib_error; if (error) return;
+			if (sink.y < info.height) { error = 91; return; } //the image data ends before the last row
+		}
+		void readChunks(const unsigned char* in, size_t size, std::vector<unsigned char>& idat) //reads the palette and transparency and gathers the image data
+		{
+			size_t pos = 33; //first byte of the first chunk after the header
 			bool IEND = false, known_type = true;
 			info.key_defined = false;
 			while (!IEND) //loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer
@@ -295,53 +670,6 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 				}
 				pos += 4; //step over CRC (which is ignored)
 			}
-			unsigned long bpp = getBpp(info);
-			std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
-			Zlib zlib; //decompress with the Zlib decompressor
-			error = zlib.decompress(scanlines, idat); if (error) return; //stop if the zlib decompressor returned an error
-			size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
-			out.resize(outlength); //time to fill the out buffer
-			unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
-			if (info.interlaceMethod == 0) //no interlace, just filter
-			{
-				size_t linestart = 0, linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
-				if (bpp >= 8) //byte per byte
-					for (unsigned long y = 0; y < info.height; y++)
-					{
-						unsigned long filterType = scanlines[linestart];
-						const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
-						unFilterScanline(&out_[linestart - y], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if (error) return;
-						linestart += (1 + linelength); //go to start of next scanline
-					}
-				else //less than 8 bits per pixel, so fill it up bit per bit
-				{
-					std::vector<unsigned char> templine((info.width * bpp + 7) >> 3); //only used if bpp < 8
-					for (size_t y = 0, obp = 0; y < info.height; y++)
-					{
-						unsigned long filterType = scanlines[linestart];
-						const unsigned char* prevline = (y == 0) ? 0 : &out_[(y - 1) * info.width * bytewidth];
-						unFilterScanline(&templine[0], &scanlines[linestart + 1], prevline, bytewidth, filterType, linelength); if (error) return;
-						for (size_t bp = 0; bp < info.width * bpp;) setBitOfReversedStream(obp, out_, readBitFromReversedStream(bp, &templine[0]));
-						linestart += (1 + linelength); //go to start of next scanline
-					}
-				}
-			}
-			else //interlaceMethod is 1 (Adam7)
-			{
-				size_t passw[7] = { (info.width + 7) / 8, (info.width + 3) / 8, (info.width + 3) / 4, (info.width + 1) / 4, (info.width + 1) / 2, (info.width + 0) / 2, (info.width + 0) / 1 };
-				size_t passh[7] = { (info.height + 7) / 8, (info.height + 7) / 8, (info.height + 3) / 8, (info.height + 3) / 4, (info.height + 1) / 4, (info.height + 1) / 2, (info.height + 0) / 2 };
-				size_t passstart[7] = { 0 };
-				size_t pattern[28] = { 0,4,0,2,0,1,0,0,0,4,0,2,0,1,8,8,4,4,2,2,1,8,8,8,4,4,2,2 }; //values for the adam7 passes
-				for (int i = 0; i < 6; i++) passstart[i + 1] = passstart[i] + passh[i] * ((passw[i] ? 1 : 0) + (passw[i] * bpp + 7) / 8);
-				std::vector<unsigned char> scanlineo((info.width * bpp + 7) / 8), scanlinen((info.width * bpp + 7) / 8); //"old" and "new" scanline
-				for (int i = 0; i < 7; i++)
-					adam7Pass(&out_[0], &scanlinen[0], &scanlineo[0], &scanlines[passstart[i]], info.width, pattern[i], pattern[i + 7], pattern[i + 14], pattern[i + 21], passw[i], passh[i], bpp);
-			}
-			if (convert_to_rgba32 && (info.colorType != 6 || info.bitDepth != 8)) //conversion needed
-			{
-				std::vector<unsigned char> data = out;
-				error = convert(out, &data[0], info, info.width, info.height);
-			}
 		}
 		void readPngHeader(const unsigned char* in, size_t inlength) //read the information from the header and store it in the Info
 		{
@@ -357,43 +685,10 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 		}
 		void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
 		{
-			switch (filterType)
-			{
-			case 0: for (size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
-			case 1:
-				for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
-				for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
-				break;
-			case 2:
-				if (precon) for (size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
-				else       for (size_t i = 0; i < length; i++) recon[i] = scanline[i];
-				break;
-			case 3:
-				if (precon)
-				{
-					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
-					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-				}
-				else
-				{
-					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
-					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
-				}
-				break;
-			case 4:
-				if (precon)
-				{
-					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
-					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
-				}
-				else
-				{
-					for (size_t i = 0; i < bytewidth; i++) recon[i] = scanline[i];
-					for (size_t i = bytewidth; i < length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], 0, 0);
-				}
-				break;
-			default: error = 36; return; //error: unexisting filter type given
-			}
+#if defined(USE_SSE2)
+			if (unFilterScanlineSSE2(recon, scanline, precon, bytewidth, filterType, length)) return;
+#endif
+			if (!unFilterScanlineScalar(recon, scanline, precon, bytewidth, filterType, length)) error = 36; //error: unexisting filter type given
 		}
 		void adam7Pass(unsigned char* out, unsigned char* linen, unsigned char* lineo, const unsigned char* in, unsigned long w, size_t passleft, size_t passtop, size_t spacex, size_t spacey, size_t passw, size_t passh, unsigned long bpp)
 		{ //filter and reposition the pixels into the output when the image is Adam7 interlaced. This function can only do it after the full image is already decoded. The out buffer must have the correct allocated memory size already.
@@ -500,16 +795,29 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width,
 				}
 			return 0;
 		}
-		unsigned char paethPredictor(short a, short b, short c) //Paeth predicter, used by PNG filter type 4
-		{
-			short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
-			return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
-		}
 	};
 
-	PNG decoder; 
-	decoder.decode(out_image, in_png, in_size, convert_to_rgba32);
+	PNG decoder;
+	decoder.info.width = decoder.info.height = 0; //in case the header is never read
+	if (on_row) decoder.decodeStream(in_png, in_size, channels, *on_header, *on_row);
+	else decoder.decode(out_image, channels, in_png, in_size, convert_to_rgba32, native, flip_y);
 	image_width = decoder.info.width;
 	image_height = decoder.info.height;
 	return decoder.error;
-}
\ No newline at end of file
+}
+int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32)
+{
+	unsigned int channels = 0;
+	return decodePNGImpl(out_image, image_width, image_height, channels, in_png, in_size, convert_to_rgba32, false, false);
+}
+
+int decodePNGNative(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, unsigned int& channels, const unsigned char* in_png, size_t in_size, bool flip_y)
+{
+	return decodePNGImpl(out_image, image_width, image_height, channels, in_png, in_size, false, true, flip_y);
+}
+
+int decodePNGStream(unsigned int& image_width, unsigned int& image_height, unsigned int& channels, const unsigned char* in_png, size_t in_size, const PNGHeaderCallback& on_header, const PNGRowCallback& on_row)
+{
+	std::vector<unsigned char> unused;
+	return decodePNGImpl(unused, image_width, image_height, channels, in_png, in_size, false, true, false, &on_header, &on_row);
+}
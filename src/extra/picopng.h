@@ -1,6 +1,23 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 #include <string.h>
 
-int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true);
\ No newline at end of file
+int decodePNG(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true);
+
+// Decodes in the final upload layout with a single output buffer: 8 bit RGB (channels = 3) and RGBA (channels = 4)
+// are returned as they are, any other format is converted to RGBA. With flip_y the first row is the bottom one.
+int decodePNGNative(std::vector<unsigned char>& out_image, unsigned int& image_width, unsigned int& image_height, unsigned int& channels, const unsigned char* in_png, size_t in_size, bool flip_y = false);
+
+// Streaming decode: the image is inflated a piece at a time and every row is given to on_row as soon as it is
+// unfiltered, top to bottom, so only a few rows are kept in memory besides the file. on_header is called before
+// the first row with the size and the channels of the rows (same formats as decodePNGNative), returning false
+// stops the decoding. The row pointer is only valid during the call. Interlaced images are decoded whole first.
+typedef std::function<bool(unsigned int width, unsigned int height, unsigned int channels)> PNGHeaderCallback;
+typedef std::function<void(unsigned int y, const unsigned char* row)> PNGRowCallback;
+int decodePNGStream(unsigned int& image_width, unsigned int& image_height, unsigned int& channels, const unsigned char* in_png, size_t in_size, const PNGHeaderCallback& on_header, const PNGRowCallback& on_row);
+
+// Unfilters random rows with the five filter types and 1 to 8 bytes per pixel through the SIMD code (when there
+// is) and through the byte by byte code. Returns false, printing the cases, if they differ. Run by --bench-png
+bool checkPNGUnfilter();
@@ -34,6 +34,9 @@ void Application::Render(void)
 	// ...
 
 	framebuffer.Render();
+
+	if (recorder.IsRecording())
+		recorder.Capture(framebuffer);
 }
 
 // Called after render
@@ -47,7 +50,13 @@ void Application::OnKeyPressed( SDL_KeyboardEvent event )
 {
 	// KEY CODES: https://wiki.libsdl.org/SDL2/SDL_Keycode
 	switch(event.keysym.sym) {
-		case SDLK_ESCAPE: exit(0); break; // ESC key, kill the app
+		case SDLK_ESCAPE: recorder.Stop(); exit(0); break; // ESC key, kill the app (the recorded frames are written first)
+		case SDLK_F9: // Start or stop recording the frames
+			if (recorder.IsRecording())
+				recorder.Stop();
+			else if (makeDirectory(absResPath("recording")))
+				recorder.Start("recording/frame", framebuffer.width, framebuffer.height);
+			break;
 	}
 }
 
@@ -7,6 +7,7 @@
 #include "main/includes.h"
 #include "framework.h"
 #include "image.h"
+#include "framerecorder.h"
 
 class Application
 {
@@ -36,6 +37,9 @@ public:
 	// CPU Global framebuffer
 	Image framebuffer;
 
+	// Writes every rendered frame to res/recording (F9 starts and stops it)
+	FrameRecorder recorder;
+
 	// Constructor and main methods
 	Application(const char* caption, int width, int height);
 	~Application();
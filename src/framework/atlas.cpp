@@ -0,0 +1,315 @@
+#include "atlas.h"
+#include "texture.h"
+#include "utils.h"
+#include "../extra/picopng.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Top of the used area along x: the packer only places images on top of it (bottom-left heuristic)
+struct sSkylineNode
+{
+	unsigned int x, y, width;
+};
+
+// Lowest position where a width x height rectangle fits, the one further left on ties
+static bool FindSkylinePosition(const std::vector<sSkylineNode>& skyline, unsigned int atlas_width, unsigned int width, unsigned int& best_x, unsigned int& best_y)
+{
+	bool found = false;
+	for (size_t i = 0; i < skyline.size(); ++i)
+	{
+		unsigned int x = skyline[i].x;
+		if (x + width > atlas_width)
+			break;
+
+		// The rectangle rests on the highest node below it
+		unsigned int y = 0;
+		for (size_t j = i; j < skyline.size() && skyline[j].x < x + width; ++j)
+			y = std::max(y, skyline[j].y);
+
+		if (!found || y < best_y)
+		{
+			best_x = x;
+			best_y = y;
+			found = true;
+		}
+	}
+	return found;
+}
+
+static void AddSkylineLevel(std::vector<sSkylineNode>& skyline, unsigned int x, unsigned int y, unsigned int width)
+{
+	// Nodes covered by the new one are removed or shortened
+	std::vector<sSkylineNode> result;
+	for (size_t i = 0; i < skyline.size(); ++i)
+	{
+		const sSkylineNode& node = skyline[i];
+		unsigned int end = node.x + node.width;
+		if (end <= x || node.x >= x + width)
+			result.push_back(node);
+		else
+		{
+			if (node.x < x)
+				result.push_back({ node.x, node.y, x - node.x });
+			if (end > x + width)
+				result.push_back({ x + width, node.y, end - (x + width) });
+		}
+	}
+
+	sSkylineNode level = { x, y, width };
+	result.insert(std::upper_bound(result.begin(), result.end(), level, [](const sSkylineNode& a, const sSkylineNode& b) { return a.x < b.x; }), level);
+
+	// Neighbours at the same height become a single node
+	skyline.clear();
+	for (size_t i = 0; i < result.size(); ++i)
+	{
+		if (!skyline.empty() && skyline.back().y == result[i].y)
+			skyline.back().width += result[i].width;
+		else
+			skyline.push_back(result[i]);
+	}
+}
+
+bool Atlas::Pack(const std::vector<std::string>& names, const std::vector<Image>& images, unsigned int max_width, unsigned int padding)
+{
+	rects.clear();
+	if (images.empty() || names.size() != images.size())
+		return false;
+
+	// Width: roughly square, but never narrower than the widest image
+	unsigned int widest = 0;
+	size_t area = 0;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		widest = std::max(widest, images[i].width + padding);
+		area += (images[i].width + padding) * (images[i].height + padding);
+	}
+	if (widest > max_width)
+	{
+		std::cerr << "Atlas: an image is wider than " << max_width << " pixels" << std::endl;
+		return false;
+	}
+	unsigned int atlas_width = 1;
+	while (atlas_width * atlas_width < area)
+		atlas_width *= 2;
+	atlas_width = std::min(max_width, std::max(atlas_width, widest));
+
+	// Taller images first leave less holes under the skyline
+	std::vector<unsigned int> order(images.size());
+	for (unsigned int i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return images[a].height > images[b].height; });
+
+	std::vector<sSkylineNode> skyline(1, sSkylineNode{ 0, 0, atlas_width });
+	rects.resize(images.size());
+	unsigned int atlas_height = 0;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const Image& img = images[order[i]];
+		unsigned int x = 0, y = 0;
+		FindSkylinePosition(skyline, atlas_width, img.width + padding, x, y);
+		AddSkylineLevel(skyline, x, y + img.height + padding, img.width + padding);
+
+		sAtlasRect& rect = rects[order[i]];
+		rect.name = names[order[i]];
+		rect.x = x;
+		rect.y = y;
+		rect.width = img.width;
+		rect.height = img.height;
+		atlas_height = std::max(atlas_height, y + img.height);
+	}
+
+	image = Image(atlas_width, atlas_height);
+	for (size_t i = 0; i < rects.size(); ++i)
+	{
+		const sAtlasRect& rect = rects[i];
+		for (unsigned int y = 0; y < rect.height; ++y)
+			memcpy(&image.pixels[(rect.y + y) * atlas_width + rect.x], &images[i].pixels[y * rect.width], rect.width * sizeof(Color));
+	}
+
+	UpdateLookup();
+	return true;
+}
+
+void Atlas::UpdateLookup()
+{
+	rect_by_name.clear();
+	for (unsigned int i = 0; i < rects.size(); ++i)
+	{
+		sAtlasRect& rect = rects[i];
+		rect.uv_min.set(rect.x / (float)image.width, rect.y / (float)image.height);
+		rect.uv_max.set((rect.x + rect.width) / (float)image.width, (rect.y + rect.height) / (float)image.height);
+		rect_by_name[rect.name] = i;
+	}
+}
+
+bool Atlas::Build(const std::string& directory, const std::string& cache_filename, unsigned int max_width, unsigned int padding)
+{
+	std::string full_path = absResPath(directory);
+	std::vector<std::string> names;
+	if (!listFiles(full_path, ".png", names) || names.empty())
+	{
+		std::cerr << "Atlas: no PNG images in " << full_path << std::endl;
+		return false;
+	}
+
+	// The key depends on the names and contents of all the files, any change packs them again
+	std::vector< std::vector<unsigned char> > files(names.size());
+	unsigned long long key = 14695981039346656037ULL;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		// Empty files fail here too, the hash and the decoder below take a pointer to their first byte
+		if (!readFile(full_path + "/" + names[i], files[i]) || files[i].empty())
+		{
+			std::cerr << "Atlas: can not read " << names[i] << std::endl;
+			return false;
+		}
+		key = (key ^ hashBytes(names[i].c_str(), names[i].size())) * 1099511628211ULL;
+		key = (key ^ hashBytes(&files[i][0], files[i].size())) * 1099511628211ULL;
+	}
+	key ^= (unsigned long long)max_width << 32 | padding;
+
+	if (!cache_filename.empty() && Load(cache_filename, key))
+		return true;
+
+	// Every image is decoded on its own thread
+	std::vector<Image> images(names.size());
+	std::vector<char> decoded(names.size(), 0);
+	parallelFor(0, (int)names.size(), [&](int i) {
+		std::vector<unsigned char> data;
+		unsigned int w, h, channels;
+		if (decodePNGNative(data, w, h, channels, &files[i][0], files[i].size(), true) != 0)
+			return;
+		std::vector<unsigned char>().swap(files[i]);
+
+		Image& img = images[i];
+		img = Image(w, h);
+		if (channels == 3)
+			memcpy(img.pixels, &data[0], w * h * sizeof(Color));
+		else
+			for (unsigned int p = 0; p < w * h; ++p)
+				img.pixels[p] = Color(data[p * 4], data[p * 4 + 1], data[p * 4 + 2]);
+		decoded[i] = 1;
+	});
+	for (size_t i = 0; i < names.size(); ++i)
+		if (!decoded[i])
+		{
+			std::cerr << "Atlas: error decoding " << names[i] << std::endl;
+			return false;
+		}
+
+	if (!Pack(names, images, max_width, padding))
+		return false;
+	if (!cache_filename.empty())
+		Save(cache_filename, key);
+	return true;
+}
+
+int Atlas::GetRect(const std::string& name) const
+{
+	std::map<std::string, unsigned int>::const_iterator it = rect_by_name.find(name);
+	return it == rect_by_name.end() ? -1 : (int)it->second;
+}
+
+void Atlas::Draw(Image& framebuffer, const sAtlasDraw* draws, unsigned int count) const
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const sAtlasRect& rect = rects[draws[i].rect];
+
+		// Part of the rectangle inside the framebuffer
+		int start_x = std::max(0, -draws[i].x);
+		int start_y = std::max(0, -draws[i].y);
+		int end_x = std::min((int)rect.width, (int)framebuffer.width - draws[i].x);
+		int end_y = std::min((int)rect.height, (int)framebuffer.height - draws[i].y);
+		if (start_x >= end_x)
+			continue;
+
+		for (int y = start_y; y < end_y; ++y)
+			memcpy(&framebuffer.pixels[(draws[i].y + y) * framebuffer.width + draws[i].x + start_x],
+				&image.pixels[(rect.y + y) * image.width + rect.x + start_x], (end_x - start_x) * sizeof(Color));
+	}
+}
+
+void Atlas::Draw(Image& framebuffer, const std::string& name, int x, int y) const
+{
+	int rect = GetRect(name);
+	if (rect < 0)
+		return;
+	sAtlasDraw draw = { (unsigned int)rect, x, y };
+	Draw(framebuffer, &draw, 1);
+}
+
+void Atlas::Upload(Texture& texture) const
+{
+	texture.Create(image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, false, (Uint8*)image.pixels);
+}
+
+// File layout: "ATLS", key, width, height, number of rects, the rects (name length, name, x, y, width, height) and the pixels
+bool Atlas::Save(const std::string& filename, unsigned long long key) const
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	unsigned int header[3] = { image.width, image.height, (unsigned int)rects.size() };
+	bool ok = fwrite("ATLS", 1, 4, file) == 4 && fwrite(&key, sizeof(key), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; ok && i < rects.size(); ++i)
+	{
+		const sAtlasRect& rect = rects[i];
+		unsigned int values[5] = { (unsigned int)rect.name.size(), rect.x, rect.y, rect.width, rect.height };
+		ok = fwrite(values, sizeof(values), 1, file) == 1 && fwrite(rect.name.c_str(), 1, rect.name.size(), file) == rect.name.size();
+	}
+	ok = ok && fwrite(image.pixels, sizeof(Color), image.width * image.height, file) == image.width * image.height;
+	fclose(file);
+
+	if (!ok)
+		std::cerr << "Error saving atlas: " << filename << std::endl;
+	return ok;
+}
+
+bool Atlas::Load(const std::string& filename, unsigned long long key)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		return false;
+
+	char magic[4];
+	unsigned long long file_key;
+	unsigned int header[3];
+	bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "ATLS", 4) == 0 &&
+		fread(&file_key, sizeof(file_key), 1, file) == 1 && file_key == key &&
+		fread(header, sizeof(header), 1, file) == 1;
+
+	std::vector<sAtlasRect> new_rects(ok ? header[2] : 0);
+	for (size_t i = 0; ok && i < new_rects.size(); ++i)
+	{
+		sAtlasRect& rect = new_rects[i];
+		unsigned int values[5];
+		ok = fread(values, sizeof(values), 1, file) == 1 && values[0] < 1024 &&
+			values[1] + values[3] <= header[0] && values[2] + values[4] <= header[1];
+		if (!ok)
+			break;
+		rect.name.resize(values[0]);
+		ok = values[0] == 0 || fread(&rect.name[0], 1, values[0], file) == values[0];
+		rect.x = values[1];
+		rect.y = values[2];
+		rect.width = values[3];
+		rect.height = values[4];
+	}
+
+	Image new_image;
+	if (ok)
+	{
+		new_image = Image(header[0], header[1]);
+		ok = fread(new_image.pixels, sizeof(Color), header[0] * header[1], file) == header[0] * header[1];
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+
+	image = new_image;
+	rects.swap(new_rects);
+	UpdateLookup();
+	return true;
+}
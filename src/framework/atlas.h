@@ -0,0 +1,64 @@
+/*
+	Packs many small images (icons, sprites...) in a single Image with a skyline packer, so they can be
+	uploaded as one Texture and drawn with a single call. Every image keeps its rectangle in pixels and in UVs.
+	The packed atlas can be saved to disk and loaded on the next start instead of decoding and packing again.
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include "framework.h"
+#include "image.h"
+
+class Texture;
+
+class Atlas
+{
+public:
+	struct sAtlasRect
+	{
+		std::string name;			// File name of the image (pencil.png...)
+		unsigned int x, y;			// Bottom left pixel in the atlas
+		unsigned int width, height;
+		Vector2 uv_min, uv_max;		// Same rectangle in texture coordinates
+	};
+
+	// One copy of a rectangle of the atlas into the framebuffer, x,y is where its bottom left pixel goes
+	struct sAtlasDraw
+	{
+		unsigned int rect;
+		int x, y;
+	};
+
+	Image image;
+	std::vector<sAtlasRect> rects;
+
+	// Packs all the PNG images of a folder (relative to res, like "images"). With a cache filename the result is
+	// saved there and reused while the files do not change. The atlas is at most max_width pixels wide and
+	// leaves 'padding' pixels between images so bilinear filtering does not mix them.
+	bool Build(const std::string& directory, const std::string& cache_filename = "", unsigned int max_width = 2048, unsigned int padding = 1);
+
+	// Packs images from memory, names[i] identifies images[i]. False if an image is wider than max_width
+	bool Pack(const std::vector<std::string>& names, const std::vector<Image>& images, unsigned int max_width = 2048, unsigned int padding = 1);
+
+	// Index of the rectangle of an image or -1 if it is not in the atlas
+	int GetRect(const std::string& name) const;
+	const sAtlasRect& GetRect(unsigned int index) const { return rects[index]; }
+
+	// Copies all the rectangles in one pass (clipped to the framebuffer)
+	void Draw(Image& framebuffer, const sAtlasDraw* draws, unsigned int count) const;
+	void Draw(Image& framebuffer, const std::string& name, int x, int y) const;
+
+	// Creates the texture with the whole atlas (no mipmaps, they would mix the images)
+	void Upload(Texture& texture) const;
+
+	// Disk cache, 'key' identifies the source images and Load fails if it does not match
+	bool Save(const std::string& filename, unsigned long long key) const;
+	bool Load(const std::string& filename, unsigned long long key);
+
+protected:
+	std::map<std::string, unsigned int> rect_by_name;
+	void UpdateLookup();
+};
@@ -0,0 +1,154 @@
+#include "blend.h"
+
+#include <algorithm>
+
+// Exact rounded x / 255 for x <= 255 * 255, without a division
+static inline unsigned char Div255(unsigned int x)
+{
+	x += 128;
+	return (unsigned char)((x + (x >> 8)) >> 8);
+}
+
+static inline unsigned char BlendChannel(unsigned char d, unsigned char s, eBlendMode mode)
+{
+	switch (mode)
+	{
+		case BLEND_ADD: return (unsigned char)std::min(255, d + s);
+		case BLEND_SUBTRACT: return (unsigned char)std::max(0, d - s);
+		case BLEND_MULTIPLY: return Div255(d * s);
+		case BLEND_SCREEN: return 255 - Div255((255 - d) * (255 - s));
+		default: return s;
+	}
+}
+
+#if defined(USE_SSE2)
+typedef __m128i byte16;
+
+static inline __m128i Div255x8(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// (a * b + c * d) / 255 for 16 bytes, the sum must fit in 255 * 255
+static inline __m128i MulAdd255(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+		_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+	__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+		_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+	return _mm_packus_epi16(Div255x8(lo), Div255x8(hi));
+}
+
+static inline __m128i Mul255(__m128i a, __m128i b)
+{
+	return MulAdd255(a, b, _mm_setzero_si128(), _mm_setzero_si128());
+}
+
+static inline byte16 Load16(const unsigned char* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void Store16(unsigned char* p, byte16 v) { _mm_storeu_si128((__m128i*)p, v); }
+
+static inline byte16 Blend16(byte16 d, byte16 s, eBlendMode mode)
+{
+	const __m128i ones = _mm_set1_epi8((char)0xFF);
+	switch (mode)
+	{
+		case BLEND_ADD: return _mm_adds_epu8(d, s);
+		case BLEND_SUBTRACT: return _mm_subs_epu8(d, s);
+		case BLEND_MULTIPLY: return Mul255(d, s);
+		case BLEND_SCREEN: return _mm_xor_si128(Mul255(_mm_xor_si128(d, ones), _mm_xor_si128(s, ones)), ones);
+		default: return s;
+	}
+}
+
+// d * (255 - a) / 255 + r * a / 255
+static inline byte16 Lerp16(byte16 d, byte16 r, byte16 a)
+{
+	return MulAdd255(d, _mm_xor_si128(a, _mm_set1_epi8((char)0xFF)), r, a);
+}
+#elif defined(USE_NEON)
+typedef uint8x16_t byte16;
+
+static inline uint8x8_t Div255x8(uint16x8_t x)
+{
+	return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static inline uint8x16_t Mul255(uint8x16_t a, uint8x16_t b)
+{
+	return vcombine_u8(Div255x8(vmull_u8(vget_low_u8(a), vget_low_u8(b))), Div255x8(vmull_u8(vget_high_u8(a), vget_high_u8(b))));
+}
+
+static inline byte16 Load16(const unsigned char* p) { return vld1q_u8(p); }
+static inline void Store16(unsigned char* p, byte16 v) { vst1q_u8(p, v); }
+
+static inline byte16 Blend16(byte16 d, byte16 s, eBlendMode mode)
+{
+	switch (mode)
+	{
+		case BLEND_ADD: return vqaddq_u8(d, s);
+		case BLEND_SUBTRACT: return vqsubq_u8(d, s);
+		case BLEND_MULTIPLY: return Mul255(d, s);
+		case BLEND_SCREEN: return vmvnq_u8(Mul255(vmvnq_u8(d), vmvnq_u8(s)));
+		default: return s;
+	}
+}
+
+static inline byte16 Lerp16(byte16 d, byte16 r, byte16 a)
+{
+	uint8x16_t ia = vmvnq_u8(a);
+	uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(d), vget_low_u8(ia)), vget_low_u8(r), vget_low_u8(a));
+	uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(d), vget_high_u8(ia)), vget_high_u8(r), vget_high_u8(a));
+	return vcombine_u8(Div255x8(lo), Div255x8(hi));
+}
+#endif
+
+// Pixels processed at once when a weight is needed: 48 pixels are 144 bytes, 9 SIMD registers
+#define BLEND_CHUNK_PIXELS 48
+
+void BlendRow(Color* dst, const Color* src, const unsigned char* mask, unsigned int count, eBlendMode mode, unsigned char opacity)
+{
+	unsigned char* d = dst->v;
+	const unsigned char* s = src->v;
+
+	// The blend modes work per channel, so the row is just an array of bytes
+	if (!mask && opacity == 255)
+	{
+		unsigned int bytes = count * 3;
+		unsigned int i = 0;
+#if defined(USE_SSE2) || defined(USE_NEON)
+		for (; i + 16 <= bytes; i += 16)
+			Store16(d + i, Blend16(Load16(d + i), Load16(s + i), mode));
+#endif
+		for (; i < bytes; ++i)
+			d[i] = BlendChannel(d[i], s[i], mode);
+		return;
+	}
+
+	// Otherwise the weight of every pixel is expanded to its 3 channels, one chunk at a time
+	unsigned char weights[BLEND_CHUNK_PIXELS * 3];
+	for (unsigned int start = 0; start < count; start += BLEND_CHUNK_PIXELS)
+	{
+		unsigned int pixels = std::min((unsigned int)BLEND_CHUNK_PIXELS, count - start);
+		for (unsigned int p = 0; p < pixels; ++p)
+		{
+			unsigned char w = mask ? Div255(mask[start + p] * opacity) : opacity;
+			weights[p * 3] = weights[p * 3 + 1] = weights[p * 3 + 2] = w;
+		}
+
+		unsigned char* cd = d + start * 3;
+		const unsigned char* cs = s + start * 3;
+		unsigned int bytes = pixels * 3;
+		unsigned int i = 0;
+#if defined(USE_SSE2) || defined(USE_NEON)
+		for (; i + 16 <= bytes; i += 16)
+		{
+			byte16 vd = Load16(cd + i);
+			Store16(cd + i, Lerp16(vd, Blend16(vd, Load16(cs + i), mode), Load16(weights + i)));
+		}
+#endif
+		for (; i < bytes; ++i)
+			cd[i] = Div255(cd[i] * (255 - weights[i]) + BlendChannel(cd[i], cs[i], mode) * weights[i]);
+	}
+}
@@ -0,0 +1,21 @@
+/*
+	Saturating blend modes for rows of packed RGB pixels (Color).
+	The byte arithmetic is done 16 channels at a time with SSE2 or NEON, with a scalar fallback.
+	Use Image::Blend to composite whole images.
+*/
+
+#pragma once
+
+#include "framework.h"
+
+enum eBlendMode {
+	BLEND_ADD,		// dst + src
+	BLEND_SUBTRACT,	// dst - src
+	BLEND_MULTIPLY,	// dst * src / 255
+	BLEND_SCREEN,	// 255 - (255 - dst) * (255 - src) / 255
+	BLEND_ALPHA		// src over dst, the opacity comes from the mask and 'opacity'
+};
+
+// Blends 'count' pixels of src into dst. The blended result is mixed with the original dst using
+// mask[i] * opacity / 255 as weight (mask can be NULL, one byte per pixel). All the results are clamped to [0..255].
+void BlendRow(Color* dst, const Color* src, const unsigned char* mask, unsigned int count, eBlendMode mode, unsigned char opacity = 255);
@@ -6,20 +6,22 @@
 Camera::Camera()
 {
 	view_matrix.SetIdentity();
+	inverse_view_matrix.SetIdentity();
+	view_dirty = false;
 	SetOrthographic(-1,1,1,-1,-1,1);
+	Update();
 }
 
 Vector3 Camera::GetLocalVector(const Vector3& v)
 {
-	Matrix44 iV = view_matrix;
-	if (iV.Inverse() == false)
-		std::cout << "Matrix Inverse error" << std::endl;
-	Vector3 result = iV.RotateVector(v);
-	return result;
+	// The inverse is cached, the camera matrix only changes when the camera moves
+	Update();
+	return inverse_view_matrix.RotateVector(v);
 }
 
 Vector3 Camera::ProjectVector(Vector3 pos, bool& negZ)
 {
+	Update();
 	Vector4 pos4 = Vector4(pos.x, pos.y, pos.z, 1.0);
 	Vector4 result = viewprojection_matrix * pos4;
 	negZ = result.z < 0;
@@ -35,7 +37,7 @@ void Camera::Rotate(float angle, const Vector3& axis)
 	R.SetRotation(angle, axis);
 	Vector3 new_front = R * (center - eye);
 	center = eye + new_front;
-	UpdateViewMatrix();
+	view_dirty = true;
 }
 
 void Camera::Move(Vector3 delta)
@@ -43,7 +45,7 @@ void Camera::Move(Vector3 delta)
 	Vector3 localDelta = GetLocalVector(delta);
 	eye = eye - localDelta;
 	center = center - localDelta;
-	UpdateViewMatrix();
+	view_dirty = true;
 }
 
 void Camera::SetOrthographic(float left, float right, float top, float bottom, float near_plane, float far_plane)
@@ -57,7 +59,7 @@ void Camera::SetOrthographic(float left, float right, float top, float bottom, f
 	this->near_plane = near_plane;
 	this->far_plane = far_plane;
 
-	UpdateProjectionMatrix();
+	projection_dirty = true;
 }
 
 void Camera::SetPerspective(float fov, float aspect, float near_plane, float far_plane)
@@ -69,7 +71,7 @@ void Camera::SetPerspective(float fov, float aspect, float near_plane, float far
 	this->near_plane = near_plane;
 	this->far_plane = far_plane;
 
-	UpdateProjectionMatrix();
+	projection_dirty = true;
 }
 
 void Camera::LookAt(const Vector3& eye, const Vector3& center, const Vector3& up)
@@ -78,65 +80,202 @@ void Camera::LookAt(const Vector3& eye, const Vector3& center, const Vector3& up
 	this->center = center;
 	this->up = up;
 
-	UpdateViewMatrix();
+	view_dirty = true;
 }
 
-void Camera::UpdateViewMatrix()
+void Camera::Update()
 {
-	// Reset Matrix (Identity)
-	view_matrix.SetIdentity();
+	if (!view_dirty && !projection_dirty)
+		return;
 
-	// Comment this line to create your own projection matrix!
-	SetExampleViewMatrix();
+	if (view_dirty)
+		UpdateViewMatrix();
+	if (projection_dirty)
+		UpdateProjectionMatrix();
+}
+
+// Same matrix as gluLookAt
+void Camera::UpdateViewMatrix()
+{
+	Vector3 front = (center - eye).Normalize();
+	Vector3 side = front.Cross(up).Normalize();
+	Vector3 top_dir = side.Cross(front);
 
-	// Remember how to fill a Matrix4x4 (check framework slides)
-	// Careful with the order of matrix multiplications, and be sure to use normalized vectors!
-	
-	// Create the view matrix rotation
-	// ...
-	// view_matrix.M[3][3] = 1.0;
+	view_matrix.Set(
+		side.x, side.y, side.z, -side.Dot(eye),
+		top_dir.x, top_dir.y, top_dir.z, -top_dir.Dot(eye),
+		-front.x, -front.y, -front.z, front.Dot(eye),
+		0, 0, 0, 1);
 
-	// Translate view matrix
-	// ...
+	// The rotation is orthonormal, so the inverse is the transposed rotation with the eye as translation
+	inverse_view_matrix.Set(
+		side.x, top_dir.x, -front.x, eye.x,
+		side.y, top_dir.y, -front.y, eye.y,
+		side.z, top_dir.z, -front.z, eye.z,
+		0, 0, 0, 1);
 
-	UpdateViewProjectionMatrix();
+	view_dirty = false;
+	if (!projection_dirty)
+		UpdateViewProjectionMatrix();
 }
 
-// Create a projection matrix
+// Same matrices as gluPerspective and glOrtho
 void Camera::UpdateProjectionMatrix()
 {
-	// Reset Matrix (Identity)
-	projection_matrix.SetIdentity();
-
-	// Comment this line to create your own projection matrix!
-	SetExampleProjectionMatrix();
-
-	// Remember how to fill a Matrix4x4 (check framework slides)
-	
 	if (type == PERSPECTIVE) {
-		// projection_matrix.M[2][3] = -1;
-		// ...
+		float f = 1.0f / tanf(fov * DEG2RAD * 0.5f);
+		float depth = near_plane - far_plane;
+		projection_matrix.Set(
+			f / aspect, 0, 0, 0,
+			0, f, 0, 0,
+			0, 0, (far_plane + near_plane) / depth, 2.0f * far_plane * near_plane / depth,
+			0, 0, -1, 0);
 	}
 	else if (type == ORTHOGRAPHIC) {
-		// ...
-	} 
+		projection_matrix.Set(
+			2.0f / (right - left), 0, 0, -(right + left) / (right - left),
+			0, 2.0f / (top - bottom), 0, -(top + bottom) / (top - bottom),
+			0, 0, -2.0f / (far_plane - near_plane), -(far_plane + near_plane) / (far_plane - near_plane),
+			0, 0, 0, 1);
+	}
 
-	UpdateViewProjectionMatrix();
+	projection_dirty = false;
+	if (!view_dirty)
+		UpdateViewProjectionMatrix();
 }
 
 void Camera::UpdateViewProjectionMatrix()
 {
 	viewprojection_matrix = projection_matrix * view_matrix;
+	UpdateFrustumPlanes();
 }
 
 Matrix44 Camera::GetViewProjectionMatrix()
 {
-	UpdateViewMatrix();
-	UpdateProjectionMatrix();
-
+	Update();
 	return viewprojection_matrix;
 }
 
+void Camera::UpdateFrustumPlanes()
+{
+	// Gribb-Hartmann: every plane is the last row of the matrix plus or minus one of the others
+	const float* m = viewprojection_matrix.m;
+	Vector4 row[4];
+	for (int i = 0; i < 4; ++i)
+		row[i].Set(m[i], m[4 + i], m[8 + i], m[12 + i]);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		frustum_planes[i * 2].Set(row[3].x + row[i].x, row[3].y + row[i].y, row[3].z + row[i].z, row[3].w + row[i].w);
+		frustum_planes[i * 2 + 1].Set(row[3].x - row[i].x, row[3].y - row[i].y, row[3].z - row[i].z, row[3].w - row[i].w);
+	}
+
+	// Normalize so the plane equation gives real distances (needed to compare with radius)
+	for (int i = 0; i < 6; ++i)
+	{
+		Vector4& p = frustum_planes[i];
+		float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+		if (length > 0.0f)
+			p.Set(p.x / length, p.y / length, p.z / length, p.w / length);
+	}
+}
+
+bool Camera::TestSphereInFrustum(const Vector3& center, float radius)
+{
+	Update();
+	for (int i = 0; i < 6; ++i)
+	{
+		const Vector4& p = frustum_planes[i];
+		if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius)
+			return false;
+	}
+	return true;
+}
+
+bool Camera::TestBoxInFrustum(const Vector3& box_min, const Vector3& box_max)
+{
+	Update();
+	for (int i = 0; i < 6; ++i)
+	{
+		// Corner of the box farthest along the plane normal
+		const Vector4& p = frustum_planes[i];
+		float x = p.x >= 0.0f ? box_max.x : box_min.x;
+		float y = p.y >= 0.0f ? box_max.y : box_min.y;
+		float z = p.z >= 0.0f ? box_max.z : box_min.z;
+		if (p.x * x + p.y * y + p.z * z + p.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+unsigned int Camera::CullSpheres(const Vector4* spheres, unsigned int count, unsigned int* visible)
+{
+	Update();
+
+	unsigned int num_visible = 0;
+	unsigned int i = 0;
+
+#if defined(USE_SSE2)
+	__m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		plane_x[p] = _mm_set1_ps(frustum_planes[p].x);
+		plane_y[p] = _mm_set1_ps(frustum_planes[p].y);
+		plane_z[p] = _mm_set1_ps(frustum_planes[p].z);
+		plane_w[p] = _mm_set1_ps(frustum_planes[p].w);
+	}
+
+	for (; i + 4 <= count; i += 4)
+	{
+		// AoS to SoA: x, y, z and radius of 4 spheres in 4 registers
+		__m128 x = _mm_loadu_ps(spheres[i].v);
+		__m128 y = _mm_loadu_ps(spheres[i + 1].v);
+		__m128 z = _mm_loadu_ps(spheres[i + 2].v);
+		__m128 r = _mm_loadu_ps(spheres[i + 3].v);
+		_MM_TRANSPOSE4_PS(x, y, z, r);
+		__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], x), _mm_mul_ps(plane_y[p], y)),
+				_mm_add_ps(_mm_mul_ps(plane_z[p], z), plane_w[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (unsigned int j = 0; j < 4; ++j)
+			if (mask & (1 << j))
+				visible[num_visible++] = i + j;
+	}
+#elif defined(USE_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4x4_t s = vld4q_f32(spheres[i].v); // Deinterleaves x, y, z, radius
+		float32x4_t neg_r = vnegq_f32(s.val[3]);
+		uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+		for (int p = 0; p < 6; ++p)
+		{
+			const Vector4& pl = frustum_planes[p];
+			float32x4_t d = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(pl.w), s.val[0], pl.x), s.val[1], pl.y), s.val[2], pl.z);
+			inside = vandq_u32(inside, vcgeq_f32(d, neg_r));
+		}
+
+		uint32_t mask[4];
+		vst1q_u32(mask, inside);
+		for (unsigned int j = 0; j < 4; ++j)
+			if (mask[j])
+				visible[num_visible++] = i + j;
+	}
+#endif
+
+	for (; i < count; ++i)
+		if (TestSphereInFrustum(Vector3(spheres[i].x, spheres[i].y, spheres[i].z), spheres[i].w))
+			visible[num_visible++] = i;
+
+	return num_visible;
+}
+
 // The following methods have been created for testing.
 // Do not modify them.
 
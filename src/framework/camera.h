@@ -14,6 +14,11 @@ class Camera
 	void SetExampleViewMatrix();
 	void SetExampleProjectionMatrix();
 
+	// Set by the setters, the matrices are only recomputed when needed
+	bool view_dirty;
+	bool projection_dirty;
+	Matrix44 inverse_view_matrix; // Camera to world, updated with view_matrix
+
 public:
 
 	// Types of cameras available
@@ -39,10 +44,14 @@ public:
 	Matrix44 projection_matrix;
 	Matrix44 viewprojection_matrix;
 
+	// Frustum planes (a,b,c,d) in world space with the normal pointing inside: a*x + b*y + c*z + d >= 0
+	enum { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR };
+	Vector4 frustum_planes[6];
+
 	Camera();
 
 	// Setters
-	void SetAspectRatio(float aspect) { this->aspect = aspect; };
+	void SetAspectRatio(float aspect) { this->aspect = aspect; projection_dirty = true; };
 
 	// Translate and rotate the camera
 	void Move(Vector3 delta);
@@ -61,10 +70,26 @@ public:
 	void SetOrthographic(float left, float right, float top, float bottom, float near_plane, float far_plane);
 	void LookAt(const Vector3& eye, const Vector3& center, const Vector3& up);
 
-	// Compute the matrices
+	// Compute the matrices on the CPU (no GL context needed). The setters only mark them as dirty,
+	// call Update (or any of the getters) before reading the public matrices or testing the frustum.
+	// If you modify eye, center, fov... directly, call the matching Update*Matrix yourself
+	void Update();
 	void UpdateViewMatrix();
 	void UpdateProjectionMatrix();
 	void UpdateViewProjectionMatrix();
 
+	const Matrix44& GetViewMatrix() { Update(); return view_matrix; }
+	const Matrix44& GetProjectionMatrix() { Update(); return projection_matrix; }
+	const Matrix44& GetInverseViewMatrix() { Update(); return inverse_view_matrix; }
 	Matrix44 GetViewProjectionMatrix();
+
+	// Frustum culling, planes are extracted from viewprojection_matrix every time it is updated.
+	// The tests call Update first, so they never see the planes of a stale matrix
+	void UpdateFrustumPlanes();
+	bool TestSphereInFrustum(const Vector3& center, float radius);
+	bool TestBoxInFrustum(const Vector3& box_min, const Vector3& box_max);
+
+	// Tests 'count' world space spheres (center xyz, radius w), 4 at a time using SIMD.
+	// Writes the indices of the ones that touch the frustum in 'visible' and returns how many they are.
+	unsigned int CullSpheres(const Vector4* spheres, unsigned int count, unsigned int* visible);
 };
\ No newline at end of file
@@ -0,0 +1,399 @@
+#include "dxt.h"
+#include "framework.h"
+#include "mipmap.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Rows of blocks compressed by every job when an image is split between threads
+#define BLOCK_ROWS_PER_JOB 8
+
+size_t GetCompressedSize(unsigned int width, unsigned int height, eBlockFormat format)
+{
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (format == BLOCK_BC1 ? 8 : 16);
+}
+
+static inline unsigned short To565(const unsigned char* c)
+{
+	return (unsigned short)((((c[0] * 31 + 127) / 255) << 11) | (((c[1] * 63 + 127) / 255) << 5) | ((c[2] * 31 + 127) / 255));
+}
+
+static inline void From565(unsigned short v, unsigned char* c)
+{
+	unsigned int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (unsigned char)((r << 3) | (r >> 2));
+	c[1] = (unsigned char)((g << 2) | (g >> 4));
+	c[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+// Copies the 4x4 texels of a block as RGBA, the ones outside the image repeat the last row or column
+static void LoadBlock(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int block_x, unsigned int block_y, unsigned char texels[64])
+{
+	for (unsigned int y = 0; y < 4; ++y)
+	{
+		const unsigned char* row = pixels + std::min(block_y * 4 + y, height - 1) * width * channels;
+		for (unsigned int x = 0; x < 4; ++x)
+		{
+			const unsigned char* src = row + std::min(block_x * 4 + x, width - 1) * channels;
+			unsigned char* dst = texels + (y * 4 + x) * 4;
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = channels == 4 ? src[3] : 255;
+		}
+	}
+}
+
+// Per channel minimum and maximum of the 16 texels (RGBA at once)
+static void GetBlockRange(const unsigned char texels[64], unsigned char min_color[4], unsigned char max_color[4])
+{
+#if defined(USE_SSE2)
+	__m128i t0 = _mm_loadu_si128((const __m128i*)texels);
+	__m128i t1 = _mm_loadu_si128((const __m128i*)(texels + 16));
+	__m128i t2 = _mm_loadu_si128((const __m128i*)(texels + 32));
+	__m128i t3 = _mm_loadu_si128((const __m128i*)(texels + 48));
+	__m128i lo = _mm_min_epu8(_mm_min_epu8(t0, t1), _mm_min_epu8(t2, t3));
+	__m128i hi = _mm_max_epu8(_mm_max_epu8(t0, t1), _mm_max_epu8(t2, t3));
+	// 4 texels left in every register, fold them in two steps
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2)));
+	lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	int min_value = _mm_cvtsi128_si32(lo), max_value = _mm_cvtsi128_si32(hi);
+	memcpy(min_color, &min_value, 4);
+	memcpy(max_color, &max_value, 4);
+#elif defined(USE_NEON)
+	uint8x16_t t0 = vld1q_u8(texels), t1 = vld1q_u8(texels + 16), t2 = vld1q_u8(texels + 32), t3 = vld1q_u8(texels + 48);
+	uint8x16_t lo = vminq_u8(vminq_u8(t0, t1), vminq_u8(t2, t3));
+	uint8x16_t hi = vmaxq_u8(vmaxq_u8(t0, t1), vmaxq_u8(t2, t3));
+	uint8x8_t lo8 = vmin_u8(vget_low_u8(lo), vget_high_u8(lo));
+	uint8x8_t hi8 = vmax_u8(vget_low_u8(hi), vget_high_u8(hi));
+	lo8 = vmin_u8(lo8, vext_u8(lo8, lo8, 4));
+	hi8 = vmax_u8(hi8, vext_u8(hi8, hi8, 4));
+	unsigned char lo_bytes[8], hi_bytes[8];
+	vst1_u8(lo_bytes, lo8);
+	vst1_u8(hi_bytes, hi8);
+	memcpy(min_color, lo_bytes, 4);
+	memcpy(max_color, hi_bytes, 4);
+#else
+	memcpy(min_color, texels, 4);
+	memcpy(max_color, texels, 4);
+	for (int i = 1; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+		{
+			min_color[c] = std::min(min_color[c], texels[i * 4 + c]);
+			max_color[c] = std::max(max_color[c], texels[i * 4 + c]);
+		}
+#endif
+}
+
+// 8 bytes: two 565 endpoints and 2 bits per texel. c0 > c1 selects the 4 color mode in BC1.
+static void EncodeColorBlock(const unsigned char texels[64], const unsigned char min_color[4], const unsigned char max_color[4], unsigned char* out)
+{
+	// Moving the endpoints a bit inside the box lowers the error of the texels in between
+	unsigned char lo[3], hi[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		int inset = (max_color[c] - min_color[c]) >> 4;
+		lo[c] = (unsigned char)(min_color[c] + inset);
+		hi[c] = (unsigned char)(max_color[c] - inset);
+	}
+
+	unsigned short c0 = To565(hi), c1 = To565(lo);
+	if (c0 < c1)
+		std::swap(c0, c1);
+	out[0] = (unsigned char)(c0 & 0xFF);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF);
+	out[3] = (unsigned char)(c1 >> 8);
+
+	unsigned char p0[3], p1[3];
+	From565(c0, p0);
+	From565(c1, p1);
+	int dir[3] = { p0[0] - p1[0], p0[1] - p1[1], p0[2] - p1[2] };
+	int dir_length2 = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	if (c0 == c1 || dir_length2 == 0)
+	{
+		memset(out + 4, 0, 4);
+		return;
+	}
+
+	// Every texel is projected on the segment p1..p0 and rounded to one of its 4 points:
+	// steps 0, 1, 2, 3 from p1 are the indices 1, 3, 2, 0
+	static const unsigned int index_of_step[4] = { 1, 3, 2, 0 };
+	int start = p1[0] * dir[0] + p1[1] * dir[1] + p1[2] * dir[2];
+	float scale = 3.0f / dir_length2;
+	unsigned int indices = 0;
+	int i = 0;
+#if defined(USE_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i dir16 = _mm_setr_epi16((short)dir[0], (short)dir[1], (short)dir[2], 0, (short)dir[0], (short)dir[1], (short)dir[2], 0);
+	const __m128 start4 = _mm_set1_ps((float)start), scale4 = _mm_set1_ps(scale);
+	const __m128 min_step = _mm_setzero_ps(), max_step = _mm_set1_ps(3.0f);
+	for (; i < 16; i += 4)
+	{
+		__m128i t = _mm_loadu_si128((const __m128i*)(texels + i * 4));
+		// (r*dr + g*dg, b*db + a*0) for every texel, the two halves are added after
+		__m128i d01 = _mm_madd_epi16(_mm_unpacklo_epi8(t, zero), dir16);
+		__m128i d23 = _mm_madd_epi16(_mm_unpackhi_epi8(t, zero), dir16);
+		__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(d01), _mm_castsi128_ps(d23), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(d01), _mm_castsi128_ps(d23), _MM_SHUFFLE(3, 1, 3, 1));
+		__m128i dot = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+		__m128 step = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(dot), start4), scale4);
+		step = _mm_min_ps(_mm_max_ps(step, min_step), max_step);
+		int steps[4];
+		_mm_storeu_si128((__m128i*)steps, _mm_cvtps_epi32(step));
+		for (int k = 0; k < 4; ++k)
+			indices |= index_of_step[steps[k]] << ((i + k) * 2);
+	}
+#endif
+	for (; i < 16; ++i)
+	{
+		const unsigned char* t = texels + i * 4;
+		float step = (t[0] * dir[0] + t[1] * dir[1] + t[2] * dir[2] - start) * scale;
+		int s = (int)nearbyintf(clamp(step, 0.0f, 3.0f)); // Same rounding as the SIMD conversion
+		indices |= index_of_step[s] << (i * 2);
+	}
+
+	out[4] = (unsigned char)(indices & 0xFF);
+	out[5] = (unsigned char)((indices >> 8) & 0xFF);
+	out[6] = (unsigned char)((indices >> 16) & 0xFF);
+	out[7] = (unsigned char)(indices >> 24);
+}
+
+// 8 bytes: two alpha endpoints (a0 > a1 selects 8 values) and 3 bits per texel
+static void EncodeAlphaBlock(const unsigned char texels[64], unsigned char min_alpha, unsigned char max_alpha, unsigned char* out)
+{
+	out[0] = max_alpha;
+	out[1] = min_alpha;
+	memset(out + 2, 0, 6);
+	if (max_alpha == min_alpha)
+		return;
+
+	// Steps 0..7 from a1 are the indices 1, 7, 6, 5, 4, 3, 2, 0
+	float scale = 7.0f / (max_alpha - min_alpha);
+	unsigned long long indices = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		int s = (int)((texels[i * 4 + 3] - min_alpha) * scale + 0.5f);
+		unsigned long long index = s == 7 ? 0 : (s == 0 ? 1 : 8 - s);
+		indices |= index << (i * 3);
+	}
+	for (int b = 0; b < 6; ++b)
+		out[2 + b] = (unsigned char)((indices >> (b * 8)) & 0xFF);
+}
+
+void CompressBlocks(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, eBlockFormat format, unsigned char* blocks)
+{
+	unsigned int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	unsigned int block_size = format == BLOCK_BC1 ? 8 : 16;
+
+	auto compress_rows = [&](unsigned int start, unsigned int end) {
+		unsigned char texels[64], min_color[4], max_color[4];
+		for (unsigned int by = start; by < end; ++by)
+		{
+			unsigned char* out = blocks + (size_t)by * blocks_x * block_size;
+			for (unsigned int bx = 0; bx < blocks_x; ++bx, out += block_size)
+			{
+				LoadBlock(pixels, width, height, channels, bx, by, texels);
+				GetBlockRange(texels, min_color, max_color);
+				if (format == BLOCK_BC3)
+				{
+					EncodeAlphaBlock(texels, min_color[3], max_color[3], out);
+					EncodeColorBlock(texels, min_color, max_color, out + 8);
+				}
+				else
+					EncodeColorBlock(texels, min_color, max_color, out);
+			}
+		}
+	};
+
+	if (blocks_x * blocks_y < 1024)
+	{
+		compress_rows(0, blocks_y);
+		return;
+	}
+	parallelFor(0, (int)((blocks_y + BLOCK_ROWS_PER_JOB - 1) / BLOCK_ROWS_PER_JOB), [&](int i) {
+		unsigned int start = i * BLOCK_ROWS_PER_JOB;
+		compress_rows(start, std::min(blocks_y, start + BLOCK_ROWS_PER_JOB));
+	});
+}
+
+void DecodeBlock(const unsigned char* block, eBlockFormat format, unsigned char rgba[64])
+{
+	const unsigned char* color_block = block;
+	if (format == BLOCK_BC3)
+	{
+		unsigned char alpha[8];
+		alpha[0] = block[0];
+		alpha[1] = block[1];
+		if (alpha[0] > alpha[1])
+			for (int i = 2; i < 8; ++i)
+				alpha[i] = (unsigned char)(((8 - i) * alpha[0] + (i - 1) * alpha[1]) / 7);
+		else
+		{
+			for (int i = 2; i < 6; ++i)
+				alpha[i] = (unsigned char)(((6 - i) * alpha[0] + (i - 1) * alpha[1]) / 5);
+			alpha[6] = 0;
+			alpha[7] = 255;
+		}
+
+		unsigned long long indices = 0;
+		for (int b = 0; b < 6; ++b)
+			indices |= (unsigned long long)block[2 + b] << (b * 8);
+		for (int i = 0; i < 16; ++i)
+			rgba[i * 4 + 3] = alpha[(indices >> (i * 3)) & 7];
+		color_block = block + 8;
+	}
+
+	unsigned short c0 = (unsigned short)(color_block[0] | (color_block[1] << 8));
+	unsigned short c1 = (unsigned short)(color_block[2] | (color_block[3] << 8));
+	unsigned char palette[4][4];
+	From565(c0, palette[0]);
+	From565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int c = 0; c < 3; ++c)
+	{
+		// BC3 always uses 4 colors, BC1 only when c0 > c1 (3 colors and transparent black otherwise)
+		if (c0 > c1 || format == BLOCK_BC3)
+		{
+			palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c]) / 3);
+		}
+		else
+		{
+			palette[2][c] = (unsigned char)((palette[0][c] + palette[1][c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	if (c0 <= c1 && format == BLOCK_BC1)
+		palette[3][3] = 0;
+
+	unsigned int indices = color_block[4] | (color_block[5] << 8) | (color_block[6] << 16) | ((unsigned int)color_block[7] << 24);
+	for (int i = 0; i < 16; ++i)
+	{
+		const unsigned char* color = palette[(indices >> (i * 2)) & 3];
+		rgba[i * 4] = color[0];
+		rgba[i * 4 + 1] = color[1];
+		rgba[i * 4 + 2] = color[2];
+		if (format == BLOCK_BC1)
+			rgba[i * 4 + 3] = color[3];
+	}
+}
+
+void DecompressBlocks(const unsigned char* blocks, unsigned int width, unsigned int height, eBlockFormat format, unsigned char* rgba)
+{
+	unsigned int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+	unsigned int block_size = format == BLOCK_BC1 ? 8 : 16;
+	unsigned char texels[64];
+	for (unsigned int by = 0; by < blocks_y; ++by)
+		for (unsigned int bx = 0; bx < blocks_x; ++bx)
+		{
+			DecodeBlock(blocks + ((size_t)by * blocks_x + bx) * block_size, format, texels);
+			for (unsigned int y = 0; y < 4 && by * 4 + y < height; ++y)
+			{
+				unsigned int count = std::min(4u, width - bx * 4);
+				memcpy(rgba + ((size_t)(by * 4 + y) * width + bx * 4) * 4, texels + y * 16, count * 4);
+			}
+		}
+}
+
+void SampleBlocks(const unsigned char* blocks, unsigned int width, eBlockFormat format, unsigned int x, unsigned int y, unsigned char rgba[4])
+{
+	unsigned int blocks_x = (width + 3) / 4;
+	unsigned int block_size = format == BLOCK_BC1 ? 8 : 16;
+	unsigned char texels[64];
+	DecodeBlock(blocks + ((size_t)(y / 4) * blocks_x + x / 4) * block_size, format, texels);
+	memcpy(rgba, texels + ((y % 4) * 4 + x % 4) * 4, 4);
+}
+
+void CompressedChain::Compress(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, bool mipmaps)
+{
+	format = channels == 4 ? BLOCK_BC3 : BLOCK_BC1;
+
+	MipChain chain;
+	if (mipmaps)
+		chain.Build(pixels, width, height, channels);
+	unsigned int num_levels = mipmaps ? chain.GetNumLevels() : 1;
+
+	levels.resize(num_levels);
+	size_t total_size = 0;
+	for (unsigned int l = 0; l < num_levels; ++l)
+	{
+		levels[l].width = mipmaps ? chain.levels[l].width : width;
+		levels[l].height = mipmaps ? chain.levels[l].height : height;
+		levels[l].offset = total_size;
+		total_size += GetLevelSize(l);
+	}
+
+	data.resize(total_size);
+	for (unsigned int l = 0; l < num_levels; ++l)
+		CompressBlocks(mipmaps ? chain.GetLevelData(l) : pixels, levels[l].width, levels[l].height, channels, format, &data[levels[l].offset]);
+}
+
+// File layout: "BCNC", key, format, width, height, number of levels and then all the levels
+bool CompressedChain::Save(const std::string& filename, unsigned long long key) const
+{
+	if (levels.empty())
+		return false;
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	unsigned int header[4] = { (unsigned int)format, levels[0].width, levels[0].height, (unsigned int)levels.size() };
+	bool ok = fwrite("BCNC", 1, 4, file) == 4 &&
+		fwrite(&key, sizeof(key), 1, file) == 1 &&
+		fwrite(header, sizeof(header), 1, file) == 1 &&
+		fwrite(&data[0], 1, data.size(), file) == data.size();
+	fclose(file);
+
+	if (!ok)
+		std::cerr << "Error saving compressed texture: " << filename << std::endl;
+	return ok;
+}
+
+bool CompressedChain::Load(const std::string& filename, unsigned long long key)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		return false;
+
+	char magic[4];
+	unsigned long long file_key;
+	unsigned int header[4];
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "BCNC", 4) != 0 ||
+		fread(&file_key, sizeof(file_key), 1, file) != 1 || file_key != key ||
+		fread(header, sizeof(header), 1, file) != 1 ||
+		header[0] > BLOCK_BC3 || header[1] == 0 || header[2] == 0 ||
+		header[3] == 0 || header[3] > MipChain::GetNumLevelsForSize(header[1], header[2]))
+	{
+		fclose(file);
+		return false;
+	}
+
+	format = (eBlockFormat)header[0];
+	unsigned int width = header[1], height = header[2];
+	levels.resize(header[3]);
+	size_t total_size = 0;
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		levels[l].width = width;
+		levels[l].height = height;
+		levels[l].offset = total_size;
+		total_size += GetCompressedSize(width, height, format);
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	data.resize(total_size);
+	bool ok = fread(&data[0], 1, total_size, file) == total_size;
+	fclose(file);
+	if (!ok)
+		levels.clear();
+	return ok;
+}
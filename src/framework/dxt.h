@@ -0,0 +1,58 @@
+/*
+	Block compression (BC1 / DXT1 for RGB and BC3 / DXT5 for RGBA) on the CPU. Every 4x4 block of texels is
+	stored in 8 (BC1) or 16 (BC3) bytes, 6 or 4 times less than uncompressed RGB(A), and the GPU samples them directly.
+	The encoder fits the endpoints to the bounding box of the block (with the usual inset) and picks the indices
+	with SIMD, the blocks are split between threads. The decoder is used to validate results and to sample on the CPU.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+enum eBlockFormat {
+	BLOCK_BC1,	// RGB, 8 bytes per block (alpha is ignored)
+	BLOCK_BC3	// RGBA, 16 bytes per block (8 for the alpha and 8 for the color)
+};
+
+// Size of a width x height image once compressed (partial blocks at the borders count as whole ones)
+size_t GetCompressedSize(unsigned int width, unsigned int height, eBlockFormat format);
+
+// Compresses a tightly packed image of 3 (RGB) or 4 (RGBA) channels into 'blocks' (GetCompressedSize bytes).
+// Blocks are stored in rows starting from the first row of the image, like OpenGL expects.
+void CompressBlocks(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, eBlockFormat format, unsigned char* blocks);
+
+// Decodes to RGBA (width * height * 4 bytes)
+void DecompressBlocks(const unsigned char* blocks, unsigned int width, unsigned int height, eBlockFormat format, unsigned char* rgba);
+void DecodeBlock(const unsigned char* block, eBlockFormat format, unsigned char rgba[64]);
+
+// Software sampling of a single texel (RGBA) without decoding the whole image
+void SampleBlocks(const unsigned char* blocks, unsigned int width, eBlockFormat format, unsigned int x, unsigned int y, unsigned char rgba[4]);
+
+// All the levels of a compressed mipmap chain (or just one) one after another, with a disk cache
+class CompressedChain
+{
+public:
+	struct sLevel
+	{
+		unsigned int width;
+		unsigned int height;
+		size_t offset;		// Position of the first block of the level in 'data'
+	};
+
+	eBlockFormat format;
+	std::vector<sLevel> levels;
+	std::vector<unsigned char> data;
+
+	CompressedChain() { format = BLOCK_BC1; }
+
+	// Compresses the image (and the CPU built mipmaps, see MipChain), BC1 for 3 channels and BC3 for 4
+	void Compress(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, bool mipmaps = true);
+
+	const unsigned char* GetLevelData(unsigned int level) const { return &data[levels[level].offset]; }
+	size_t GetLevelSize(unsigned int level) const { return GetCompressedSize(levels[level].width, levels[level].height, format); }
+
+	// Disk cache, 'key' identifies the source (a hash of its pixels) and Load fails if it does not match
+	bool Save(const std::string& filename, unsigned long long key) const;
+	bool Load(const std::string& filename, unsigned long long key);
+};
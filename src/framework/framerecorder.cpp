@@ -0,0 +1,189 @@
+#include "framerecorder.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstring>
+
+FrameRecorder::FrameRecorder()
+{
+	writing = NULL;
+	first = queued = 0;
+	stop = false;
+	format = RECORD_QOI;
+	policy = DROP_NEWEST;
+	width = height = 0;
+	captured = written = dropped = 0;
+	stream = NULL;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	Stop();
+}
+
+bool FrameRecorder::Start(const char* path, unsigned int width, unsigned int height, eRecordFormat format, unsigned int ring_size, eDropPolicy policy)
+{
+	Stop();
+	if (width == 0 || height == 0 || ring_size == 0)
+		return false;
+
+	if (format == RECORD_RAW)
+	{
+		std::string fullPath = absResPath(std::string(path) + ".rgb");
+		stream = fopen(fullPath.c_str(), "wb");
+		if (stream == NULL)
+		{
+			perror("Failed to open file: ");
+			return false;
+		}
+	}
+
+	// Everything is allocated here, Capture only copies
+	ring.resize(ring_size);
+	for (unsigned int i = 0; i < ring_size; ++i)
+	{
+		ring[i].image = new Image(width, height);
+		ring[i].number = 0;
+	}
+	writing = new Image(width, height);
+
+	this->path = path;
+	this->format = format;
+	this->policy = policy;
+	this->width = width;
+	this->height = height;
+	first = queued = 0;
+	captured = written = dropped = 0;
+	stop = false;
+	writer = std::thread(&FrameRecorder::WriterLoop, this);
+	return true;
+}
+
+void FrameRecorder::Stop()
+{
+	if (!IsRecording())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	frame_ready.notify_one();
+	writer.join();
+
+	if (stream)
+	{
+		fclose(stream);
+		stream = NULL;
+	}
+	for (size_t i = 0; i < ring.size(); ++i)
+		delete ring[i].image;
+	ring.clear();
+	delete writing;
+	writing = NULL;
+
+	std::cout << "Recorded " << written << " of " << captured << " frames (" << dropped << " dropped) to " << path << std::endl;
+}
+
+bool FrameRecorder::Capture(const Image& frame)
+{
+	if (!IsRecording())
+		return false;
+
+	unsigned int slot, number;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		number = captured++;
+		if (frame.width != width || frame.height != height)
+		{
+			++dropped;
+			return false;
+		}
+		if (queued == ring.size())
+		{
+			++dropped;
+			if (policy == DROP_NEWEST)
+				return false;
+			first = (first + 1) % ring.size();
+			--queued;
+		}
+
+		// The slot after the queued ones is not seen by the writer until it is queued below
+		slot = (first + queued) % ring.size();
+	}
+
+	memcpy(ring[slot].image->pixels, frame.pixels, (size_t)width * height * sizeof(Color));
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ring[slot].number = number;
+		++queued;
+	}
+	frame_ready.notify_one();
+	return true;
+}
+
+void FrameRecorder::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		frame_ready.wait(lock, [this]() { return stop || queued > 0; });
+		if (queued == 0)
+			return; // Stopping and every frame is written
+
+		std::swap(writing, ring[first].image);
+		unsigned int number = ring[first].number;
+		first = (first + 1) % ring.size();
+		--queued;
+		lock.unlock();
+
+		// Encoding and writing run without the lock
+		bool ok = WriteFrame(*writing, number);
+
+		lock.lock();
+		if (ok)
+			++written;
+	}
+}
+
+bool FrameRecorder::WriteFrame(Image& image, unsigned int number)
+{
+	if (format == RECORD_RAW)
+	{
+		// Top row first, the usual order of video tools
+		size_t row_size = (size_t)width * sizeof(Color);
+		for (unsigned int y = height; y-- > 0;)
+			if (fwrite(&image.pixels[y * width], 1, row_size, stream) != row_size)
+				return false;
+		return true;
+	}
+
+	static const char* EXTENSIONS[3] = { "qoi", "tga", "png" };
+	char filename[32];
+	snprintf(filename, sizeof(filename), "_%06u.%s", number, EXTENSIONS[format]);
+	std::string name = path + filename;
+	if (format == RECORD_QOI)
+		return image.SaveQOI(name.c_str());
+	if (format == RECORD_TGA)
+		return image.SaveTGA(name.c_str());
+	return image.SavePNG(name.c_str(), PNG_LEVEL_FAST);
+}
+
+unsigned int FrameRecorder::GetCaptured()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return captured;
+}
+
+unsigned int FrameRecorder::GetWritten()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return written;
+}
+
+unsigned int FrameRecorder::GetDropped()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return dropped;
+}
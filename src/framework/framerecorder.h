@@ -0,0 +1,76 @@
+/*
+	Records frames (usually Application::framebuffer) to disk without slowing down the render loop.
+	Start preallocates a ring of images of the frame size. Capture reserves a free slot and copies the frame
+	into it (a single memcpy), and a writer thread encodes and writes the queued frames in order.
+	If the writer falls behind and the ring is full, a frame is dropped following the drop policy.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "image.h"
+
+enum eRecordFormat {
+	RECORD_QOI,		// Numbered files path_000000.qoi, fast to write (the default)
+	RECORD_TGA,		// Numbered files path_000000.tga, uncompressed
+	RECORD_PNG,		// Numbered files path_000000.png with the fast level, the writer falls behind at big sizes
+	RECORD_RAW		// A single file path.rgb with the frames one after the other (RGB, top row first):
+					// ffmpeg -f rawvideo -pixel_format rgb24 -video_size WxH -framerate 60 -i path.rgb video.mp4
+};
+
+enum eDropPolicy {
+	DROP_NEWEST,	// The new frame is not recorded, the queued frames are kept (the recording has gaps)
+	DROP_OLDEST		// The oldest queued frame is discarded, so the recording keeps up with the latest frames
+};
+
+class FrameRecorder
+{
+public:
+	FrameRecorder();
+	~FrameRecorder();	// Stops the recording
+
+	// 'path' is relative to res (the directory must exist). Numbered files use the index of the frame since Start,
+	// so the dropped frames are the missing numbers. The ring holds 'ring_size' frames of width * height
+	bool Start(const char* path, unsigned int width, unsigned int height, eRecordFormat format = RECORD_QOI, unsigned int ring_size = 4, eDropPolicy policy = DROP_NEWEST);
+	void Stop();		// Waits until the queued frames are written
+
+	// Called once per frame from the render thread. Returns false if the frame was dropped
+	// (ring full or a frame of another size, like after resizing the window)
+	bool Capture(const Image& frame);
+
+	bool IsRecording() const { return writer.joinable(); }
+	unsigned int GetCaptured();		// Frames given to Capture since Start
+	unsigned int GetWritten();
+	unsigned int GetDropped();
+
+protected:
+	struct sSlot
+	{
+		Image* image;
+		unsigned int number;		// Index of the frame since Start
+	};
+
+	std::vector<sSlot> ring;
+	Image* writing;					// Swapped with the slot taken by the writer, so the slot is free again at once
+	unsigned int first;				// Oldest queued slot
+	unsigned int queued;			// Slots with a frame waiting for the writer
+	std::mutex mutex;
+	std::condition_variable frame_ready;
+	std::thread writer;
+	bool stop;
+
+	std::string path;
+	eRecordFormat format;
+	eDropPolicy policy;
+	unsigned int width, height;
+	unsigned int captured, written, dropped;
+	FILE* stream;					// Only for RECORD_RAW
+
+	void WriterLoop();
+	bool WriteFrame(Image& image, unsigned int number);
+};
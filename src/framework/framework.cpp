@@ -1,8 +1,10 @@
 #include "framework.h"
+#include "utils.h" //parallelFor
 
 #include <cmath> //for sqrt (square root) function
 #include <math.h> //atan2
 #include <cstring>
+#include <algorithm>
 
 #define M_PI_2 1.57079632679489661923
 
@@ -18,35 +20,7 @@ const Color Color::YELLOW(255,255,0);
 const Color Color::CYAN(0,255,255);
 const Color Color::PURPLE(255,0,255);
 
-void Color::operator = (const Vector3& v)
-{
-	r = clamp( (unsigned char)v.x,0,255);
-	g = clamp( (unsigned char)v.y,0,255);
-	b = clamp( (unsigned char)v.z,0,255);
-}
-
 //**************************************
-float Vector2::Distance(const Vector2& v)
-{
-	return (v - *this).length();
-}
-
-float Vector2::Dot( const Vector2& v )
-{
-	return x * v.x + y * v.y;
-}
-
-void Vector2::Clamp(float min, float max)
-{
-	x = clamp(x, min, max);
-	y = clamp(y, min, max);
-}
-
-float Vector2::Perpdot( const Vector2& v )
-{
-	return y * v.x + -x * v.y;
-}
-
 void Vector2::Random(float range)
 {
 	//rand returns a value between 0 and RAND_MAX
@@ -54,14 +28,6 @@ void Vector2::Random(float range)
 	y = (rand() / (float)RAND_MAX) * 2 * range - range; //value between -range and range
 }
 
-
-Vector2 operator * (const Vector2& a, float v) { return Vector2(a.x * v, a.y * v); }
-Vector2 operator / (const Vector2& a, float v) { return Vector2(a.x / v, a.y / v); }
-Vector2 operator + (const Vector2& a, const Vector2& b) { return Vector2(a.x + b.x, a.y + b.y); }
-Vector2 operator - (const Vector2& a, const Vector2& b) { return Vector2(a.x - b.x, a.y - b.y); }
-Vector2 operator * (const Vector2& a, const Vector2& b) { return Vector2(a.x * b.x, a.y * b.y); }
-Vector2 operator / (const Vector2& a, const Vector2& b) { return Vector2(a.x / b.x, a.y / b.y); }
-
 // **************************************
 
 // Vector3
@@ -70,40 +36,6 @@ const Vector3 Vector3::DOWN(0, -1, 0);
 const Vector3 Vector3::RIGHT(1, 0, 0);
 const Vector3 Vector3::LEFT(-1, 0, 0);
 
-float Vector3::Length()
-{
-	return sqrt(x*x + y*y + z*z);
-}
-
-float Vector3::Length() const
-{
-	return sqrt(x*x + y*y + z*z);
-}
-
-Vector3& Vector3::Normalize()
-{
-	float len = Length();
-	x /= len;
-	y /= len;
-	z /= len;
-	return *this;
-}
-
-float Vector3::Distance(const Vector3& v) const
-{
-	return (v - *this).Length();
-}
-
-Vector3 Vector3::Cross( const Vector3& b ) const
-{
-	return Vector3(y*b.z - z*b.y, z*b.x - x*b.z, x*b.y - y*b.x);
-}
-
-float Vector3::Dot( const Vector3& v ) const
-{
-	return x*v.x + y*v.y + z*v.z;
-}
-
 void Vector3::Random(float range)
 {
 	//rand returns a value between 0 and RAND_MAX
@@ -120,19 +52,7 @@ void Vector3::Random(Vector3 range)
 	z = (rand() / (float)RAND_MAX) * 2 * range.z - range.z; //value between -range and range
 }
 
-void Vector3::Clamp(float min, float max)
-{
-	x = clamp(x, min, max);
-	y = clamp(y, min, max);
-	z = clamp(z, min, max);
-}
-
 //*********************************
-Matrix44::Matrix44()
-{
-	SetIdentity();
-}
-
 Matrix44::Matrix44(const float* v)
 {
 	memcpy(m, v, sizeof(float) * 16);
@@ -156,14 +76,6 @@ void Matrix44::Clear()
     std::memset(m, 0, 16*sizeof(float));
 }
 
-void Matrix44::SetIdentity()
-{
-	m[0]=1; m[4]=0; m[8]=0; m[12]=0;
-	m[1]=0; m[5]=1; m[9]=0; m[13]=0;
-	m[2]=0; m[6]=0; m[10]=1; m[14]=0;
-	m[3]=0; m[7]=0; m[11]=0; m[15]=1;
-}
-
 void Matrix44::Transpose()
 {
    std::swap(m[1],m[4]); std::swap(m[2],m[8]); std::swap(m[3],m[12]);
@@ -327,75 +239,6 @@ bool Matrix44::GetXYZ(float* euler) const
 	return false;
 }
 
-//Multiply a matrix by another and returns the result
-Matrix44 Matrix44::operator*(const Matrix44& matrix) const
-{
-	Matrix44 ret;
-
-	unsigned int i,j,k;
-	for (i=0;i<4;i++)
-	{
-		for (j=0;j<4;j++)
-		{
-			ret.M[i][j]=0.0;
-			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[k][j] * matrix.M[i][k];
-		}
-	}
-
-	return ret;
-}
-
-//it allows to add two vectors
-Vector3 operator + (const Vector3& a, const Vector3& b) 
-{
-	return Vector3(a.x + b.x, a.y + b.y, a.z + b.z );
-}
-
-//it allows to add two vectors
-Vector3 operator - (const Vector3& a, const Vector3& b) 
-{
-	return Vector3(a.x - b.x, a.y - b.y, a.z - b.z );
-}
-
-Vector3 operator * (const Vector3& a, float v) 
-{
-	return Vector3(a.x * v, a.y * v, a.z * v);
-}
-
-Vector3 operator / (const Vector3& a, float v)
-{
-	return Vector3(a.x / v, a.y / v, a.z / v);
-}
-
-Vector3 operator * (const Vector3& a, const Vector3& b)
-{
-	return Vector3(a.x * b.x, a.y * b.y, a.z * b.z);
-}
-
-Vector3 operator / (const Vector3& a, const Vector3& b)
-{
-	return Vector3(a.x / b.x, a.y / b.y, a.z / b.z);
-}
-
-Vector4 operator * (const Matrix44& matrix, const Vector4& v)
-{
-	float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12] * v.w;
-	float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13] * v.w;
-	float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14] * v.w;
-	float w = matrix.m[3] * v.x + matrix.m[7] * v.y + matrix.m[11] * v.z + matrix.m[15] * v.w;
-	return Vector4(x, y, z, w);
-}
-
-//Multiplies a vector by a matrix and returns the new vector ( assumes v4 = (v.x, v.y, v.z, 1) )
-Vector3 operator * (const Matrix44& matrix, const Vector3& v)
-{   
-   float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12]; 
-   float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13]; 
-   float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14];
-   return Vector3(x,y,z);
-}
-
 void Matrix44::SetUpAndOrthonormalize(Vector3 up)
 {
 	up.Normalize();
@@ -468,7 +311,189 @@ void Matrix44::SetFrontAndOrthonormalize(Vector3 front)
 	
 }
 
+// Both versions of Inverse use the same test, relative to the size of the matrix so scaled matrices still invert.
+// |det| is never bigger than the product of the lengths of the columns (Hadamard): the ratio is 1 for orthogonal
+// columns and goes to 0 as they become dependent. Done in doubles, the squares of big matrices overflow floats
+#define MATRIX_SINGULAR_THRESHOLD 0.00001 //change this if you experience problems with matrices
+static bool IsSingular(const float* m, double det)
+{
+	double lengths = 1.0;
+	for (int i = 0; i < 16; i += 4)
+		lengths *= (double)m[i] * m[i] + (double)m[i + 1] * m[i + 1] + (double)m[i + 2] * m[i + 2] + (double)m[i + 3] * m[i + 3];
+	return !(det * det > MATRIX_SINGULAR_THRESHOLD * MATRIX_SINGULAR_THRESHOLD * lengths); // Also true for NaN
+}
+#undef MATRIX_SINGULAR_THRESHOLD
+
+#if defined(USE_SSE2)
+
+// Helpers for the SSE inverse, 2x2 matrices are stored row major in one register (a b c d)
+#define SHUFFLE_MASK(x,y,z,w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define SWIZZLE(v, x, y, z, w) _mm_castsi128_ps(_mm_shuffle_epi32(_mm_castps_si128(v), SHUFFLE_MASK(x, y, z, w)))
+#define SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, SHUFFLE_MASK(x, y, z, w))
+
+// A * B
+static inline __m128 Mat2Mul(__m128 a, __m128 b)
+{
+	return _mm_add_ps(_mm_mul_ps(a, SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// adj(A) * B
+static inline __m128 Mat2AdjMul(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(SWIZZLE(a, 1, 1, 2, 2), SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+// A * adj(B)
+static inline __m128 Mat2MulAdj(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(a, SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
 bool Matrix44::Inverse()
+{
+	// Block matrix inverse: M = |A B| with 2x2 blocks, inv(M) = 1/|M| * |X Y|
+	//                           |C D|                                 |Z W|
+	// inv(trans(M)) = trans(inv(M)), so it works the same for columns than for rows
+	__m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+
+	__m128 A = _mm_movelh_ps(c0, c1);
+	__m128 B = _mm_movehl_ps(c1, c0);
+	__m128 C = _mm_movelh_ps(c2, c3);
+	__m128 D = _mm_movehl_ps(c3, c2);
+
+	// Determinants of the blocks as (|A| |B| |C| |D|)
+	__m128 det_sub = _mm_sub_ps(
+		_mm_mul_ps(SHUFFLE(c0, c2, 0, 2, 0, 2), SHUFFLE(c1, c3, 1, 3, 1, 3)),
+		_mm_mul_ps(SHUFFLE(c0, c2, 1, 3, 1, 3), SHUFFLE(c1, c3, 0, 2, 0, 2)));
+	__m128 det_A = SWIZZLE(det_sub, 0, 0, 0, 0);
+	__m128 det_B = SWIZZLE(det_sub, 1, 1, 1, 1);
+	__m128 det_C = SWIZZLE(det_sub, 2, 2, 2, 2);
+	__m128 det_D = SWIZZLE(det_sub, 3, 3, 3, 3);
+
+	__m128 D_C = Mat2AdjMul(D, C);
+	__m128 A_B = Mat2AdjMul(A, B);
+	__m128 X_ = _mm_sub_ps(_mm_mul_ps(det_D, A), Mat2Mul(B, D_C));	// |D|A - B(D#C)
+	__m128 W_ = _mm_sub_ps(_mm_mul_ps(det_A, D), Mat2Mul(C, A_B));	// |A|D - C(A#B)
+	__m128 Y_ = _mm_sub_ps(_mm_mul_ps(det_B, C), Mat2MulAdj(D, A_B));	// |B|C - D(A#B)#
+	__m128 Z_ = _mm_sub_ps(_mm_mul_ps(det_C, B), Mat2MulAdj(A, D_C));	// |C|B - A(D#C)#
+
+	// |M| = |A||D| + |B||C| - tr((A#B)(D#C))
+	__m128 tr = _mm_mul_ps(A_B, SWIZZLE(D_C, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, SWIZZLE(tr, 2, 3, 0, 1));
+	tr = _mm_add_ps(tr, SWIZZLE(tr, 1, 0, 3, 2));
+	__m128 det_M = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_A, det_D), _mm_mul_ps(det_B, det_C)), tr);
+
+	if (IsSingular(m, _mm_cvtss_f32(det_M)))
+		return false;
+
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det_M);
+	X_ = _mm_mul_ps(X_, inv_det);
+	Y_ = _mm_mul_ps(Y_, inv_det);
+	Z_ = _mm_mul_ps(Z_, inv_det);
+	W_ = _mm_mul_ps(W_, inv_det);
+
+	// Apply the adjugate shuffle while storing
+	_mm_storeu_ps(m, SHUFFLE(X_, Y_, 3, 1, 3, 1));
+	_mm_storeu_ps(m + 4, SHUFFLE(X_, Y_, 2, 0, 2, 0));
+	_mm_storeu_ps(m + 8, SHUFFLE(Z_, W_, 3, 1, 3, 1));
+	_mm_storeu_ps(m + 12, SHUFFLE(Z_, W_, 2, 0, 2, 0));
+	return true;
+}
+
+#undef SHUFFLE_MASK
+#undef SWIZZLE
+#undef SHUFFLE
+
+#elif defined(USE_NEON)
+
+// Helpers for the NEON inverse, same layout as the SSE version. NEON has no free shuffle, the lanes are picked
+// from the two halves of the register: (b0 b3), (b3 b0) and (b2 b1), used twice
+static inline float32x4_t Twice(float32x2_t v) { return vcombine_f32(v, v); }
+static inline float32x2_t Lanes03(float32x4_t b) { return vrev64_f32(vext_f32(vget_high_f32(b), vget_low_f32(b), 1)); }
+static inline float32x2_t Lanes30(float32x4_t b) { return vext_f32(vget_high_f32(b), vget_low_f32(b), 1); }
+static inline float32x2_t Lanes21(float32x4_t b) { return vrev64_f32(vext_f32(vget_low_f32(b), vget_high_f32(b), 1)); }
+
+// A * B
+static inline float32x4_t Mat2Mul(float32x4_t a, float32x4_t b)
+{
+	return vaddq_f32(vmulq_f32(a, Twice(Lanes03(b))), vmulq_f32(vrev64q_f32(a), Twice(Lanes21(b))));
+}
+
+// adj(A) * B
+static inline float32x4_t Mat2AdjMul(float32x4_t a, float32x4_t b)
+{
+	float32x2_t low = vget_low_f32(a), high = vget_high_f32(a);
+	float32x4_t a3300 = vcombine_f32(vdup_lane_f32(high, 1), vdup_lane_f32(low, 0));
+	float32x4_t a1122 = vcombine_f32(vdup_lane_f32(low, 1), vdup_lane_f32(high, 0));
+	return vsubq_f32(vmulq_f32(a3300, b), vmulq_f32(a1122, vextq_f32(b, b, 2)));
+}
+
+// A * adj(B)
+static inline float32x4_t Mat2MulAdj(float32x4_t a, float32x4_t b)
+{
+	return vsubq_f32(vmulq_f32(a, Twice(Lanes30(b))), vmulq_f32(vrev64q_f32(a), Twice(Lanes21(b))));
+}
+
+bool Matrix44::Inverse()
+{
+	// Same block matrix inverse as the SSE version
+	float32x4_t c0 = vld1q_f32(m), c1 = vld1q_f32(m + 4), c2 = vld1q_f32(m + 8), c3 = vld1q_f32(m + 12);
+
+	float32x4_t A = vcombine_f32(vget_low_f32(c0), vget_low_f32(c1));
+	float32x4_t B = vcombine_f32(vget_high_f32(c0), vget_high_f32(c1));
+	float32x4_t C = vcombine_f32(vget_low_f32(c2), vget_low_f32(c3));
+	float32x4_t D = vcombine_f32(vget_high_f32(c2), vget_high_f32(c3));
+
+	// Determinants of the blocks as (|A| |B| |C| |D|), the even and odd lanes of the columns
+	float32x4x2_t c02 = vuzpq_f32(c0, c2), c13 = vuzpq_f32(c1, c3);
+	float32x4_t det_sub = vsubq_f32(vmulq_f32(c02.val[0], c13.val[1]), vmulq_f32(c02.val[1], c13.val[0]));
+	float det_A = vgetq_lane_f32(det_sub, 0);
+	float det_B = vgetq_lane_f32(det_sub, 1);
+	float det_C = vgetq_lane_f32(det_sub, 2);
+	float det_D = vgetq_lane_f32(det_sub, 3);
+
+	float32x4_t D_C = Mat2AdjMul(D, C);
+	float32x4_t A_B = Mat2AdjMul(A, B);
+	float32x4_t X_ = vsubq_f32(vmulq_n_f32(A, det_D), Mat2Mul(B, D_C));	// |D|A - B(D#C)
+	float32x4_t W_ = vsubq_f32(vmulq_n_f32(D, det_A), Mat2Mul(C, A_B));	// |A|D - C(A#B)
+	float32x4_t Y_ = vsubq_f32(vmulq_n_f32(C, det_B), Mat2MulAdj(D, A_B));	// |B|C - D(A#B)#
+	float32x4_t Z_ = vsubq_f32(vmulq_n_f32(B, det_C), Mat2MulAdj(A, D_C));	// |C|B - A(D#C)#
+
+	// |M| = |A||D| + |B||C| - tr((A#B)(D#C))
+	float32x2x2_t D_C_t = vzip_f32(vget_low_f32(D_C), vget_high_f32(D_C));
+	float32x4_t tr = vmulq_f32(A_B, vcombine_f32(D_C_t.val[0], D_C_t.val[1]));
+	float32x2_t sum = vpadd_f32(vget_low_f32(tr), vget_high_f32(tr));
+	float det = det_A * det_D + det_B * det_C - (vget_lane_f32(sum, 0) + vget_lane_f32(sum, 1));
+
+	if (IsSingular(m, det))
+		return false;
+
+	static const float signs[4] = { 1.f, -1.f, -1.f, 1.f };
+	float32x4_t inv_det = vmulq_n_f32(vld1q_f32(signs), 1.0f / det);
+	X_ = vmulq_f32(X_, inv_det);
+	Y_ = vmulq_f32(Y_, inv_det);
+	Z_ = vmulq_f32(Z_, inv_det);
+	W_ = vmulq_f32(W_, inv_det);
+
+	// Apply the adjugate shuffle while storing: (X3 X1 Y3 Y1) and (X2 X0 Y2 Y0)
+	float32x4x2_t XY = vuzpq_f32(X_, Y_), ZW = vuzpq_f32(Z_, W_);
+	vst1q_f32(m, vrev64q_f32(XY.val[1]));
+	vst1q_f32(m + 4, vrev64q_f32(XY.val[0]));
+	vst1q_f32(m + 8, vrev64q_f32(ZW.val[1]));
+	vst1q_f32(m + 12, vrev64q_f32(ZW.val[0]));
+	return true;
+}
+
+#else
+
+bool Matrix44::Inverse()
+{
+	return InverseGaussian();
+}
+
+#endif
+
+bool Matrix44::InverseGaussian()
 {
 	// Guassian elimination
 	// this code is meant for MemoryRowMajor
@@ -478,6 +503,7 @@ bool Matrix44::Inverse()
 
    unsigned int i, j, k, swap;
    float t;
+   double det = 1.0; // Product of the pivots, for the same singular test as the SIMD version
    Matrix44 temp, final;
    final.SetIdentity();
 
@@ -505,18 +531,15 @@ bool Matrix44::Inverse()
 			 std::swap( temp.M[i][k],temp.M[swap][k]);
 			 std::swap( final.M[i][k], final.M[swap][k]);
          }
+         det = -det;
       }
 
       // No non-zero pivot.  The CMatrix is singular, which shouldn't
       // happen.  This means the user gave us a bad CMatrix.
-	  
-#define MATRIX_SINGULAR_THRESHOLD 0.00001 //change this if you experience problems with matrices
-      if ( fabsf(temp.M[i][i]) <= MATRIX_SINGULAR_THRESHOLD)
-	  {
-		  final.SetIdentity();
+      // (almost singular matrices are rejected at the end, with the determinant)
+      if (temp.M[i][i] == 0.0f)
          return false;
-	  }
-#undef MATRIX_SINGULAR_THRESHOLD
+      det *= temp.M[i][i];
 
       t = 1.0f/temp.M[i][i];
 
@@ -540,11 +563,44 @@ bool Matrix44::Inverse()
       }
    }
 
+   if (IsSingular(this->m, det))
+      return false;
    *this = final;
 
    return true;
 }
 
+bool Matrix44::InverseAffine()
+{
+	// The columns of the 3x3 part must be orthogonal (rotation and scale, no shear)
+	float sx = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+	float sy = m[4] * m[4] + m[5] * m[5] + m[6] * m[6];
+	float sz = m[8] * m[8] + m[9] * m[9] + m[10] * m[10];
+	if (sx <= 0.0f || sy <= 0.0f || sz <= 0.0f)
+		return false;
+	sx = 1.0f / sx; sy = 1.0f / sy; sz = 1.0f / sz;
+
+	// Inverse of R*S is inv(S)*trans(R): transpose and divide every row by its squared scale
+	float r[9] = {
+		m[0] * sx, m[4] * sy, m[8] * sz,
+		m[1] * sx, m[5] * sy, m[9] * sz,
+		m[2] * sx, m[6] * sy, m[10] * sz
+	};
+	float tx = m[12], ty = m[13], tz = m[14];
+
+	m[0] = r[0]; m[4] = r[3]; m[8] = r[6];
+	m[1] = r[1]; m[5] = r[4]; m[9] = r[7];
+	m[2] = r[2]; m[6] = r[5]; m[10] = r[8];
+
+	// New translation is -inv(RS) * t
+	m[12] = -(m[0] * tx + m[4] * ty + m[8] * tz);
+	m[13] = -(m[1] * tx + m[5] * ty + m[9] * tz);
+	m[14] = -(m[2] * tx + m[6] * ty + m[10] * tz);
+	m[3] = m[7] = m[11] = 0.0f;
+	m[15] = 1.0f;
+	return true;
+}
+
 float ComputeSignedAngle( Vector2 a, Vector2 b)
 {
 	a.normalize();
@@ -560,3 +616,258 @@ Vector3 RayPlaneCollision( const Vector3& plane_pos, const Vector3& plane_normal
 	float t = -(numer / denom);
 	return ray_origin + ray_dir * t;
 }
+
+//**************************************
+// Stream transforms
+
+enum eStreamMode { STREAM_POINTS, STREAM_DIRECTIONS, STREAM_PROJECT };
+
+#if defined(USE_SSE2)
+typedef __m128 float4;
+static inline float4 Splat4(float v) { return _mm_set1_ps(v); }
+static inline float4 Load4(const float* p) { return _mm_loadu_ps(p); }
+static inline void Store4(float* p, float4 v) { _mm_storeu_ps(p, v); }
+static inline float4 Mul4(float4 a, float4 b) { return _mm_mul_ps(a, b); }
+static inline float4 MulAdd4(float4 a, float4 b, float4 c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+static inline float4 Div4(float4 a, float4 b) { return _mm_div_ps(a, b); }
+
+// Loads 4 consecutive Vector3 (12 floats) and deinterleaves them into x, y and z
+static inline void LoadVector3x4(const Vector3* p, float4& x, float4& y, float4& z)
+{
+	const float* f = p->v;
+	__m128 a = _mm_loadu_ps(f);     // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(f + 4); // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(f + 8); // z2 x3 y3 z3
+	__m128 t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+	x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+	t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+	__m128 u = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+	y = _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0));
+	t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+	z = _mm_shuffle_ps(t, c, _MM_SHUFFLE(3, 0, 2, 0));
+}
+
+static inline void StoreVector3x4(Vector3* p, float4 x, float4 y, float4 z)
+{
+	float* f = p->v;
+	__m128 t = _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 u = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+	_mm_storeu_ps(f, _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0)));
+	t = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+	u = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0)));
+	t = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+	u = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline void StoreVector4x4(Vector4* p, float4 x, float4 y, float4 z, float4 w)
+{
+	_MM_TRANSPOSE4_PS(x, y, z, w);
+	_mm_storeu_ps(p[0].v, x);
+	_mm_storeu_ps(p[1].v, y);
+	_mm_storeu_ps(p[2].v, z);
+	_mm_storeu_ps(p[3].v, w);
+}
+#elif defined(USE_NEON)
+typedef float32x4_t float4;
+static inline float4 Splat4(float v) { return vdupq_n_f32(v); }
+static inline float4 Load4(const float* p) { return vld1q_f32(p); }
+static inline void Store4(float* p, float4 v) { vst1q_f32(p, v); }
+static inline float4 Mul4(float4 a, float4 b) { return vmulq_f32(a, b); }
+static inline float4 MulAdd4(float4 a, float4 b, float4 c) { return vmlaq_f32(c, a, b); }
+static inline float4 Div4(float4 a, float4 b)
+{
+#if defined(__aarch64__)
+	return vdivq_f32(a, b);
+#else
+	// No division in ARMv7 NEON: reciprocal estimate refined with two Newton-Raphson steps
+	float4 r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+#endif
+}
+
+static inline void LoadVector3x4(const Vector3* p, float4& x, float4& y, float4& z)
+{
+	float32x4x3_t t = vld3q_f32(p->v);
+	x = t.val[0]; y = t.val[1]; z = t.val[2];
+}
+
+static inline void StoreVector3x4(Vector3* p, float4 x, float4 y, float4 z)
+{
+	float32x4x3_t t;
+	t.val[0] = x; t.val[1] = y; t.val[2] = z;
+	vst3q_f32(p->v, t);
+}
+
+static inline void StoreVector4x4(Vector4* p, float4 x, float4 y, float4 z, float4 w)
+{
+	float32x4x4_t t;
+	t.val[0] = x; t.val[1] = y; t.val[2] = z; t.val[3] = w;
+	vst4q_f32(p->v, t);
+}
+#endif
+
+template<int MODE>
+static inline void TransformScalar(const float* m, float x, float y, float z, float& rx, float& ry, float& rz)
+{
+	rx = m[0] * x + m[4] * y + m[8] * z;
+	ry = m[1] * x + m[5] * y + m[9] * z;
+	rz = m[2] * x + m[6] * y + m[10] * z;
+	if (MODE == STREAM_DIRECTIONS)
+		return;
+	rx += m[12]; ry += m[13]; rz += m[14];
+	if (MODE == STREAM_PROJECT)
+	{
+		float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+		rx /= w; ry /= w; rz /= w;
+	}
+}
+
+#if defined(USE_SSE2) || defined(USE_NEON)
+// The 16 matrix values broadcasted, computed once per range
+struct sStreamMatrix
+{
+	float4 c[16];
+	sStreamMatrix(const Matrix44& matrix) { for (int i = 0; i < 16; ++i) c[i] = Splat4(matrix.m[i]); }
+};
+
+template<int MODE>
+static inline void Transform4(const float4* c, float4 x, float4 y, float4 z, float4& rx, float4& ry, float4& rz)
+{
+	if (MODE == STREAM_DIRECTIONS)
+	{
+		rx = MulAdd4(c[8], z, MulAdd4(c[4], y, Mul4(c[0], x)));
+		ry = MulAdd4(c[9], z, MulAdd4(c[5], y, Mul4(c[1], x)));
+		rz = MulAdd4(c[10], z, MulAdd4(c[6], y, Mul4(c[2], x)));
+		return;
+	}
+	rx = MulAdd4(c[8], z, MulAdd4(c[4], y, MulAdd4(c[0], x, c[12])));
+	ry = MulAdd4(c[9], z, MulAdd4(c[5], y, MulAdd4(c[1], x, c[13])));
+	rz = MulAdd4(c[10], z, MulAdd4(c[6], y, MulAdd4(c[2], x, c[14])));
+	if (MODE == STREAM_PROJECT)
+	{
+		float4 w = MulAdd4(c[11], z, MulAdd4(c[7], y, MulAdd4(c[3], x, c[15])));
+		rx = Div4(rx, w); ry = Div4(ry, w); rz = Div4(rz, w);
+	}
+}
+#endif
+
+template<int MODE>
+static void StreamAoS(const Matrix44& matrix, const Vector3* in, Vector3* out, unsigned int begin, unsigned int end)
+{
+	unsigned int i = begin;
+#if defined(USE_SSE2) || defined(USE_NEON)
+	sStreamMatrix sm(matrix);
+	for (; i + 4 <= end; i += 4)
+	{
+		float4 x, y, z;
+		LoadVector3x4(in + i, x, y, z);
+		Transform4<MODE>(sm.c, x, y, z, x, y, z);
+		StoreVector3x4(out + i, x, y, z);
+	}
+#endif
+	for (; i < end; ++i)
+	{
+		Vector3 v = in[i];
+		TransformScalar<MODE>(matrix.m, v.x, v.y, v.z, out[i].x, out[i].y, out[i].z);
+	}
+}
+
+template<int MODE>
+static void StreamSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* rx, float* ry, float* rz, unsigned int begin, unsigned int end)
+{
+	unsigned int i = begin;
+#if defined(USE_SSE2) || defined(USE_NEON)
+	sStreamMatrix sm(matrix);
+	for (; i + 4 <= end; i += 4)
+	{
+		float4 ox, oy, oz;
+		Transform4<MODE>(sm.c, Load4(x + i), Load4(y + i), Load4(z + i), ox, oy, oz);
+		Store4(rx + i, ox);
+		Store4(ry + i, oy);
+		Store4(rz + i, oz);
+	}
+#endif
+	for (; i < end; ++i)
+	{
+		float vx = x[i], vy = y[i], vz = z[i];
+		TransformScalar<MODE>(matrix.m, vx, vy, vz, rx[i], ry[i], rz[i]);
+	}
+}
+
+static void StreamHomogeneous(const Matrix44& matrix, const Vector3* in, Vector4* out, unsigned int begin, unsigned int end)
+{
+	unsigned int i = begin;
+#if defined(USE_SSE2) || defined(USE_NEON)
+	sStreamMatrix sm(matrix);
+	const float4* c = sm.c;
+	for (; i + 4 <= end; i += 4)
+	{
+		float4 x, y, z;
+		LoadVector3x4(in + i, x, y, z);
+		StoreVector4x4(out + i,
+			MulAdd4(c[8], z, MulAdd4(c[4], y, MulAdd4(c[0], x, c[12]))),
+			MulAdd4(c[9], z, MulAdd4(c[5], y, MulAdd4(c[1], x, c[13]))),
+			MulAdd4(c[10], z, MulAdd4(c[6], y, MulAdd4(c[2], x, c[14]))),
+			MulAdd4(c[11], z, MulAdd4(c[7], y, MulAdd4(c[3], x, c[15]))));
+	}
+#endif
+	for (; i < end; ++i)
+		out[i] = matrix * Vector4(in[i].x, in[i].y, in[i].z, 1.0f);
+}
+
+// Small arrays are not worth the cost of starting the threads
+#define STREAM_CHUNK_SIZE 16384
+
+template<typename F>
+static void RunStream(unsigned int count, bool multithread, F kernel)
+{
+	if (!multithread || count < 2 * STREAM_CHUNK_SIZE)
+	{
+		kernel(0, count);
+		return;
+	}
+	int num_chunks = (int)((count + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE);
+	parallelFor(0, num_chunks, [&](int chunk) {
+		unsigned int begin = chunk * STREAM_CHUNK_SIZE;
+		kernel(begin, std::min(count, begin + STREAM_CHUNK_SIZE));
+	});
+}
+
+void TransformPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamAoS<STREAM_POINTS>(matrix, points, result, begin, end); });
+}
+
+void TransformDirections(const Matrix44& matrix, const Vector3* directions, Vector3* result, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamAoS<STREAM_DIRECTIONS>(matrix, directions, result, begin, end); });
+}
+
+void ProjectPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamAoS<STREAM_PROJECT>(matrix, points, result, begin, end); });
+}
+
+void TransformPoints(const Matrix44& matrix, const Vector3* points, Vector4* result, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamHomogeneous(matrix, points, result, begin, end); });
+}
+
+void TransformPointsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamSoA<STREAM_POINTS>(matrix, x, y, z, result_x, result_y, result_z, begin, end); });
+}
+
+void TransformDirectionsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamSoA<STREAM_DIRECTIONS>(matrix, x, y, z, result_x, result_y, result_z, begin, end); });
+}
+
+void ProjectPointsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread)
+{
+	RunStream(count, multithread, [&](unsigned int begin, unsigned int end) { StreamSoA<STREAM_PROJECT>(matrix, x, y, z, result_x, result_y, result_z, begin, end); });
+}
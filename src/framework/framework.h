@@ -13,10 +13,22 @@
 #endif
 #define DEG2RAD 0.0174532925f
 
+// SIMD instruction sets (SSE2 is always there on x64, NEON on arm64), scalar code is used otherwise
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define USE_SSE2
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+	#define USE_NEON
+	#include <arm_neon.h>
+#endif
+
 // Clamp a value 'x' between 'a' and 'b'
-inline float clamp(float x, float a, float b) { return x < a ? a : (x > b ? b : x); }
-inline unsigned int clamp(unsigned int x, unsigned int a, unsigned int b) { return x < a ? a : (x > b ? b : x); }
-inline unsigned char clamp(unsigned char x, unsigned char a, unsigned char b) { return x < a ? a : (x > b ? b : x); }
+constexpr inline float clamp(float x, float a, float b) { return x < a ? a : (x > b ? b : x); }
+constexpr inline unsigned int clamp(unsigned int x, unsigned int a, unsigned int b) { return x < a ? a : (x > b ? b : x); }
+constexpr inline unsigned char clamp(unsigned char x, unsigned char a, unsigned char b) { return x < a ? a : (x > b ? b : x); }
+
+// The basic vector and color operations are defined here (inline and constexpr when possible)
+// so the compiler can vectorize the loops that use them without link time optimization
 
 class Vector3;
 
@@ -31,23 +43,28 @@ public:
 				 unsigned char b; };
 		unsigned char v[3];
 	};
-	Color() { r = g = b = 0; }
-	Color(float r, float g, float b) { this->r = (unsigned char)r; this->g = (unsigned char)g; this->b = (unsigned char)b; }
-	void operator = (const Vector3& v);
+	constexpr Color() : r(0), g(0), b(0) {}
+	constexpr Color(float r, float g, float b) : r((unsigned char)r), g((unsigned char)g), b((unsigned char)b) {}
+	inline void operator = (const Vector3& v);
 
 	void Set(float r, float g, float b) { this->r = (unsigned char)clamp(r,0.0,255.0); this->g = (unsigned char)clamp(g,0.0,255.0); this->b = (unsigned char)clamp(b,0.0,255.0); }
 	void Random() { r = rand() % 255; g = rand() % 255; b = rand() % 255; }
 
-	Color operator * (float v) { return Color((unsigned char)(r*v), (unsigned char)(g*v), (unsigned char)(b*v)); }
-	void operator *= (float v) { r = (unsigned char)(r * v); g = (unsigned char)(g * v); b = (unsigned char)(b * v); }
-	Color operator / (float v) { return Color((unsigned char)(r/v), (unsigned char)(g/v), (unsigned char)(b/v)); }
-	void operator /= (float v) { r = (unsigned char)(r / v); g = (unsigned char)(g / v); b = (unsigned char)(b / v); }
-	Color operator + (const Color& v) { return Color((float)(r+v.r), (float)(g+v.g), (float)(b+v.b) ); }
-	void operator += (const Color& v) { r += v.r; g += v.g; b += v.b; }
-	Color operator - (const Color& v) { return Color((float)(r-v.r), (float)(g-v.g), (float)(b-v.b)); }
-	void operator -= (const Color& v) { r -= v.r; g -= v.g; b -= v.b; }
-	Color operator * (const Color& v) { return Color((float)(r * v.r), (float)(g * v.g), (float)(b * v.b)); }
-	void operator *= (const Color& v) { r *= v.r; g *= v.g; b *= v.b; }
+	// All the operators saturate: results are clamped to [0..255] instead of wrapping around
+	void operator *= (float v) { r = (unsigned char)clamp(r * v, 0.0f, 255.0f); g = (unsigned char)clamp(g * v, 0.0f, 255.0f); b = (unsigned char)clamp(b * v, 0.0f, 255.0f); }
+	constexpr Color operator / (float v) const { return Color(clamp(r / v, 0.0f, 255.0f), clamp(g / v, 0.0f, 255.0f), clamp(b / v, 0.0f, 255.0f)); }
+	void operator /= (float v) { *this = *this / v; }
+	constexpr Color operator + (const Color& v) const { return Color(SaturateAdd(r, v.r), SaturateAdd(g, v.g), SaturateAdd(b, v.b)); }
+	void operator += (const Color& v) { *this = *this + v; }
+	constexpr Color operator - (const Color& v) const { return Color(SaturateSub(r, v.r), SaturateSub(g, v.g), SaturateSub(b, v.b)); }
+	void operator -= (const Color& v) { *this = *this - v; }
+	constexpr Color operator * (const Color& v) const { return Color(SaturateMul(r, v.r), SaturateMul(g, v.g), SaturateMul(b, v.b)); }
+	void operator *= (const Color& v) { *this = *this * v; }
+
+	// Saturated byte arithmetic (see blend.h to apply it to whole images)
+	static constexpr float SaturateAdd(unsigned char a, unsigned char b) { return a + b > 255 ? 255.0f : (float)(a + b); }
+	static constexpr float SaturateSub(unsigned char a, unsigned char b) { return a < b ? 0.0f : (float)(a - b); }
+	static constexpr float SaturateMul(unsigned char a, unsigned char b) { return a * b > 255 ? 255.0f : (float)(a * b); }
 
 	//some colors to help
 	static const Color WHITE;
@@ -61,8 +78,8 @@ public:
 	static const Color PURPLE;
 };
 
-inline Color operator * (const Color& c, float v) { return Color((unsigned char)(c.r*v), (unsigned char)(c.g*v), (unsigned char)(c.b*v)); }
-inline Color operator * (float v, const Color& c) { return Color((unsigned char)(c.r*v), (unsigned char)(c.g*v), (unsigned char)(c.b*v)); }
+constexpr inline Color operator * (const Color& c, float v) { return Color(clamp(c.r * v, 0.0f, 255.0f), clamp(c.g * v, 0.0f, 255.0f), clamp(c.b * v, 0.0f, 255.0f)); }
+constexpr inline Color operator * (float v, const Color& c) { return c * v; }
 //*********************************
 
 class Vector2
@@ -74,22 +91,22 @@ public:
 		float value[2];
 	};
 
-	Vector2() { x = y = 0.0f; }
-	Vector2(float x, float y) { this->x = x; this->y = y; }
+	constexpr Vector2() : x(0.0f), y(0.0f) {}
+	constexpr Vector2(float x, float y) : x(x), y(y) {}
 
 	float length() { return sqrt(x * x + y * y); }
 	float length() const { return sqrt(x * x + y * y); }
 
-	float Dot(const Vector2& v);
-	float Perpdot(const Vector2& v);
+	constexpr float Dot(const Vector2& v) const { return x * v.x + y * v.y; }
+	constexpr float Perpdot(const Vector2& v) const { return y * v.x + -x * v.y; }
 
 	void set(float x, float y) { this->x = x; this->y = y; }
 
 	Vector2& normalize() { *this *= 1/(float)length(); return *this; }
 
-	float Distance(const Vector2& v);
+	inline float Distance(const Vector2& v) const;
 	void Random(float range);
-	void Clamp(float min, float max);
+	void Clamp(float min, float max) { x = clamp(x, min, max); y = clamp(y, min, max); }
 
 	void operator *= (float v) { x *= v; y *= v; }
 	void operator *= (const Vector2& v) { x *= v.x; y *= v.y; }
@@ -97,12 +114,14 @@ public:
 	void operator -= (const Vector2& v) { x -= v.x; y -= v.y; }
 };
 
-Vector2 operator * (const Vector2& a, float v);
-Vector2 operator / (const Vector2& a, float v);
-Vector2 operator + (const Vector2& a, const Vector2& b);
-Vector2 operator - (const Vector2& a, const Vector2& b);
-Vector2 operator * (const Vector2& a, const Vector2& b);
-Vector2 operator / (const Vector2& a, const Vector2& b);
+constexpr inline Vector2 operator * (const Vector2& a, float v) { return Vector2(a.x * v, a.y * v); }
+constexpr inline Vector2 operator / (const Vector2& a, float v) { return Vector2(a.x / v, a.y / v); }
+constexpr inline Vector2 operator + (const Vector2& a, const Vector2& b) { return Vector2(a.x + b.x, a.y + b.y); }
+constexpr inline Vector2 operator - (const Vector2& a, const Vector2& b) { return Vector2(a.x - b.x, a.y - b.y); }
+constexpr inline Vector2 operator * (const Vector2& a, const Vector2& b) { return Vector2(a.x * b.x, a.y * b.y); }
+constexpr inline Vector2 operator / (const Vector2& a, const Vector2& b) { return Vector2(a.x / b.x, a.y / b.y); }
+
+inline float Vector2::Distance(const Vector2& v) const { return (v - *this).length(); }
 
 inline float distance(const Vector2& a, const Vector2& b) { return (float)(a - b).length(); }
 inline float distance(float x, float y, float x2, float y2) { return sqrtf((x - x2) * (x - x2) + (y - y2) * (y - y2)); }
@@ -116,25 +135,25 @@ public:
 		float v[3];
 	};
 
-	Vector3() { x = y = z = 0.0f; }
-	Vector3(float v) { this->x = v; this->y = v; this->z = v; }
-	Vector3(float x, float y, float z) { this->x = x; this->y = y; this->z = z;	}
+	constexpr Vector3() : x(0.0f), y(0.0f), z(0.0f) {}
+	constexpr Vector3(float v) : x(v), y(v), z(v) {}
+	constexpr Vector3(float x, float y, float z) : x(x), y(y), z(z) {}
 
-	float Length();
-	float Length() const;
+	float Length() { return sqrt(x*x + y*y + z*z); }
+	float Length() const { return sqrt(x*x + y*y + z*z); }
 
 	void Set(float x, float y, float z) { this->x = x; this->y = y; this->z = z; }
 
-	Vector3& Normalize();
-	Vector3 Cross( const Vector3& v ) const;
-	Vector2 GetVector2() { return Vector2(x, y); }
+	Vector3& Normalize() { float len = Length(); x /= len; y /= len; z /= len; return *this; }
+	constexpr Vector3 Cross( const Vector3& b ) const { return Vector3(y*b.z - z*b.y, z*b.x - x*b.z, x*b.y - y*b.x); }
+	constexpr Vector2 GetVector2() const { return Vector2(x, y); }
 
 	void Random(float range);
 	void Random(Vector3 range);
-	void Clamp(float min, float max);
+	void Clamp(float min, float max) { x = clamp(x, min, max); y = clamp(y, min, max); z = clamp(z, min, max); }
 
-	float Distance(const Vector3& v) const;
-	float Dot( const Vector3& v ) const;
+	inline float Distance(const Vector3& v) const;
+	constexpr float Dot( const Vector3& v ) const { return x*v.x + y*v.y + z*v.z; }
 
 	static const Vector3 UP;
 	static const Vector3 DOWN;
@@ -142,6 +161,22 @@ public:
 	static const Vector3 LEFT;
 };
 
+// Operators, they are our friends
+constexpr inline Vector3 operator + (const Vector3& a, const Vector3& b) { return Vector3(a.x + b.x, a.y + b.y, a.z + b.z); }
+constexpr inline Vector3 operator - (const Vector3& a, const Vector3& b) { return Vector3(a.x - b.x, a.y - b.y, a.z - b.z); }
+constexpr inline Vector3 operator * (const Vector3& a, float v) { return Vector3(a.x * v, a.y * v, a.z * v); }
+constexpr inline Vector3 operator / (const Vector3& a, float v) { return Vector3(a.x / v, a.y / v, a.z / v); }
+constexpr inline Vector3 operator * (const Vector3& a, const Vector3& b) { return Vector3(a.x * b.x, a.y * b.y, a.z * b.z); }
+constexpr inline Vector3 operator / (const Vector3& a, const Vector3& b) { return Vector3(a.x / b.x, a.y / b.y, a.z / b.z); }
+
+inline float Vector3::Distance(const Vector3& v) const { return (v - *this).Length(); }
+
+inline void Color::operator = (const Vector3& v)
+{
+	r = clamp( (unsigned char)v.x,0,255);
+	g = clamp( (unsigned char)v.y,0,255);
+	b = clamp( (unsigned char)v.z,0,255);
+}
 
 class Vector4
 {
@@ -152,11 +187,11 @@ public:
 		float v[4];
 	};
 
-	Vector4() { x = y = z = w = 0.0f; }
-	Vector4(float x, float y, float z, float w ) { this->x = x; this->y = y; this->z = z; this->w = w; }
+	constexpr Vector4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+	constexpr Vector4(float x, float y, float z, float w ) : x(x), y(y), z(z), w(w) {}
 	void Set(float x, float y, float z, float w) { this->x = x; this->y = y; this->z = z; this->w = w; }
 
-	Vector3 GetVector3() { return Vector3(x,y,z); }
+	constexpr Vector3 GetVector3() const { return Vector3(x,y,z); }
 };
 
 //****************************
@@ -178,7 +213,7 @@ class Matrix44
 			float m[16];
 		};
 
-		Matrix44();
+		Matrix44() { SetIdentity(); }
 		Matrix44(const float* v);
 
 		void Set(
@@ -188,7 +223,12 @@ class Matrix44
 			float r4c1, float r4c2, float r4c3, float r4c4 
 		);
 		void Clear();
-		void SetIdentity();
+		void SetIdentity() {
+			m[0] = 1; m[4] = 0; m[8] = 0; m[12] = 0;
+			m[1] = 0; m[5] = 1; m[9] = 0; m[13] = 0;
+			m[2] = 0; m[6] = 0; m[10] = 1; m[14] = 0;
+			m[3] = 0; m[7] = 0; m[11] = 0; m[15] = 1;
+		}
 		void Transpose();
 
 		// Get base vectors
@@ -196,7 +236,13 @@ class Matrix44
 		Vector3 TopVector() { return Vector3(m[4],m[5],m[6]); }
 		Vector3 FrontVector() { return Vector3(m[8],m[9],m[10]); }
 
+		// General inverse, returns false (and leaves the matrix untouched) if it is singular
 		bool Inverse();
+		// Gaussian elimination, what Inverse uses without SIMD and the reference to check the SIMD versions
+		bool InverseGaussian();
+		// Fast path for rotation (+ scale) and translation matrices, e.g. view and model matrices:
+		// transposes the 3x3 part (dividing by the squared scale) and moves the translation back
+		bool InverseAffine();
 		void SetUpAndOrthonormalize(Vector3 up);
 		void SetFrontAndOrthonormalize(Vector3 front);
 
@@ -224,16 +270,88 @@ class Matrix44
 		Matrix44 operator * (const Matrix44& matrix) const;
 };
 
-// Operators, they are our friends
-// Matrix44 operator * ( const Matrix44& a, const Matrix44& b );
-Vector3 operator * (const Matrix44& matrix, const Vector3& v);
-Vector3 operator + (const Vector3& a, const Vector3& b);
-Vector3 operator - (const Vector3& a, const Vector3& b);
-Vector3 operator * (const Vector3& a, float v);
-Vector3 operator / (const Vector3& a, float v);
-Vector3 operator * (const Vector3& a, const Vector3& b);
-Vector3 operator / (const Vector3& a, const Vector3& b);
-Vector4 operator * (const Matrix44& matrix, const Vector4& v);
+// Matrix products are inlined so they can be used in hot loops, every column of the
+// result is a linear combination of the columns of the left matrix
+inline Matrix44 Matrix44::operator * (const Matrix44& matrix) const
+{
+	Matrix44 ret;
+#if defined(USE_SSE2)
+	__m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+	for (int i = 0; i < 4; ++i)
+	{
+		const float* b = matrix.m + i * 4;
+		__m128 r = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(b[0])), _mm_mul_ps(c1, _mm_set1_ps(b[1]))),
+			_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(b[2])), _mm_mul_ps(c3, _mm_set1_ps(b[3]))));
+		_mm_storeu_ps(ret.m + i * 4, r);
+	}
+#elif defined(USE_NEON)
+	float32x4_t c0 = vld1q_f32(m), c1 = vld1q_f32(m + 4), c2 = vld1q_f32(m + 8), c3 = vld1q_f32(m + 12);
+	for (int i = 0; i < 4; ++i)
+	{
+		const float* b = matrix.m + i * 4;
+		float32x4_t r = vmulq_n_f32(c0, b[0]);
+		r = vmlaq_n_f32(r, c1, b[1]);
+		r = vmlaq_n_f32(r, c2, b[2]);
+		r = vmlaq_n_f32(r, c3, b[3]);
+		vst1q_f32(ret.m + i * 4, r);
+	}
+#else
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			ret.M[i][j] = M[0][j] * matrix.M[i][0] + M[1][j] * matrix.M[i][1] + M[2][j] * matrix.M[i][2] + M[3][j] * matrix.M[i][3];
+#endif
+	return ret;
+}
+
+inline Vector4 operator * (const Matrix44& matrix, const Vector4& v)
+{
+#if defined(USE_SSE2)
+	const float* m = matrix.m;
+	__m128 r = _mm_add_ps(
+		_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m), _mm_set1_ps(v.x)), _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_set1_ps(v.y))),
+		_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 8), _mm_set1_ps(v.z)), _mm_mul_ps(_mm_loadu_ps(m + 12), _mm_set1_ps(v.w))));
+	Vector4 result;
+	_mm_storeu_ps(result.v, r);
+	return result;
+#elif defined(USE_NEON)
+	const float* m = matrix.m;
+	float32x4_t r = vmulq_n_f32(vld1q_f32(m), v.x);
+	r = vmlaq_n_f32(r, vld1q_f32(m + 4), v.y);
+	r = vmlaq_n_f32(r, vld1q_f32(m + 8), v.z);
+	r = vmlaq_n_f32(r, vld1q_f32(m + 12), v.w);
+	Vector4 result;
+	vst1q_f32(result.v, r);
+	return result;
+#else
+	float x = matrix.m[0] * v.x + matrix.m[4] * v.y + matrix.m[8] * v.z + matrix.m[12] * v.w;
+	float y = matrix.m[1] * v.x + matrix.m[5] * v.y + matrix.m[9] * v.z + matrix.m[13] * v.w;
+	float z = matrix.m[2] * v.x + matrix.m[6] * v.y + matrix.m[10] * v.z + matrix.m[14] * v.w;
+	float w = matrix.m[3] * v.x + matrix.m[7] * v.y + matrix.m[11] * v.z + matrix.m[15] * v.w;
+	return Vector4(x, y, z, w);
+#endif
+}
+
+//Multiplies a vector by a matrix and returns the new vector ( assumes v4 = (v.x, v.y, v.z, 1) )
+inline Vector3 operator * (const Matrix44& matrix, const Vector3& v)
+{
+	Vector4 r = matrix * Vector4(v.x, v.y, v.z, 1.0f);
+	return Vector3(r.x, r.y, r.z);
+}
+
+// Stream transforms: apply a matrix to a whole array at once (SIMD, 4 elements per step).
+// The output can be the same array as the input. Set 'multithread' to split large arrays across threads
+// Points use w = 1, directions use w = 0 (no translation), projected points are divided by the resulting w
+void TransformPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int count, bool multithread = false);
+void TransformDirections(const Matrix44& matrix, const Vector3* directions, Vector3* result, unsigned int count, bool multithread = false);
+void ProjectPoints(const Matrix44& matrix, const Vector3* points, Vector3* result, unsigned int count, bool multithread = false);
+// Keeps the homogeneous coordinate, e.g. to get clip space positions
+void TransformPoints(const Matrix44& matrix, const Vector3* points, Vector4* result, unsigned int count, bool multithread = false);
+
+// Same for structure of arrays inputs: x[i], y[i], z[i] is the element i
+void TransformPointsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread = false);
+void TransformDirectionsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread = false);
+void ProjectPointsSoA(const Matrix44& matrix, const float* x, const float* y, const float* z, float* result_x, float* result_y, float* result_z, unsigned int count, bool multithread = false);
 
 class Vector3u
 {
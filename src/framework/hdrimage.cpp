@@ -0,0 +1,308 @@
+#include "hdrimage.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Encoding uses a table of linear values in [0..1], fine enough for the darkest sRGB steps (around 3e-4
+// in linear, the table step is 6e-5): decoded bytes go back exactly, other values can be off by one
+#define SRGB_ENCODE_BITS 14
+#define SRGB_ENCODE_SIZE (1 << SRGB_ENCODE_BITS)
+
+// Rows converted by every job when the conversions are split between threads
+#define HDR_ROWS_PER_JOB 32
+
+struct sSRGBTables
+{
+	float decode[256];
+	unsigned char encode[SRGB_ENCODE_SIZE];
+
+	sSRGBTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			decode[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < SRGB_ENCODE_SIZE; ++i)
+		{
+			float l = i / (float)(SRGB_ENCODE_SIZE - 1);
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			encode[i] = (unsigned char)clamp(c * 255.0f + 0.5f, 0.0f, 255.0f);
+		}
+	}
+};
+
+// Built the first time they are needed (thread safe since C++11)
+static const sSRGBTables& GetSRGBTables()
+{
+	static sSRGBTables tables;
+	return tables;
+}
+
+float HDRImage::SRGBToLinear(unsigned char v)
+{
+	return GetSRGBTables().decode[v];
+}
+
+unsigned char HDRImage::LinearToSRGB(float v)
+{
+	return GetSRGBTables().encode[(int)(clamp(v, 0.0f, 1.0f) * (SRGB_ENCODE_SIZE - 1) + 0.5f)];
+}
+
+HDRImage::HDRImage(unsigned int width, unsigned int height, unsigned int channels)
+{
+	this->width = width;
+	this->height = height;
+	this->channels = channels == 4 ? 4 : 3;
+	pixels = new float[width * height * this->channels];
+	memset(pixels, 0, width * height * this->channels * sizeof(float));
+}
+
+HDRImage::HDRImage(const Image& image, bool srgb)
+{
+	width = height = 0;
+	channels = 3;
+	pixels = NULL;
+	FromImage(image, srgb);
+}
+
+// Copy constructor
+HDRImage::HDRImage(const HDRImage& c)
+{
+	pixels = NULL;
+	width = c.width;
+	height = c.height;
+	channels = c.channels;
+	if (c.pixels)
+	{
+		pixels = new float[width * height * channels];
+		memcpy(pixels, c.pixels, width * height * channels * sizeof(float));
+	}
+}
+
+// Assign operator
+HDRImage& HDRImage::operator = (const HDRImage& c)
+{
+	if (this == &c)
+		return *this;
+	delete[] pixels;
+	pixels = NULL;
+
+	width = c.width;
+	height = c.height;
+	channels = c.channels;
+	if (c.pixels)
+	{
+		pixels = new float[width * height * channels];
+		memcpy(pixels, c.pixels, width * height * channels * sizeof(float));
+	}
+	return *this;
+}
+
+HDRImage::~HDRImage()
+{
+	delete[] pixels;
+}
+
+void HDRImage::Resize(unsigned int width, unsigned int height)
+{
+	if (this->width == width && this->height == height && pixels)
+		return;
+	delete[] pixels;
+	this->width = width;
+	this->height = height;
+	pixels = new float[width * height * channels];
+	memset(pixels, 0, width * height * channels * sizeof(float));
+}
+
+void HDRImage::Fill(const Vector3& color, float alpha)
+{
+	float value[4] = { color.x, color.y, color.z, alpha };
+	for (unsigned int pos = 0; pos < width * height; ++pos)
+		memcpy(pixels + pos * channels, value, channels * sizeof(float));
+}
+
+// Calls job(first_row, end_row), splitting the rows between threads for big images
+template <typename F>
+static void ForEachRowRange(unsigned int width, unsigned int height, F job)
+{
+	if (width * height < 256 * 256)
+	{
+		job(0u, height);
+		return;
+	}
+	parallelFor(0, (int)((height + HDR_ROWS_PER_JOB - 1) / HDR_ROWS_PER_JOB), [&](int i) {
+		unsigned int start = i * HDR_ROWS_PER_JOB;
+		job(start, std::min(height, start + HDR_ROWS_PER_JOB));
+	});
+}
+
+void HDRImage::FromImage(const Image& image, bool srgb)
+{
+	channels = 3;
+	Resize(image.width, image.height);
+
+	const float* decode = GetSRGBTables().decode;
+	ForEachRowRange(width, height, [&](unsigned int start, unsigned int end) {
+		unsigned int count = (end - start) * width * 3;
+		const unsigned char* src = image.pixels[start * width].v;
+		float* dst = pixels + start * width * 3;
+		unsigned int i = 0;
+		if (srgb)
+		{
+			// A table lookup per channel, nothing to gain from SIMD here
+			for (; i < count; ++i)
+				dst[i] = decode[src[i]];
+			return;
+		}
+#if defined(USE_SSE2)
+		const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+			__m128i lo = _mm_unpacklo_epi8(b, zero), hi = _mm_unpackhi_epi8(b, zero);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+			_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+			_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+		}
+#elif defined(USE_NEON)
+		const float32x4_t scale = vdupq_n_f32(1.0f / 255.0f);
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x16_t b = vld1q_u8(src + i);
+			uint16x8_t lo = vmovl_u8(vget_low_u8(b)), hi = vmovl_u8(vget_high_u8(b));
+			vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+			vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+			vst1q_f32(dst + i + 8, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+			vst1q_f32(dst + i + 12, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+		}
+#endif
+		for (; i < count; ++i)
+			dst[i] = src[i] / 255.0f;
+	});
+}
+
+static inline float ToneMap(float x, HDRImage::eToneMapping tonemapping)
+{
+	if (tonemapping == HDRImage::TONEMAP_REINHARD)
+		return x / (1.0f + x);
+	if (tonemapping == HDRImage::TONEMAP_ACES)
+		return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+	return x;
+}
+
+#if defined(USE_SSE2)
+static inline __m128 ToneMap4(__m128 x, HDRImage::eToneMapping tonemapping)
+{
+	if (tonemapping == HDRImage::TONEMAP_REINHARD)
+		return _mm_div_ps(x, _mm_add_ps(_mm_set1_ps(1.0f), x));
+	if (tonemapping == HDRImage::TONEMAP_ACES)
+	{
+		__m128 a = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+		__m128 b = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+		return _mm_div_ps(a, b);
+	}
+	return x;
+}
+#elif defined(USE_NEON)
+static inline float32x4_t ToneMap4(float32x4_t x, HDRImage::eToneMapping tonemapping)
+{
+	if (tonemapping == HDRImage::TONEMAP_CLAMP)
+		return x;
+	float32x4_t a, b;
+	if (tonemapping == HDRImage::TONEMAP_REINHARD)
+	{
+		a = x;
+		b = vaddq_f32(vdupq_n_f32(1.0f), x);
+	}
+	else
+	{
+		a = vmulq_f32(x, vmlaq_n_f32(vdupq_n_f32(0.03f), x, 2.51f));
+		b = vmlaq_f32(vdupq_n_f32(0.14f), x, vmlaq_n_f32(vdupq_n_f32(0.59f), x, 2.43f));
+	}
+	// Reciprocal estimate refined twice, ARMv7 has no vector division
+	float32x4_t r = vrecpeq_f32(b);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	r = vmulq_f32(vrecpsq_f32(b, r), r);
+	return vmulq_f32(a, r);
+}
+#endif
+
+void HDRImage::ToImage(Image& image, bool srgb, eToneMapping tonemapping, float exposure) const
+{
+	if (image.width != width || image.height != height || !image.pixels)
+	{
+		delete[] image.pixels;
+		image.pixels = new Color[width * height];
+		image.width = width;
+		image.height = height;
+	}
+
+	const unsigned char* encode = GetSRGBTables().encode;
+	// Values are tone mapped, clamped to [0..1] and scaled to the table size or to 255
+	const float scale = srgb ? (float)(SRGB_ENCODE_SIZE - 1) : 255.0f;
+
+	ForEachRowRange(width, height, [&](unsigned int start, unsigned int end) {
+		// RGBA rows are converted with all their channels in a temporary row and then the alpha is skipped
+		std::vector<unsigned char> temp(channels == 4 ? width * 4 : 0);
+		for (unsigned int y = start; y < end; ++y)
+		{
+			const float* src = pixels + y * width * channels;
+			unsigned char* row = image.pixels[y * width].v;
+			unsigned char* dst = channels == 4 ? &temp[0] : row;
+			unsigned int count = width * channels;
+			unsigned int i = 0;
+
+#if defined(USE_SSE2)
+			const __m128 v_exposure = _mm_set1_ps(exposure), v_scale = _mm_set1_ps(scale), v_half = _mm_set1_ps(0.5f);
+			const __m128 v_zero = _mm_setzero_ps(), v_one = _mm_set1_ps(1.0f);
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 x = ToneMap4(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), v_exposure), v_zero), tonemapping);
+				x = _mm_min_ps(_mm_max_ps(x, v_zero), v_one);
+				__m128i index = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, v_scale), v_half));
+				if (srgb)
+				{
+					// No gather in SSE2, the 4 lookups are scalar
+					int idx[4];
+					_mm_storeu_si128((__m128i*)idx, index);
+					dst[i] = encode[idx[0]]; dst[i + 1] = encode[idx[1]]; dst[i + 2] = encode[idx[2]]; dst[i + 3] = encode[idx[3]];
+				}
+				else
+				{
+					__m128i packed = _mm_packus_epi16(_mm_packs_epi32(index, index), _mm_setzero_si128());
+					int value = _mm_cvtsi128_si32(packed);
+					memcpy(dst + i, &value, 4);
+				}
+			}
+#elif defined(USE_NEON)
+			const float32x4_t v_zero = vdupq_n_f32(0.0f), v_one = vdupq_n_f32(1.0f);
+			for (; i + 4 <= count; i += 4)
+			{
+				float32x4_t x = ToneMap4(vmaxq_f32(vmulq_n_f32(vld1q_f32(src + i), exposure), v_zero), tonemapping);
+				x = vminq_f32(vmaxq_f32(x, v_zero), v_one);
+				uint32x4_t index = vcvtq_u32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), x, scale));
+				uint32_t idx[4];
+				vst1q_u32(idx, index);
+				for (int k = 0; k < 4; ++k)
+					dst[i + k] = srgb ? encode[idx[k]] : (unsigned char)idx[k];
+			}
+#endif
+			for (; i < count; ++i)
+			{
+				float x = clamp(ToneMap(std::max(src[i] * exposure, 0.0f), tonemapping), 0.0f, 1.0f);
+				int index = (int)(x * scale + 0.5f);
+				dst[i] = srgb ? encode[index] : (unsigned char)index;
+			}
+
+			if (channels == 4)
+				for (unsigned int x = 0; x < width; ++x)
+				{
+					row[x * 3] = dst[x * 4]; row[x * 3 + 1] = dst[x * 4 + 1]; row[x * 3 + 2] = dst[x * 4 + 2];
+				}
+		}
+	});
+}
@@ -0,0 +1,58 @@
+/*
+	Image with 3 (RGB) or 4 (RGBA) floats per pixel, to work in linear light without losing precision
+	(blur, lighting, compositing...). Conversions from and to the 8 bits Image decode and encode sRGB
+	using tables and apply an optional tone mapping operator, 4 channels at a time with SIMD.
+*/
+
+#pragma once
+
+#include "framework.h"
+#include "image.h"
+
+class HDRImage
+{
+public:
+	// Operators to bring values above 1 back to [0..1] when converting to an Image
+	enum eToneMapping {
+		TONEMAP_CLAMP,		// Values are just clamped
+		TONEMAP_REINHARD,	// x / (1 + x)
+		TONEMAP_ACES		// Filmic curve (Narkowicz fit of the ACES reference)
+	};
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int channels; // 3 or 4
+	float* pixels; // Interleaved channels, row-major with row 0 at the bottom like Image
+
+	// CONSTRUCTORS 
+	HDRImage() { width = height = 0; channels = 3; pixels = NULL; }
+	HDRImage(unsigned int width, unsigned int height, unsigned int channels = 3);
+	HDRImage(const Image& image, bool srgb = true);
+	HDRImage(const HDRImage& c);
+	HDRImage& operator = (const HDRImage& c); //assign operator
+
+	//destructor
+	~HDRImage();
+
+	void Resize(unsigned int width, unsigned int height); // Contents are lost
+	void Fill(const Vector3& color, float alpha = 1.0f);
+
+	//get the pixel at position x,y
+	float* GetPixelPtr(unsigned int x, unsigned int y) { return pixels + (y * width + x) * channels; }
+	Vector3 GetPixel(unsigned int x, unsigned int y) const { const float* p = pixels + (y * width + x) * channels; return Vector3(p[0], p[1], p[2]); }
+	float GetAlpha(unsigned int x, unsigned int y) const { return channels == 4 ? pixels[(y * width + x) * 4 + 3] : 1.0f; }
+
+	//set the pixel at position x,y
+	void SetPixel(unsigned int x, unsigned int y, const Vector3& c) { if (x >= width || y >= height) return; SetPixelUnsafe(x, y, c); }
+	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const Vector3& c) { float* p = GetPixelPtr(x, y); p[0] = c.x; p[1] = c.y; p[2] = c.z; }
+
+	// Conversion from and to 8 bits per channel. With srgb the bytes are sRGB encoded (usual for
+	// images loaded from disk and the framebuffer), otherwise they are linear values / 255.
+	// Alpha is 1 when coming from an Image and dropped when going to one.
+	void FromImage(const Image& image, bool srgb = true);
+	void ToImage(Image& image, bool srgb = true, eToneMapping tonemapping = TONEMAP_CLAMP, float exposure = 1.0f) const;
+
+	// Single value conversions (same tables as the image ones)
+	static float SRGBToLinear(unsigned char v);
+	static unsigned char LinearToSRGB(float v);
+};
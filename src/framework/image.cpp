@@ -2,9 +2,13 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <memory>
+#include <thread>
 #include "GL/glew.h"
 #include "../extra/picopng.h"
 #include "image.h"
+#include "tga.h"
+#include "qoi.h"
 #include "utils.h"
 #include "camera.h"
 #include "mesh.h"
@@ -129,149 +133,199 @@ void Image::FlipY()
 bool Image::LoadPNG(const char* filename, bool flip_y)
 {
 	std::string sfullPath = absResPath(filename);
-	std::ifstream file(sfullPath, std::ios::in | std::ios::binary | std::ios::ate);
-
-	// Get filesize
-	std::streamsize size = 0;
-	if (file.seekg(0, std::ios::end).good()) size = file.tellg();
-	if (file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-
-	if (!size)
+	std::vector<unsigned char> buffer;
+	if (!readFile(sfullPath, buffer))
 		return false;
 
-	std::vector<unsigned char> buffer;
+	// Every row is written to its final (flipped) position as soon as it is decoded,
+	// so the decoded image is never kept in a second buffer
+	Color* new_pixels = NULL;
+	unsigned int new_width = 0, new_height = 0, row_channels = 0;
+	PNGHeaderCallback on_header = [&](unsigned int w, unsigned int h, unsigned int c) {
+		new_width = w;
+		new_height = h;
+		row_channels = c;
+		new_pixels = new Color[w * h];
+		return true;
+	};
+	PNGRowCallback on_row = [&](unsigned int y, const unsigned char* row) {
+		Color* dst = &new_pixels[(flip_y ? new_height - 1 - y : y) * new_width];
+		if (row_channels == 3)
+			memcpy(dst, row, new_width * sizeof(Color));
+		else
+			for (unsigned int x = 0; x < new_width; ++x, row += 4)
+				dst[x] = Color(row[0], row[1], row[2]);
+	};
 
-	// Read contents of the file into the vector
-	if (size > 0)
+	unsigned int w, h, channels;
+	if (decodePNGStream(w, h, channels, &buffer[0], buffer.size(), on_header, on_row) != 0)
 	{
-		buffer.resize((size_t)size);
-		file.read((char*)(&buffer[0]), size);
-	}
-	else
-		buffer.clear();
-
-	std::vector<unsigned char> out_image;
-
-	if (decodePNG(out_image, width, height, buffer.empty() ? 0 : &buffer[0], (unsigned long)buffer.size(), true) != 0)
+		delete[] new_pixels;
 		return false;
+	}
 
-	size_t bufferSize = out_image.size();
-	unsigned int originalBytesPerPixel = (unsigned int)bufferSize / (width * height);
-	
 	// Force 3 channels
 	bytes_per_pixel = 3;
 
-	if (originalBytesPerPixel == 3) {
-		pixels = new Color[bufferSize];
-		memcpy(pixels, &out_image[0], bufferSize);
-	}
-	else if (originalBytesPerPixel == 4) {
+	delete[] pixels;
+	pixels = new_pixels;
+	width = new_width;
+	height = new_height;
+	return true;
+}
 
-		unsigned int newBufferSize = width * height * bytes_per_pixel;
-		pixels = new Color[newBufferSize];
+// Loads an image from a TGA file
+bool Image::LoadTGA(const char* filename, bool flip_y)
+{
+	std::string sfullPath = absResPath(filename);
+	std::vector<unsigned char> buffer;
+	if (!readFile(sfullPath, buffer))
+		return false;
 
-		unsigned int k = 0;
-		for (unsigned int i = 0; i < bufferSize; i += originalBytesPerPixel) {
-			pixels[k] = Color(out_image[i], out_image[i + 1], out_image[i + 2]);
-			k++;
-		}
+	// The first row of the file ends at the top of the image unless it is flipped
+	Color* new_pixels = NULL;
+	unsigned int new_width = 0, new_height = 0, row_channels = 0;
+	TGAHeaderCallback on_header = [&](unsigned int w, unsigned int h, unsigned int c) {
+		new_width = w;
+		new_height = h;
+		row_channels = c;
+		new_pixels = new Color[w * h];
+		return true;
+	};
+	TGARowCallback on_row = [&](unsigned int y, const unsigned char* row) {
+		unsigned char* dst = (unsigned char*)&new_pixels[(flip_y ? y : new_height - 1 - y) * new_width];
+		if (row_channels == 3)
+			SwizzleRGB(dst, row, new_width);
+		else
+			SwizzleBGRAToRGB(dst, row, new_width);
+	};
+
+	if (buffer.empty() || !DecodeTGA(&buffer[0], buffer.size(), on_header, on_row))
+	{
+		std::cerr << "Unsupported or damaged TGA: " << sfullPath.c_str() << std::endl;
+		delete[] new_pixels;
+		return false;
 	}
 
-	// Flip pixels in Y
-	if (flip_y)
-		FlipY();
+	// Force 3 channels
+	bytes_per_pixel = 3;
 
+	delete[] pixels;
+	pixels = new_pixels;
+	width = new_width;
+	height = new_height;
 	return true;
 }
 
-// Loads an image from a TGA file
-bool Image::LoadTGA(const char* filename, bool flip_y)
+bool Image::SaveTGA(const char* filename, bool rle)
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-	unsigned char TGAcompare[12];
-	unsigned char header[6];
-	unsigned int imageSize;
-	unsigned int bytesPerPixel;
+	std::string fullPath = absResPath(filename);
+	FILE *file = fopen(fullPath.c_str(), "wb");
+	if ( file == NULL )
+	{
+		perror("Failed to open file: ");
+		return false;
+	}
 
-    std::string sfullPath = absResPath( filename );
+	unsigned char header[18];
+	WriteTGAHeader(header, width, height, 3, rle);
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
 
-	FILE * file = fopen( sfullPath.c_str(), "rb");
-   	if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-		fread(header, 1, sizeof(header), file) != sizeof(header))
+	// Written row by row, only one row is converted to BGR (and compressed) at a time
+	std::vector<unsigned char> row(width * 3), packets(rle ? GetTGARowRLESize(width, 3) : 0);
+	for (unsigned int y = 0; y < height && ok; ++y)
 	{
-		std::cerr << "File not found: " << sfullPath.c_str() << std::endl;
-		if (file == NULL)
-			return NULL;
-		else
+		SwizzleRGB(&row[0], (const unsigned char*)&pixels[y * width], width);
+		if (rle)
 		{
-			fclose(file);
-			return NULL;
+			size_t size = EncodeTGARowRLE(&packets[0], &row[0], width, 3);
+			ok = fwrite(&packets[0], 1, size, file) == size;
 		}
+		else
+			ok = fwrite(&row[0], 1, row.size(), file) == row.size();
 	}
+	fclose(file);
+
+	return ok;
+}
 
-	TGAInfo* tgainfo = new TGAInfo;
-    
-	tgainfo->width = header[1] * 256 + header[0];
-	tgainfo->height = header[3] * 256 + header[2];
-    
-	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
+bool Image::SavePNG(const char* filename, ePNGLevel level, bool flip_y) const
+{
+	// Color is three packed bytes, so the pixels are already RGB rows
+	std::vector<unsigned char> png;
+	if (!EncodePNG(png, (const unsigned char*)pixels, width, height, 3, level, flip_y))
 	{
-		fclose(file);
-		delete tgainfo;
-		return NULL;
+		std::cerr << "PNG encoding failed: " << filename << std::endl;
+		return false;
 	}
-    
-	tgainfo->bpp = header[4];
-	bytesPerPixel = tgainfo->bpp / 8;
-	imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
-    
-	tgainfo->data = new unsigned char[imageSize];
-    
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+
+	std::string fullPath = absResPath(filename);
+	FILE *file = fopen(fullPath.c_str(), "wb");
+	if ( file == NULL )
 	{
-		if (tgainfo->data != NULL)
-			delete tgainfo->data;
-            
-		fclose(file);
-		delete tgainfo;
+		perror("Failed to open file: ");
 		return false;
 	}
 
+	bool ok = fwrite(&png[0], 1, png.size(), file) == png.size();
 	fclose(file);
+	return ok;
+}
 
-	// Save info in image
-	if(pixels)
-		delete pixels;
+std::future<bool> Image::SavePNGAsync(const char* filename, ePNGLevel level, bool flip_y) const
+{
+	// The thread owns a copy of the image and is detached, so waiting is up to the caller
+	// (a future from std::async would block in its destructor)
+	std::shared_ptr<Image> copy(new Image(*this));
+	std::shared_ptr< std::promise<bool> > promise(new std::promise<bool>());
+	std::string name = filename;
+	std::thread([copy, promise, name, level, flip_y]() {
+		promise->set_value(copy->SavePNG(name.c_str(), level, flip_y));
+	}).detach();
+	return promise->get_future();
+}
 
-	width = tgainfo->width;
-	height = tgainfo->height;
-	pixels = new Color[width*height];
+bool Image::LoadQOI(const char* filename, bool flip_y)
+{
+	std::string sfullPath = absResPath(filename);
+	std::vector<unsigned char> buffer;
+	if (!readFile(sfullPath, buffer))
+		return false;
 
-	// Convert to float all pixels
-	for (unsigned int y = 0; y < height; ++y) {
-		for (unsigned int x = 0; x < width; ++x) {
-			unsigned int pos = y * width * bytesPerPixel + x * bytesPerPixel;
-			// Make sure we don't access out of memory
-			if( (pos < imageSize) && (pos + 1 < imageSize) && (pos + 2 < imageSize))
-				SetPixelUnsafe(x, height - y - 1, Color(tgainfo->data[pos + 2], tgainfo->data[pos + 1], tgainfo->data[pos]));
-		}
+	// Decoded straight into the pixels (Color is three packed bytes)
+	unsigned int new_width, new_height, channels;
+	if (!ReadQOIHeader(buffer.empty() ? NULL : &buffer[0], buffer.size(), new_width, new_height, channels))
+	{
+		std::cerr << "Not a QOI file: " << sfullPath.c_str() << std::endl;
+		return false;
+	}
+	Color* new_pixels = new Color[new_width * new_height];
+	if (!DecodeQOI(&buffer[0], buffer.size(), (unsigned char*)new_pixels, 3, flip_y))
+	{
+		std::cerr << "Damaged QOI file: " << sfullPath.c_str() << std::endl;
+		delete[] new_pixels;
+		return false;
 	}
 
-	// Flip pixels in Y
-	if (flip_y)
-		FlipY();
-
-	delete tgainfo->data;
-	delete tgainfo;
+	// Force 3 channels
+	bytes_per_pixel = 3;
 
+	delete[] pixels;
+	pixels = new_pixels;
+	width = new_width;
+	height = new_height;
 	return true;
 }
 
-// Saves the image to a TGA file
-bool Image::SaveTGA(const char* filename)
+bool Image::SaveQOI(const char* filename, bool striped, bool flip_y) const
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	unsigned int stripes = striped ? std::max(1u, (unsigned int)((size_t)width * height / QOI_PIXELS_PER_STRIPE)) : 1;
+	std::vector<unsigned char> qoi;
+	if (!EncodeQOI(qoi, (const unsigned char*)pixels, width, height, 3, stripes, flip_y))
+	{
+		std::cerr << "QOI encoding failed: " << filename << std::endl;
+		return false;
+	}
 
 	std::string fullPath = absResPath(filename);
 	FILE *file = fopen(fullPath.c_str(), "wb");
@@ -281,32 +335,9 @@ bool Image::SaveTGA(const char* filename)
 		return false;
 	}
 
-	unsigned short header_short[3];
-	header_short[0] = width;
-	header_short[1] = height;
-	unsigned char* header = (unsigned char*)header_short;
-	header[4] = 24;
-	header[5] = 0;
-
-	fwrite(TGAheader, 1, sizeof(TGAheader), file);
-	fwrite(header, 1, 6, file);
-
-	// Convert pixels to unsigned char
-	unsigned char* bytes = new unsigned char[width*height*3];
-	for(unsigned int y = 0; y < height; ++y)
-		for(unsigned int x = 0; x < width; ++x)
-		{
-			Color c = pixels[y*width+x];
-			unsigned int pos = (y*width+x)*3;
-			bytes[pos+2] = c.r;
-			bytes[pos+1] = c.g;
-			bytes[pos] = c.b;
-		}
-
-	fwrite(bytes, 1, width*height*3, file);
+	bool ok = fwrite(&qoi[0], 1, qoi.size(), file) == qoi.size();
 	fclose(file);
-
-	return true;
+	return ok;
 }
 
 void Image::DrawRect(int x, int y, int w, int h, const Color& c)
@@ -323,6 +354,56 @@ void Image::DrawRect(int x, int y, int w, int h, const Color& c)
 	}
 }
 
+// Interpolates the 4 texels around (x,y), with x,y in pixel units relative to the texel centers
+template <typename T>
+static Color BilinearFilter(const T& image, float x, float y)
+{
+	x = clamp(x, 0.0f, (float)(image.width - 1));
+	y = clamp(y, 0.0f, (float)(image.height - 1));
+	unsigned int x0 = (unsigned int)x;
+	unsigned int y0 = (unsigned int)y;
+	unsigned int x1 = x0 + 1 < image.width ? x0 + 1 : x0;
+	unsigned int y1 = y0 + 1 < image.height ? y0 + 1 : y0;
+	float fx = x - x0;
+	float fy = y - y0;
+
+	Color c00 = image.GetPixel(x0, y0), c10 = image.GetPixel(x1, y0);
+	Color c01 = image.GetPixel(x0, y1), c11 = image.GetPixel(x1, y1);
+
+	float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+	return Color(
+		c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11 + 0.5f,
+		c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11 + 0.5f,
+		c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11 + 0.5f);
+}
+
+Color Image::SampleBilinear(float u, float v) const
+{
+	return BilinearFilter(*this, u * width - 0.5f, v * height - 0.5f);
+}
+
+void Image::Blend(const Image& layer, eBlendMode mode, const unsigned char* mask, float opacity)
+{
+	unsigned int w = std::min(width, layer.width);
+	unsigned int h = std::min(height, layer.height);
+	unsigned char alpha = (unsigned char)clamp(opacity * 255.0f + 0.5f, 0.0f, 255.0f);
+	if (!w || !h || alpha == 0)
+		return;
+
+	// Rows are independent, big images are split between threads
+	auto blend_rows = [&](unsigned int start, unsigned int end) {
+		for (unsigned int y = start; y < end; ++y)
+			BlendRow(pixels + y * width, layer.pixels + y * layer.width, mask ? mask + y * layer.width : NULL, w, mode, alpha);
+	};
+	const unsigned int rows_per_job = 64;
+	if (w * h < 512 * 512)
+		blend_rows(0, h);
+	else
+		parallelFor(0, (int)((h + rows_per_job - 1) / rows_per_job), [&](int job) {
+			blend_rows(job * rows_per_job, std::min(h, (job + 1) * rows_per_job));
+		});
+}
+
 #ifndef IGNORE_LAMBDAS
 
 // You can apply and algorithm for two images and store the result in the first one
@@ -393,4 +474,180 @@ void FloatImage::Resize(unsigned int width, unsigned int height)
 	this->width = width;
 	this->height = height;
 	pixels = new_pixels;
-}
\ No newline at end of file
+}
+
+UIntImage::UIntImage(unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	pixels = new unsigned int[width * height];
+	memset(pixels, 0, width * height * sizeof(unsigned int));
+}
+
+// Copy constructor
+UIntImage::UIntImage(const UIntImage& c) {
+	pixels = NULL;
+
+	width = c.width;
+	height = c.height;
+	if (c.pixels)
+	{
+		pixels = new unsigned int[width * height];
+		memcpy(pixels, c.pixels, width * height * sizeof(unsigned int));
+	}
+}
+
+// Assign operator
+UIntImage& UIntImage::operator = (const UIntImage& c)
+{
+	if (this == &c)
+		return *this;
+	if (pixels) delete[] pixels;
+	pixels = NULL;
+
+	width = c.width;
+	height = c.height;
+	if (c.pixels)
+	{
+		pixels = new unsigned int[width * height];
+		memcpy(pixels, c.pixels, width * height * sizeof(unsigned int));
+	}
+	return *this;
+}
+
+UIntImage::~UIntImage()
+{
+	if (pixels)
+		delete[] pixels;
+}
+
+// Change image size (the old one will remain in the top-left corner)
+void UIntImage::Resize(unsigned int width, unsigned int height)
+{
+	unsigned int* new_pixels = new unsigned int[width * height];
+	memset(new_pixels, 0, width * height * sizeof(unsigned int));
+	unsigned int min_width = this->width > width ? width : this->width;
+	unsigned int min_height = this->height > height ? height : this->height;
+
+	for (unsigned int y = 0; y < min_height; ++y)
+		memcpy(new_pixels + y * width, pixels + y * this->width, min_width * sizeof(unsigned int));
+
+	if (pixels)
+		delete[] pixels;
+	this->width = width;
+	this->height = height;
+	pixels = new_pixels;
+}
+
+// Out of class definitions of the constants, std::min and std::max take them by reference
+const unsigned int TiledImage::BLOCK_BITS;
+const unsigned int TiledImage::BLOCK_SIZE;
+const unsigned int TiledImage::BLOCK_PIXELS;
+const unsigned char TiledImage::morton_table[TiledImage::BLOCK_SIZE] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+TiledImage::TiledImage(const Image& image)
+{
+	width = height = blocks_x = blocks_y = 0;
+	pixels = NULL;
+	FromImage(image);
+}
+
+// Copy constructor
+TiledImage::TiledImage(const TiledImage& c)
+{
+	pixels = NULL;
+	width = height = blocks_x = blocks_y = 0;
+	*this = c;
+}
+
+// Assign operator
+TiledImage& TiledImage::operator = (const TiledImage& c)
+{
+	if (this == &c)
+		return *this;
+
+	Allocate(c.width, c.height);
+	if (c.pixels)
+		memcpy(pixels, c.pixels, blocks_x * blocks_y * BLOCK_PIXELS * sizeof(Color));
+	return *this;
+}
+
+TiledImage::~TiledImage()
+{
+	if (pixels)
+		delete[] pixels;
+}
+
+void TiledImage::Allocate(unsigned int width, unsigned int height)
+{
+	if (pixels)
+		delete[] pixels;
+	pixels = NULL;
+
+	this->width = width;
+	this->height = height;
+	blocks_x = (width + BLOCK_SIZE - 1) >> BLOCK_BITS;
+	blocks_y = (height + BLOCK_SIZE - 1) >> BLOCK_BITS;
+	if (blocks_x > 0 && blocks_y > 0)
+		pixels = new Color[blocks_x * blocks_y * BLOCK_PIXELS];
+}
+
+void TiledImage::FromImage(const Image& image)
+{
+	Allocate(image.width, image.height);
+	if (!pixels || !image.pixels)
+		return;
+
+	// Every block is filled one row of 8 pixels at a time, the partial blocks
+	// on the right and bottom borders repeat the last column/row (clamp to edge)
+	for (unsigned int by = 0; by < blocks_y; ++by)
+		for (unsigned int bx = 0; bx < blocks_x; ++bx)
+		{
+			Color* block = pixels + (by * blocks_x + bx) * BLOCK_PIXELS;
+			for (unsigned int j = 0; j < BLOCK_SIZE; ++j)
+			{
+				unsigned int y = std::min(by * BLOCK_SIZE + j, height - 1);
+				const Color* row = image.pixels + y * width;
+				unsigned int row_code = morton_table[j] << 1;
+				unsigned int x = bx * BLOCK_SIZE;
+				if (x + BLOCK_SIZE <= width)
+				{
+					for (unsigned int i = 0; i < BLOCK_SIZE; ++i)
+						block[row_code | morton_table[i]] = row[x + i];
+				}
+				else
+				{
+					for (unsigned int i = 0; i < BLOCK_SIZE; ++i)
+						block[row_code | morton_table[i]] = row[std::min(x + i, width - 1)];
+				}
+			}
+		}
+}
+
+void TiledImage::ToImage(Image& image) const
+{
+	if (image.width != width || image.height != height || !image.pixels)
+		image = Image(width, height);
+	if (!pixels)
+		return;
+
+	for (unsigned int by = 0; by < blocks_y; ++by)
+		for (unsigned int bx = 0; bx < blocks_x; ++bx)
+		{
+			const Color* block = pixels + (by * blocks_x + bx) * BLOCK_PIXELS;
+			unsigned int x = bx * BLOCK_SIZE;
+			unsigned int count = std::min(BLOCK_SIZE, width - x);
+			for (unsigned int j = 0; j < BLOCK_SIZE && by * BLOCK_SIZE + j < height; ++j)
+			{
+				Color* row = image.pixels + (by * BLOCK_SIZE + j) * width + x;
+				unsigned int row_code = morton_table[j] << 1;
+				for (unsigned int i = 0; i < count; ++i)
+					row[i] = block[row_code | morton_table[i]];
+			}
+		}
+}
+
+Color TiledImage::SampleBilinear(float u, float v) const
+{
+	return BilinearFilter(*this, u * width - 0.5f, v * height - 0.5f);
+}
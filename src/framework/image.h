@@ -8,7 +8,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <iostream>
+#include <future>
 #include "framework.h"
+#include "blend.h"
+#include "pngencoder.h"
 
 //remove unsafe warnings
 #ifndef _CRT_SECURE_NO_WARNINGS
@@ -23,14 +26,6 @@ class Camera;
 // A matrix of pixels
 class Image
 {
-	// A general struct to store all the information about a TGA file
-	typedef struct sTGAInfo {
-		unsigned int width;
-		unsigned int height;
-		unsigned int bpp; // Bits per pixel
-		unsigned char* data; // Bytes with the pixel information
-	} TGAInfo;
-
 public:
 	unsigned int width;
 	unsigned int height;
@@ -76,10 +71,24 @@ public:
 	// Save or load images from the hard drive
 	bool LoadPNG(const char* filename, bool flip_y = true);
 	bool LoadTGA(const char* filename, bool flip_y = false);
-	bool SaveTGA(const char* filename);
+	bool SaveTGA(const char* filename, bool rle = false);	// Run length encoded with 'rle'
+	bool SavePNG(const char* filename, ePNGLevel level = PNG_LEVEL_DEFAULT, bool flip_y = true) const;
+	// Saves a copy of the image from another thread, so the caller can keep drawing. The future is ready when the file is written
+	std::future<bool> SavePNGAsync(const char* filename, ePNGLevel level = PNG_LEVEL_DEFAULT, bool flip_y = true) const;
+	// QOI is lossless and much faster than PNG, for debug dumps and caches. 'striped' splits big images in parts that are
+	// written and read in parallel, but only LoadQOI reads those files
+	bool LoadQOI(const char* filename, bool flip_y = true);
+	bool SaveQOI(const char* filename, bool striped = false, bool flip_y = true) const;
 
 	void DrawRect(int x, int y, int w, int h, const Color& c);
 
+	// Bilinear sampling using normalized coordinates [0..1] (clamp to edge)
+	Color SampleBilinear(float u, float v) const;
+
+	// Composites 'layer' on top of this image using a saturating blend mode (only the overlapping area).
+	// The optional mask has one weight byte per pixel of the layer, opacity [0..1] multiplies it
+	void Blend(const Image& layer, eBlendMode mode, const unsigned char* mask = NULL, float opacity = 1.0f);
+
 	// Used to easy code
 	#ifndef IGNORE_LAMBDAS
 
@@ -125,4 +134,85 @@ public:
 	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const float& v) { pixels[y * width + x] = v; }
 
 	void Resize(unsigned int width, unsigned int height);
-};
\ No newline at end of file
+};
+
+// Image storing one 32 bit id per pixel (used as visibility buffer)
+
+class UIntImage
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	unsigned int* pixels;
+
+	// CONSTRUCTORS 
+	UIntImage() { width = height = 0; pixels = NULL; }
+	UIntImage(unsigned int width, unsigned int height);
+	UIntImage(const UIntImage& c);
+	UIntImage& operator = (const UIntImage& c); //assign operator
+
+	//destructor
+	~UIntImage();
+
+	void Fill(unsigned int v) { for (unsigned int pos = 0; pos < width * height; ++pos) pixels[pos] = v; }
+
+	//get the pixel at position x,y
+	unsigned int GetPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
+	unsigned int& GetPixelRef(unsigned int x, unsigned int y) { return pixels[y * width + x]; }
+
+	//set the pixel at position x,y with value v
+	void SetPixel(unsigned int x, unsigned int y, unsigned int v) { if (x >= width || y >= height) return; pixels[y * width + x] = v; }
+	inline void SetPixelUnsafe(unsigned int x, unsigned int y, unsigned int v) { pixels[y * width + x] = v; }
+
+	void Resize(unsigned int width, unsigned int height);
+};
+
+// Read-mostly copy of an Image stored in 8x8 blocks, with the pixels of every block in Z-order (Morton).
+// Neighbours in X and Y end up close in memory, so sampling along any direction stays cache friendly.
+class TiledImage
+{
+public:
+	static const unsigned int BLOCK_BITS = 3;
+	static const unsigned int BLOCK_SIZE = 1 << BLOCK_BITS; // 8x8 pixels per block
+	static const unsigned int BLOCK_PIXELS = BLOCK_SIZE * BLOCK_SIZE;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int blocks_x; // Blocks per row (width rounded up to BLOCK_SIZE)
+	unsigned int blocks_y;
+	Color* pixels;
+
+	// CONSTRUCTORS 
+	TiledImage() { width = height = blocks_x = blocks_y = 0; pixels = NULL; }
+	TiledImage(const Image& image);
+	TiledImage(const TiledImage& c);
+	TiledImage& operator = (const TiledImage& c); //assign operator
+
+	//destructor
+	~TiledImage();
+
+	// Conversion from and to the row-major layout
+	void FromImage(const Image& image);
+	void ToImage(Image& image) const;
+
+	// Position of the pixel x,y inside pixels
+	unsigned int GetOffset(unsigned int x, unsigned int y) const {
+		return ((y >> BLOCK_BITS) * blocks_x + (x >> BLOCK_BITS)) * BLOCK_PIXELS + (morton_table[y & (BLOCK_SIZE - 1)] << 1 | morton_table[x & (BLOCK_SIZE - 1)]);
+	}
+
+	//get the pixel at position x,y
+	Color GetPixel(unsigned int x, unsigned int y) const { return pixels[GetOffset(x, y)]; }
+	Color GetPixelSafe(unsigned int x, unsigned int y) const {
+		x = clamp((unsigned int)x, 0, width - 1);
+		y = clamp((unsigned int)y, 0, height - 1);
+		return pixels[GetOffset(x, y)];
+	}
+
+	// Bilinear sampling using normalized coordinates [0..1] (clamp to edge)
+	Color SampleBilinear(float u, float v) const;
+
+private:
+	// Spreads the 3 low bits of a coordinate to the even bits of the Morton code
+	static const unsigned char morton_table[BLOCK_SIZE];
+	void Allocate(unsigned int width, unsigned int height);
+};
@@ -0,0 +1,152 @@
+#include "imageloader.h"
+
+#include <algorithm>
+#include <cctype>
+
+ImageLoader::ImageLoader(unsigned int num_threads)
+{
+	pending = 0;
+	stop = false;
+
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&ImageLoader::WorkerLoop, this));
+}
+
+ImageLoader::~ImageLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	request_ready.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	for (size_t i = 0; i < decoded.size(); ++i)
+		delete decoded[i].image;
+}
+
+bool ImageLoader::LoadFile(const std::string& filename, Image& image)
+{
+	std::string extension = filename.substr(std::min(filename.size(), filename.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	if (extension == ".png")
+		return image.LoadPNG(filename.c_str());
+	if (extension == ".tga")
+		return image.LoadTGA(filename.c_str());
+	if (extension == ".qoi")
+		return image.LoadQOI(filename.c_str());
+
+	std::cerr << "ImageLoader: unknown image format: " << filename << std::endl;
+	return false;
+}
+
+std::future<bool> ImageLoader::Load(const std::string& filename, Image& image)
+{
+	sRequest request;
+	request.filename = filename;
+	request.image = &image;
+	std::future<bool> future = request.promise.get_future();
+	Queue(request);
+	return future;
+}
+
+void ImageLoader::Load(const std::string& filename, const Callback& callback)
+{
+	sRequest request;
+	request.filename = filename;
+	request.image = NULL;
+	request.callback = callback;
+	Queue(request);
+}
+
+std::vector< std::future<bool> > ImageLoader::LoadBatch(const std::vector<std::string>& filenames, std::vector<Image>& images)
+{
+	images.resize(filenames.size());
+	std::vector< std::future<bool> > futures;
+	for (size_t i = 0; i < filenames.size(); ++i)
+		futures.push_back(Load(filenames[i], images[i]));
+	return futures;
+}
+
+void ImageLoader::LoadBatch(const std::vector<std::string>& filenames, const Callback& callback)
+{
+	for (size_t i = 0; i < filenames.size(); ++i)
+		Load(filenames[i], callback);
+}
+
+void ImageLoader::Queue(sRequest& request)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		requests.push_back(std::move(request));
+		++pending;
+	}
+	request_ready.notify_one();
+}
+
+void ImageLoader::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		request_ready.wait(lock, [this]() { return stop || !requests.empty(); });
+		if (requests.empty())
+			return; // Stopping and nothing left to do
+
+		sRequest request = std::move(requests.front());
+		requests.pop_front();
+		lock.unlock();
+
+		// The decoding itself runs without the lock
+		Image* image = request.image ? request.image : new Image();
+		bool ok = LoadFile(request.filename, *image);
+		if (request.image)
+			request.promise.set_value(ok);
+
+		lock.lock();
+		if (!request.image)
+		{
+			sDecoded result = { request.filename, image, ok, request.callback };
+			decoded.push_back(result);
+		}
+		if (--pending == 0)
+			all_done.notify_all();
+	}
+}
+
+unsigned int ImageLoader::Poll()
+{
+	std::vector<sDecoded> ready;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.swap(decoded);
+	}
+
+	// Callbacks run without the lock, they may queue more files
+	for (size_t i = 0; i < ready.size(); ++i)
+	{
+		ready[i].callback(ready[i].filename, *ready[i].image, ready[i].ok);
+		delete ready[i].image;
+	}
+	return (unsigned int)ready.size();
+}
+
+void ImageLoader::Wait()
+{
+	// Callbacks can queue more files, so wait again until nothing is left
+	do
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		all_done.wait(lock, [this]() { return pending == 0; });
+	} while (Poll() > 0);
+}
+
+unsigned int ImageLoader::GetPending()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending;
+}
@@ -0,0 +1,75 @@
+/*
+	Loads many images at the same time: the files are decoded by a pool of worker threads while the main
+	thread keeps going. Workers only decode, the results come back as futures or through callbacks that are
+	run by Poll on the main thread, so they can create textures (OpenGL only works on the main thread).
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "image.h"
+
+class ImageLoader
+{
+public:
+	// Runs on the main thread (inside Poll or Wait), 'ok' is false if the file could not be loaded.
+	// The image is destroyed after the call, copy it (or create the texture) to keep it.
+	typedef std::function<void(const std::string& filename, Image& image, bool ok)> Callback;
+
+	ImageLoader(unsigned int num_threads = 0);	// 0 uses all the hardware threads
+	~ImageLoader();								// Finishes the queued files, callbacks not polled yet are not called
+
+	// Decodes a file (relative to res, PNG, TGA or QOI by extension) into 'image', that must exist until the future is ready
+	std::future<bool> Load(const std::string& filename, Image& image);
+	// Decodes a file and gives the image to the callback in the next Poll after it is ready
+	void Load(const std::string& filename, const Callback& callback);
+
+	// All the files are queued at once. 'images' is resized to one image per file (and must not change until they are ready)
+	std::vector< std::future<bool> > LoadBatch(const std::vector<std::string>& filenames, std::vector<Image>& images);
+	void LoadBatch(const std::vector<std::string>& filenames, const Callback& callback);
+
+	unsigned int Poll();	// Runs the callbacks of the images decoded since the last call, returns how many
+	void Wait();			// Blocks until all the files are decoded and runs their callbacks
+	unsigned int GetPending();	// Files queued or being decoded
+
+	unsigned int GetNumThreads() const { return (unsigned int)threads.size(); }
+
+	// Same rows order as the defaults of the Image loaders
+	static bool LoadFile(const std::string& filename, Image& image);
+
+protected:
+	struct sRequest
+	{
+		std::string filename;
+		Image* image;					// Decoded here with a future, NULL with a callback
+		std::promise<bool> promise;
+		Callback callback;
+	};
+
+	struct sDecoded
+	{
+		std::string filename;
+		Image* image;
+		bool ok;
+		Callback callback;
+	};
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable request_ready;	// Workers wait for requests
+	std::condition_variable all_done;		// Wait waits for the last request
+	std::deque<sRequest> requests;
+	std::vector<sDecoded> decoded;			// Waiting for Poll
+	unsigned int pending;
+	bool stop;
+
+	void Queue(sRequest& request);
+	void WorkerLoop();
+};
@@ -1,13 +1,16 @@
 #include "mesh.h"
 #include "utils.h"
 #include "camera.h"
+#include "shader.h"
 
 #include <string>
 #include <sys/stat.h>
 #include <cstring>
+#include <algorithm>
 
 Mesh::Mesh()
 {
+	bounding_radius = 0.0f;
 }
 
 void Mesh::Clear()
@@ -15,13 +18,50 @@ void Mesh::Clear()
 	vertices.clear();
 	normals.clear();
 	uvs.clear();
+	UpdateBoundingVolumes();
 }
 
-void Mesh::Render(int primitive)
+void Mesh::UpdateBoundingVolumes()
 {
-	// Render the mesh using your rasterizer
-	assert(vertices.size() && "No vertices in this mesh");
+	if (vertices.empty())
+	{
+		aabb_min = aabb_max = bounding_center = Vector3(0.0f);
+		bounding_radius = 0.0f;
+		return;
+	}
+
+	aabb_min = aabb_max = vertices[0];
+	for (size_t i = 1; i < vertices.size(); ++i)
+	{
+		const Vector3& v = vertices[i];
+		aabb_min.Set(std::min(aabb_min.x, v.x), std::min(aabb_min.y, v.y), std::min(aabb_min.z, v.z));
+		aabb_max.Set(std::max(aabb_max.x, v.x), std::max(aabb_max.y, v.y), std::max(aabb_max.z, v.z));
+	}
 
+	// Sphere centered in the box, the radius is the farthest vertex (tighter than the box diagonal)
+	bounding_center = (aabb_min + aabb_max) * 0.5f;
+	float max_distance2 = 0.0f;
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		Vector3 d = vertices[i] - bounding_center;
+		max_distance2 = std::max(max_distance2, d.Dot(d));
+	}
+	bounding_radius = sqrtf(max_distance2);
+}
+
+Vector4 Mesh::GetBoundingSphere(const Matrix44& model) const
+{
+	Vector3 center = model * bounding_center;
+
+	// Scale the radius by the largest axis scale of the model
+	float sx = Vector3(model.m[0], model.m[1], model.m[2]).Length();
+	float sy = Vector3(model.m[4], model.m[5], model.m[6]).Length();
+	float sz = Vector3(model.m[8], model.m[9], model.m[10]).Length();
+	return Vector4(center.x, center.y, center.z, bounding_radius * std::max(sx, std::max(sy, sz)));
+}
+
+void Mesh::EnableArrays()
+{
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glVertexPointer(3, GL_FLOAT, 0, &vertices[0]);
 
@@ -36,8 +76,10 @@ void Mesh::Render(int primitive)
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		glTexCoordPointer(2, GL_FLOAT, 0, &uvs[0]);
 	}
+}
 
-	glDrawArrays(primitive, 0, static_cast<GLsizei>(vertices.size()));
+void Mesh::DisableArrays()
+{
 	glDisableClientState(GL_VERTEX_ARRAY);
 
 	if (normals.size())
@@ -46,6 +88,77 @@ void Mesh::Render(int primitive)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 }
 
+void Mesh::Render(int primitive)
+{
+	// Render the mesh using your rasterizer
+	assert(vertices.size() && "No vertices in this mesh");
+
+	EnableArrays();
+	glDrawArrays(primitive, 0, static_cast<GLsizei>(vertices.size()));
+	DisableArrays();
+}
+
+void Mesh::RenderInstanced(Shader* shader, const Matrix44* models, unsigned int count, const Color* colors, int primitive)
+{
+	assert(vertices.size() && "No vertices in this mesh");
+	if (count == 0)
+		return;
+
+	int model_location = shader ? shader->GetAttribLocation("a_model") : -1;
+	int color_location = shader ? shader->GetAttribLocation("a_color") : -1;
+	bool instancing = model_location != -1 && glDrawArraysInstanced && glVertexAttribDivisor;
+
+	EnableArrays();
+
+	if (instancing)
+	{
+		// A mat4 attribute takes 4 consecutive locations, one per column, advanced once per instance
+		for (int i = 0; i < 4; ++i)
+		{
+			glEnableVertexAttribArray(model_location + i);
+			glVertexAttribPointer(model_location + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix44), models[0].m + i * 4);
+			glVertexAttribDivisor(model_location + i, 1);
+		}
+
+		if (color_location != -1 && !colors)
+			glVertexAttrib3f(color_location, 1.0f, 1.0f, 1.0f);
+		else if (color_location != -1)
+		{
+			glEnableVertexAttribArray(color_location);
+			glVertexAttribPointer(color_location, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Color), colors[0].v);
+			glVertexAttribDivisor(color_location, 1);
+		}
+
+		glDrawArraysInstanced(primitive, 0, static_cast<GLsizei>(vertices.size()), static_cast<GLsizei>(count));
+
+		for (int i = 0; i < 4; ++i)
+		{
+			glVertexAttribDivisor(model_location + i, 0);
+			glDisableVertexAttribArray(model_location + i);
+		}
+		if (color_location != -1 && colors)
+		{
+			glVertexAttribDivisor(color_location, 0);
+			glDisableVertexAttribArray(color_location);
+		}
+	}
+	else
+	{
+		glMatrixMode(GL_MODELVIEW);
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			glPushMatrix();
+			glMultMatrixf(models[i].m);
+			if (colors)
+				glColor3ubv(colors[i].v);
+			glDrawArrays(primitive, 0, static_cast<GLsizei>(vertices.size()));
+			glPopMatrix();
+		}
+	}
+
+	DisableArrays();
+}
+
 void Mesh::CreateQuad()
 {
 	vertices.clear();
@@ -67,6 +180,8 @@ void Mesh::CreateQuad()
 	uvs.push_back(Vector2(0, 1));
 	uvs.push_back(Vector2(1, 1));
 	uvs.push_back(Vector2(0, 0));
+
+	UpdateBoundingVolumes();
 }
 
 void Mesh::CreatePlane(float size)
@@ -99,6 +214,8 @@ void Mesh::CreatePlane(float size)
 	uvs.push_back(Vector2(0, 1));
 	uvs.push_back(Vector2(1, 1));
 	uvs.push_back(Vector2(0, 0));
+
+	UpdateBoundingVolumes();
 }
 
 void Mesh::CreateCube(float size)
@@ -236,6 +353,8 @@ void Mesh::CreateCube(float size)
 	uvs.push_back(Vector2(0, 1));
 	uvs.push_back(Vector2(1, 1));
 	uvs.push_back(Vector2(0, 0));
+
+	UpdateBoundingVolumes();
 }
 
 bool Mesh::LoadOBJ(const char* filename)
@@ -344,5 +463,7 @@ bool Mesh::LoadOBJ(const char* filename)
 
 	delete[] data;
 
+	UpdateBoundingVolumes();
+
 	return true;
 }
@@ -9,24 +9,46 @@
 #include "camera.h"
 #include "main/includes.h"
 
+class Shader;
+
 class Mesh
 {
 	std::vector<Vector3> vertices;
 	std::vector<Vector3> normals;
 	std::vector<Vector2> uvs;
 
+	// Client arrays shared by all the render methods
+	void EnableArrays();
+	void DisableArrays();
+
 public:
 
+	// Bounding volumes in local space, updated every time the mesh is created or loaded
+	Vector3 aabb_min;
+	Vector3 aabb_max;
+	Vector3 bounding_center;
+	float bounding_radius;
+
 	Mesh();
 	void Clear();
 	void Render(int primitive = GL_TRIANGLES);
 
+	// Renders 'count' copies of the mesh in a single draw call. The shader must be enabled and declare
+	// 'attribute mat4 a_model' (and optionally 'attribute vec3 a_color'), see res/shaders/instanced.vs.
+	// Without shader (or instancing support) every copy is drawn with the fixed pipeline, binding the arrays once.
+	void RenderInstanced(Shader* shader, const Matrix44* models, unsigned int count, const Color* colors = NULL, int primitive = GL_TRIANGLES);
+
 	void CreatePlane(float size);
 	void CreateCube(float size);
 	void CreateQuad();
 
 	bool LoadOBJ(const char* filename);
 
+	void UpdateBoundingVolumes();
+
+	// Bounding sphere (center, radius) in world space for a given model matrix
+	Vector4 GetBoundingSphere(const Matrix44& model) const;
+
 	const std::vector<Vector3>& GetVertices() { return vertices; }
 	const std::vector<Vector3>& GetNormals() { return normals; }
 	const std::vector<Vector2>& GetUVs() { return uvs; }
@@ -0,0 +1,367 @@
+#include "mipmap.h"
+#include "framework.h"
+#include "hdrimage.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Kaiser window: radius in texels of the smaller level and shape (bigger alpha, less ringing and more blur)
+#define KAISER_RADIUS 3.0f
+#define KAISER_ALPHA 4.0f
+
+// Rows filtered by every job when a level is split between threads
+#define MIP_ROWS_PER_JOB 32
+
+// For every texel of the smaller level, the texels of the bigger one that contribute to it and their weights.
+// All of them use the same number of taps, the ones outside the image are clamped to the edge.
+struct sFilterTaps
+{
+	unsigned int num_taps;
+	std::vector<int> index;
+	std::vector<float> weight;
+};
+
+// Modified Bessel function of the first kind (order 0), the series converges fast for the values used here
+static float BesselI0(float x)
+{
+	float sum = 1.0f, term = 1.0f;
+	float quarter_x2 = x * x * 0.25f;
+	for (int k = 1; k < 32 && term > sum * 1e-8f; ++k)
+	{
+		term *= quarter_x2 / (float)(k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+// t is the distance in texels of the smaller level
+static float KaiserSinc(float t)
+{
+	if (fabsf(t) >= KAISER_RADIUS)
+		return 0.0f;
+	float x = t / KAISER_RADIUS;
+	float sinc = t == 0.0f ? 1.0f : sinf(PI * t) / (PI * t);
+	return sinc * BesselI0(KAISER_ALPHA * sqrtf(1.0f - x * x)) / BesselI0(KAISER_ALPHA);
+}
+
+static void ComputeTaps(unsigned int src_size, unsigned int dst_size, MipChain::eMipFilter filter, sFilterTaps& taps)
+{
+	if (src_size == dst_size) // Dimension already at 1
+	{
+		taps.num_taps = 1;
+		taps.index.assign(1, 0);
+		taps.weight.assign(1, 1.0f);
+		return;
+	}
+
+	// With odd sizes a texel covers a bit more than 2 of the bigger level, so there are 3 taps with different
+	// weights instead of just ignoring the last row or column
+	float scale = src_size / (float)dst_size;
+	float radius = filter == MipChain::MIPFILTER_BOX ? scale * 0.5f : KAISER_RADIUS * scale;
+	taps.num_taps = 1;
+	for (unsigned int i = 0; i < dst_size; ++i)
+	{
+		float center = (i + 0.5f) * scale;
+		taps.num_taps = std::max(taps.num_taps, (unsigned int)((int)ceilf(center + radius) - (int)floorf(center - radius)));
+	}
+	taps.index.resize(dst_size * taps.num_taps);
+	taps.weight.resize(dst_size * taps.num_taps);
+
+	for (unsigned int i = 0; i < dst_size; ++i)
+	{
+		float center = (i + 0.5f) * scale;
+		int first = (int)floorf(center - radius);
+		int* index = &taps.index[i * taps.num_taps];
+		float* weight = &taps.weight[i * taps.num_taps];
+
+		float sum = 0.0f;
+		for (unsigned int k = 0; k < taps.num_taps; ++k)
+		{
+			int j = first + (int)k;
+			if (filter == MipChain::MIPFILTER_BOX) // Part of the texel [j, j+1] inside the covered interval
+				weight[k] = std::max(0.0f, std::min(j + 1.0f, center + radius) - std::max((float)j, center - radius));
+			else
+				weight[k] = KaiserSinc((j + 0.5f - center) / scale);
+			index[k] = std::min(std::max(j, 0), (int)src_size - 1);
+			sum += weight[k];
+		}
+		for (unsigned int k = 0; k < taps.num_taps; ++k)
+			weight[k] /= sum;
+	}
+}
+
+// Calls job(first_row, end_row), splitting the rows between threads for big levels
+template <typename F>
+static void ForEachRowRange(unsigned int width, unsigned int height, F job)
+{
+	if (width * height < 128 * 128)
+	{
+		job(0u, height);
+		return;
+	}
+	parallelFor(0, (int)((height + MIP_ROWS_PER_JOB - 1) / MIP_ROWS_PER_JOB), [&](int i) {
+		unsigned int start = i * MIP_ROWS_PER_JOB;
+		job(start, std::min(height, start + MIP_ROWS_PER_JOB));
+	});
+}
+
+// Texels are always 4 floats while filtering (unused channels are 0), one SIMD register each.
+// Every row of src (src_width texels) becomes a row of dst with one texel per group of taps.
+static void FilterRowsH(const float* src, unsigned int src_width, float* dst, unsigned int dst_width, const sFilterTaps& taps, unsigned int start, unsigned int end)
+{
+	unsigned int num_taps = taps.num_taps;
+	for (unsigned int y = start; y < end; ++y)
+	{
+		const float* src_row = src + y * src_width * 4;
+		float* dst_texel = dst + y * dst_width * 4;
+		const int* index = &taps.index[0];
+		const float* weight = &taps.weight[0];
+
+		for (unsigned int x = 0; x < dst_width; ++x, dst_texel += 4, index += num_taps, weight += num_taps)
+		{
+#if defined(USE_SSE2)
+			__m128 acc = _mm_setzero_ps();
+			for (unsigned int k = 0; k < num_taps; ++k)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weight[k]), _mm_loadu_ps(src_row + index[k] * 4)));
+			_mm_storeu_ps(dst_texel, acc);
+#elif defined(USE_NEON)
+			float32x4_t acc = vdupq_n_f32(0.0f);
+			for (unsigned int k = 0; k < num_taps; ++k)
+				acc = vmlaq_n_f32(acc, vld1q_f32(src_row + index[k] * 4), weight[k]);
+			vst1q_f32(dst_texel, acc);
+#else
+			float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (unsigned int k = 0; k < num_taps; ++k)
+				for (int c = 0; c < 4; ++c)
+					acc[c] += weight[k] * src_row[index[k] * 4 + c];
+			memcpy(dst_texel, acc, sizeof(acc));
+#endif
+		}
+	}
+}
+
+// Row y of dst is the weighted sum of whole rows of src, added one after another so the memory is read in order.
+// src only holds the rows from first_row on
+static void FilterRowsV(const float* src, int first_row, float* dst, unsigned int width, const sFilterTaps& taps, unsigned int start, unsigned int end)
+{
+	unsigned int num_taps = taps.num_taps;
+	unsigned int count = width * 4;
+	for (unsigned int y = start; y < end; ++y)
+	{
+		float* dst_row = dst + y * count;
+		const int* index = &taps.index[y * num_taps];
+		const float* weight = &taps.weight[y * num_taps];
+		memset(dst_row, 0, count * sizeof(float));
+
+		for (unsigned int k = 0; k < num_taps; ++k)
+		{
+			const float* src_row = src + (index[k] - first_row) * count;
+			unsigned int i = 0;
+#if defined(USE_SSE2)
+			__m128 w = _mm_set1_ps(weight[k]);
+			for (; i + 4 <= count; i += 4)
+				_mm_storeu_ps(dst_row + i, _mm_add_ps(_mm_loadu_ps(dst_row + i), _mm_mul_ps(w, _mm_loadu_ps(src_row + i))));
+#elif defined(USE_NEON)
+			for (; i + 4 <= count; i += 4)
+				vst1q_f32(dst_row + i, vmlaq_n_f32(vld1q_f32(dst_row + i), vld1q_f32(src_row + i), weight[k]));
+#endif
+			for (; i < count; ++i)
+				dst_row[i] += weight[k] * src_row[i];
+		}
+	}
+}
+
+// Filters the rows [start, end) of the smaller level into 'dst'. Only the rows of the bigger level they need are
+// filtered horizontally, into a band of the new width, so the memory used does not grow with the size of the level.
+// get_row(y, scratch) returns the row y of the bigger level in floats, converting it into 'scratch' if needed
+template <typename F>
+static void FilterBand(unsigned int src_width, unsigned int dst_width, const sFilterTaps& taps_x, const sFilterTaps& taps_y, unsigned int start, unsigned int end, F get_row, float* dst)
+{
+	const int* index = &taps_y.index[start * taps_y.num_taps];
+	int first = index[0], last = index[0];
+	for (unsigned int i = 1; i < (end - start) * taps_y.num_taps; ++i)
+	{
+		first = std::min(first, index[i]);
+		last = std::max(last, index[i]);
+	}
+
+	std::vector<float> scratch(src_width * 4), band((last - first + 1) * dst_width * 4);
+	for (int y = first; y <= last; ++y)
+		FilterRowsH(get_row(y, &scratch[0]), src_width, &band[(y - first) * dst_width * 4], dst_width, taps_x, 0, 1);
+	FilterRowsV(&band[0], first, dst, dst_width, taps_y, start, end);
+}
+
+unsigned int MipChain::GetNumLevelsForSize(unsigned int width, unsigned int height)
+{
+	unsigned int num_levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+		num_levels++;
+	}
+	return num_levels;
+}
+
+void MipChain::Clear()
+{
+	channels = 0;
+	levels.clear();
+	std::vector<unsigned char>().swap(data);
+}
+
+void MipChain::Build(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, eMipFilter filter, bool srgb)
+{
+	Clear();
+	if (width == 0 || height == 0 || channels == 0 || channels > 4)
+		return;
+	this->channels = channels;
+
+	// Sizes and positions of all the levels
+	levels.resize(GetNumLevelsForSize(width, height));
+	size_t total_size = 0;
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		levels[l].width = width;
+		levels[l].height = height;
+		levels[l].offset = total_size;
+		total_size += width * height * channels;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	data.resize(total_size);
+	memcpy(&data[0], pixels, levels[0].width * levels[0].height * channels);
+
+	int alpha_channel = (channels == 2 || channels == 4) ? (int)channels - 1 : -1;
+	float decode[256];
+	for (int i = 0; i < 256; ++i)
+		decode[i] = srgb ? HDRImage::SRGBToLinear((unsigned char)i) : i / 255.0f;
+
+	// Texels in linear light and premultiplied, so transparent texels do not bleed their color. Level 0 is
+	// converted a row at a time when a band needs it, the other levels are kept in floats until the next one
+	// is done (the rounding errors do not accumulate). The extra memory is about the size of level 1 in floats
+	unsigned int width0 = levels[0].width;
+	auto get_row0 = [&](unsigned int y, float* scratch) -> const float* {
+		const unsigned char* src = pixels + y * width0 * channels;
+		float* dst = scratch;
+		for (unsigned int i = width0; i > 0; --i, src += channels, dst += 4)
+		{
+			float alpha = alpha_channel >= 0 ? src[alpha_channel] * (1.0f / 255.0f) : 1.0f;
+			dst[0] = dst[1] = dst[2] = dst[3] = 0.0f;
+			for (unsigned int c = 0; c < channels; ++c)
+				dst[c] = decode[src[c]] * alpha;
+			if (alpha_channel >= 0)
+				dst[alpha_channel] = alpha;
+		}
+		return scratch;
+	};
+
+	sFilterTaps taps_x, taps_y;
+	std::vector<float> current, next;
+	for (size_t l = 1; l < levels.size(); ++l)
+	{
+		const sLevel& src = levels[l - 1];
+		const sLevel& dst = levels[l];
+		ComputeTaps(src.width, dst.width, filter, taps_x);
+		ComputeTaps(src.height, dst.height, filter, taps_y);
+
+		next.resize(dst.width * dst.height * 4);
+		ForEachRowRange(dst.width, dst.height, [&](unsigned int start, unsigned int end) {
+			if (l == 1)
+				FilterBand(src.width, dst.width, taps_x, taps_y, start, end, get_row0, &next[0]);
+			else
+				FilterBand(src.width, dst.width, taps_x, taps_y, start, end, [&](unsigned int y, float*) -> const float* {
+					return &current[y * src.width * 4];
+				}, &next[0]);
+
+			// Back to bytes
+			const float* texel = &next[start * dst.width * 4];
+			unsigned char* out = &data[dst.offset + start * dst.width * channels];
+			for (unsigned int i = (end - start) * dst.width; i > 0; --i, texel += 4, out += channels)
+			{
+				float alpha = alpha_channel >= 0 ? clamp(texel[alpha_channel], 0.0f, 1.0f) : 1.0f;
+				float inv_alpha = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+				for (unsigned int c = 0; c < channels; ++c)
+				{
+					if ((int)c == alpha_channel)
+						out[c] = (unsigned char)(alpha * 255.0f + 0.5f);
+					else if (srgb)
+						out[c] = HDRImage::LinearToSRGB(texel[c] * inv_alpha);
+					else
+						out[c] = (unsigned char)(clamp(texel[c] * inv_alpha, 0.0f, 1.0f) * 255.0f + 0.5f);
+				}
+			}
+		});
+		current.swap(next);
+	}
+}
+
+// File layout: "MIPS", key, width, height, channels, number of levels and then all the levels
+bool MipChain::Save(const std::string& filename, unsigned long long key) const
+{
+	if (levels.empty())
+		return false;
+
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	unsigned int header[4] = { levels[0].width, levels[0].height, channels, GetNumLevels() };
+	bool ok = fwrite("MIPS", 1, 4, file) == 4 &&
+		fwrite(&key, sizeof(key), 1, file) == 1 &&
+		fwrite(header, sizeof(header), 1, file) == 1 &&
+		fwrite(&data[0], 1, data.size(), file) == data.size();
+	fclose(file);
+
+	if (!ok)
+		std::cerr << "Error saving mipmaps: " << filename << std::endl;
+	return ok;
+}
+
+bool MipChain::Load(const std::string& filename, unsigned long long key)
+{
+	Clear();
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		return false;
+
+	char magic[4];
+	unsigned long long file_key;
+	unsigned int header[4];
+	if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "MIPS", 4) != 0 ||
+		fread(&file_key, sizeof(file_key), 1, file) != 1 || file_key != key ||
+		fread(header, sizeof(header), 1, file) != 1 ||
+		header[0] == 0 || header[1] == 0 || header[2] == 0 || header[2] > 4 ||
+		header[3] != GetNumLevelsForSize(header[0], header[1]))
+	{
+		fclose(file);
+		return false;
+	}
+
+	unsigned int width = header[0], height = header[1];
+	levels.resize(header[3]);
+	size_t total_size = 0;
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		levels[l].width = width;
+		levels[l].height = height;
+		levels[l].offset = total_size;
+		total_size += width * height * header[2];
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+
+	data.resize(total_size);
+	bool ok = fread(&data[0], 1, total_size, file) == total_size;
+	fclose(file);
+	if (!ok)
+	{
+		Clear();
+		return false;
+	}
+	channels = header[2];
+	return true;
+}
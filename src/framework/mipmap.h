@@ -0,0 +1,48 @@
+/*
+	Builds the whole mipmap chain of an 8 bits per channel image on the CPU, so the mipmaps do not depend on the
+	driver and work with any size (not only powers of two). Texels are filtered in linear light with premultiplied
+	alpha, 4 channels at a time with SIMD and splitting the rows of the big levels between threads.
+	The levels can be uploaded one by one (see Texture::UploadMipChain) or saved to disk and loaded next time.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+class MipChain
+{
+public:
+	enum eMipFilter {
+		MIPFILTER_BOX,		// Average of the texels covered by the new one, fast but a bit blurry
+		MIPFILTER_KAISER	// Kaiser windowed sinc, sharper (more texels per result)
+	};
+
+	struct sLevel
+	{
+		unsigned int width;
+		unsigned int height;
+		size_t offset;		// Position of the first byte of the level in 'data'
+	};
+
+	unsigned int channels;				// 1 to 4 bytes per texel, rows tightly packed (alpha is the last one with 2 or 4)
+	std::vector<sLevel> levels;			// levels[0] is the original image, the last one is 1x1
+	std::vector<unsigned char> data;	// All the levels one after another
+
+	MipChain() { channels = 0; }
+
+	// Copies the image as level 0 and builds the rest. Every level halves the size of the previous one rounding down
+	// like OpenGL (a 5x3 image goes 2x1 and 1x1), odd sizes are filtered without shifting the image.
+	// With srgb the color channels are decoded before filtering and encoded again, alpha is always linear.
+	void Build(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, eMipFilter filter = MIPFILTER_BOX, bool srgb = true);
+	void Clear();
+
+	unsigned int GetNumLevels() const { return (unsigned int)levels.size(); }
+	const unsigned char* GetLevelData(unsigned int level) const { return &data[levels[level].offset]; }
+
+	// Disk cache. 'key' identifies the source (a hash of its pixels for example), Load fails if it does not match
+	bool Save(const std::string& filename, unsigned long long key) const;
+	bool Load(const std::string& filename, unsigned long long key);
+
+	static unsigned int GetNumLevelsForSize(unsigned int width, unsigned int height);
+};
@@ -0,0 +1,673 @@
+#include "pngencoder.h"
+#include "framework.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+// Bytes of filtered rows compressed by every job (whole rows, at least one)
+#define PNG_BYTES_PER_JOB (1 << 20)
+
+#define WINDOW_SIZE 32768		// The furthest a match can go back
+#define MIN_MATCH 4				// Deflate allows 3, but they rarely pay off and the hash reads 4 bytes
+#define MAX_MATCH 258
+#define NICE_MATCH 128			// Long enough to stop looking for a better one
+#define HASH_BITS 15
+#define BLOCK_TOKENS (1 << 16)	// Literals and matches per deflate block, every block has its own Huffman codes
+#define MATCH_FLAG 0x80000000u	// Token layout: literal byte, or the flag with the length in bits 15-23 and distance - 1 in bits 0-14
+
+static const unsigned short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const unsigned char CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Lookup tables, built the first time they are used (from any thread)
+struct sEncoderTables
+{
+	unsigned int crc[256];
+	unsigned char length_symbol[MAX_MATCH + 1];	// Length code - 257 of every match length
+	unsigned char dist_symbol_small[512];		// Distance code of distances up to 512 (index distance - 1)
+	unsigned char dist_symbol_large[128];		// Of the longer ones (index (distance - 1) >> 8)
+
+	sEncoderTables()
+	{
+		for (unsigned int n = 0; n < 256; ++n)
+		{
+			unsigned int c = n;
+			for (int k = 0; k < 8; ++k)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			crc[n] = c;
+		}
+		for (unsigned int s = 0; s < 29; ++s)
+			for (unsigned int l = LENGTH_BASE[s]; l < LENGTH_BASE[s] + (1u << LENGTH_EXTRA[s]) && l <= MAX_MATCH; ++l)
+				length_symbol[l] = (unsigned char)s;
+		for (unsigned int s = 0; s < 30; ++s)
+			for (unsigned int d = DIST_BASE[s]; d < DIST_BASE[s] + (1u << DIST_EXTRA[s]); ++d)
+			{
+				if (d <= 512)
+					dist_symbol_small[d - 1] = (unsigned char)s;
+				else
+					dist_symbol_large[(d - 1) >> 8] = (unsigned char)s;
+			}
+	}
+
+	unsigned int DistSymbol(unsigned int dist) const { return dist <= 512 ? dist_symbol_small[dist - 1] : dist_symbol_large[(dist - 1) >> 8]; }
+};
+
+static const sEncoderTables& GetTables()
+{
+	static sEncoderTables tables;
+	return tables;
+}
+
+// CRC-32 of the PNG chunks, start with 0xFFFFFFFF and xor the result with it at the end
+static unsigned int UpdateCRC(unsigned int crc, const unsigned char* data, size_t size)
+{
+	const unsigned int* table = GetTables().crc;
+	for (size_t i = 0; i < size; ++i)
+		crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+	return crc;
+}
+
+static unsigned int Adler32(const unsigned char* data, size_t size)
+{
+	unsigned int a = 1, b = 0;
+	while (size > 0)
+	{
+		size_t n = std::min(size, (size_t)5552); // The most bytes before the sums can overflow
+		size -= n;
+		while (n--)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// Adler-32 of two buffers one after the other from the checksum of each one (same as zlib adler32_combine)
+static unsigned int CombineAdler32(unsigned int adler1, unsigned int adler2, size_t size2)
+{
+	const unsigned int BASE = 65521;
+	unsigned int rem = (unsigned int)(size2 % BASE);
+	unsigned int sum1 = adler1 & 0xFFFF;
+	unsigned int sum2 = (unsigned int)(((unsigned long long)rem * sum1) % BASE);
+	sum1 += (adler2 & 0xFFFF) + BASE - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + BASE - rem;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum2 >= BASE * 2) sum2 -= BASE * 2;
+	if (sum2 >= BASE) sum2 -= BASE;
+	return sum1 | (sum2 << 16);
+}
+
+static inline void WriteBigEndian(std::vector<unsigned char>& out, unsigned int value)
+{
+	unsigned char bytes[4] = { (unsigned char)(value >> 24), (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static void WriteChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size)
+{
+	WriteBigEndian(out, (unsigned int)size);
+	out.insert(out.end(), type, type + 4);
+	if (size)
+		out.insert(out.end(), data, data + size);
+	unsigned int crc = UpdateCRC(0xFFFFFFFFu, (const unsigned char*)type, 4);
+	WriteBigEndian(out, UpdateCRC(crc, data, size) ^ 0xFFFFFFFFu);
+}
+
+// Deflate writes the bits starting from the least significant one
+struct sBitWriter
+{
+	std::vector<unsigned char>& out;
+	unsigned long long bits;
+	unsigned int count;
+
+	sBitWriter(std::vector<unsigned char>& out) : out(out), bits(0), count(0) {}
+
+	void Write(unsigned int value, unsigned int n) // n <= 32
+	{
+		bits |= (unsigned long long)value << count;
+		count += n;
+		if (count >= 32)
+		{
+			unsigned char bytes[4] = { (unsigned char)bits, (unsigned char)(bits >> 8), (unsigned char)(bits >> 16), (unsigned char)(bits >> 24) };
+			out.insert(out.end(), bytes, bytes + 4);
+			bits >>= 32;
+			count -= 32;
+		}
+	}
+
+	void AlignToByte()
+	{
+		for (; count > 0; count = count > 8 ? count - 8 : 0)
+		{
+			out.push_back((unsigned char)bits);
+			bits >>= 8;
+		}
+		bits = 0;
+	}
+};
+
+struct sHuffman
+{
+	unsigned short code[288];	// Bits already reversed, ready for sBitWriter
+	unsigned char length[288];	// 0 for the symbols not used
+};
+
+// Length limited canonical Huffman code: optimal lengths with the in place algorithm of Moffat and Katajainen,
+// then the longest ones are shortened moving leaves down the tree until the Kraft sum is 1 again
+static void BuildHuffman(const unsigned int* freqs, unsigned int num_symbols, unsigned int max_bits, sHuffman& huffman)
+{
+	memset(huffman.length, 0, sizeof(huffman.length));
+
+	std::vector< std::pair<unsigned int, unsigned int> > used; // Frequency and symbol
+	for (unsigned int s = 0; s < num_symbols; ++s)
+		if (freqs[s])
+			used.push_back(std::make_pair(freqs[s], s));
+	// A code with a single symbol would have length 0, the decoders expect two at least
+	for (unsigned int s = 0; used.size() < 2; ++s)
+		if (!freqs[s])
+			used.push_back(std::make_pair(1u, s));
+	std::sort(used.begin(), used.end());
+
+	int n = (int)used.size();
+	std::vector<unsigned int> a(n);
+	for (int i = 0; i < n; ++i)
+		a[i] = used[i].first;
+
+	// Parents, then depths of the internal nodes and finally the depths of the leaves (least frequent first)
+	int root = 0, leaf = 2, next;
+	a[0] += a[1];
+	for (next = 1; next < n - 1; ++next)
+	{
+		if (leaf >= n || a[root] < a[leaf]) { a[next] = a[root]; a[root++] = next; }
+		else a[next] = a[leaf++];
+		if (leaf >= n || (root < next && a[root] < a[leaf])) { a[next] += a[root]; a[root++] = next; }
+		else a[next] += a[leaf++];
+	}
+	a[n - 2] = 0;
+	for (next = n - 3; next >= 0; --next)
+		a[next] = a[a[next]] + 1;
+	int available = 1, used_nodes = 0, depth = 0;
+	root = n - 2;
+	next = n - 1;
+	while (available > 0)
+	{
+		while (root >= 0 && (int)a[root] == depth) { used_nodes++; root--; }
+		while (available > used_nodes) { a[next--] = depth; available--; }
+		available = 2 * used_nodes;
+		depth++;
+		used_nodes = 0;
+	}
+
+	unsigned int count[64] = { 0 }; // Symbols of every length
+	for (int i = 0; i < n; ++i)
+		count[std::min(a[i], 63u)]++;
+	for (unsigned int bits = max_bits + 1; bits < 64; ++bits)
+		count[max_bits] += count[bits];
+	unsigned int total = 0;
+	for (unsigned int bits = max_bits; bits > 0; --bits)
+		total += count[bits] << (max_bits - bits);
+	while (total != (1u << max_bits))
+	{
+		count[max_bits]--;
+		for (unsigned int bits = max_bits - 1; bits > 0; --bits)
+			if (count[bits])
+			{
+				count[bits]--;
+				count[bits + 1] += 2;
+				break;
+			}
+		total--;
+	}
+
+	// The most frequent symbols get the shortest codes
+	for (unsigned int bits = 1, j = n; bits <= max_bits; ++bits)
+		for (unsigned int k = count[bits]; k > 0; --k)
+			huffman.length[used[--j].second] = (unsigned char)bits;
+
+	unsigned int length_count[16] = { 0 }, next_code[16] = { 0 };
+	for (unsigned int s = 0; s < num_symbols; ++s)
+		length_count[huffman.length[s]]++;
+	length_count[0] = 0;
+	for (unsigned int bits = 1, code = 0; bits < 16; ++bits)
+	{
+		code = (code + length_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+	for (unsigned int s = 0; s < num_symbols; ++s)
+	{
+		unsigned int length = huffman.length[s], code = next_code[length]++, reversed = 0;
+		for (unsigned int i = 0; i < length; ++i, code >>= 1)
+			reversed = (reversed << 1) | (code & 1);
+		huffman.code[s] = (unsigned short)reversed;
+	}
+}
+
+static void WriteStored(sBitWriter& writer, const unsigned char* data, size_t size, bool final)
+{
+	do
+	{
+		size_t n = std::min(size, (size_t)65535);
+		writer.Write(final && n == size ? 1 : 0, 3); // BFINAL and BTYPE 00
+		writer.AlignToByte();
+		unsigned char header[4] = { (unsigned char)n, (unsigned char)(n >> 8), (unsigned char)~n, (unsigned char)(~n >> 8) };
+		writer.out.insert(writer.out.end(), header, header + 4);
+		writer.out.insert(writer.out.end(), data, data + n);
+		data += n;
+		size -= n;
+	} while (size > 0);
+}
+
+// Writes the tokens that encode data[0, size) as a block with its own Huffman codes, or stored if that is smaller
+static void WriteBlock(sBitWriter& writer, const std::vector<unsigned int>& tokens, const unsigned char* data, size_t size, bool final)
+{
+	const sEncoderTables& tables = GetTables();
+	unsigned int lit_freqs[286] = { 0 }, dist_freqs[30] = { 0 };
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		unsigned int token = tokens[i];
+		if (token & MATCH_FLAG)
+		{
+			lit_freqs[257 + tables.length_symbol[(token >> 15) & 511]]++;
+			dist_freqs[tables.DistSymbol((token & 32767) + 1)]++;
+		}
+		else
+			lit_freqs[token]++;
+	}
+	lit_freqs[256] = 1; // End of block
+
+	sHuffman lit, dist, lengths_code;
+	BuildHuffman(lit_freqs, 286, 15, lit);
+	BuildHuffman(dist_freqs, 30, 15, dist);
+
+	// Lengths of both codes one after the other, the runs are encoded with the symbols 16 (repeat), 17 and 18 (zeros)
+	unsigned int hlit = 286, hdist = 30;
+	while (hlit > 257 && lit.length[hlit - 1] == 0)
+		hlit--;
+	while (hdist > 1 && dist.length[hdist - 1] == 0)
+		hdist--;
+	unsigned char lengths[286 + 30];
+	memcpy(lengths, lit.length, hlit);
+	memcpy(lengths + hlit, dist.length, hdist);
+
+	unsigned char rle_symbol[286 + 30], rle_extra[286 + 30];
+	unsigned int num_rle = 0, lengths_freqs[19] = { 0 };
+	for (unsigned int i = 0, total = hlit + hdist; i < total;)
+	{
+		unsigned char length = lengths[i];
+		unsigned int run = 1;
+		while (i + run < total && lengths[i + run] == length)
+			run++;
+		i += run;
+
+		if (length != 0) // The first one is written, the rest repeat it
+		{
+			rle_symbol[num_rle] = length;
+			rle_extra[num_rle++] = 0;
+			run--;
+		}
+		while (run >= 3)
+		{
+			unsigned int n = std::min(run, length ? 6u : 138u);
+			rle_symbol[num_rle] = length ? 16 : (n >= 11 ? 18 : 17);
+			rle_extra[num_rle++] = (unsigned char)(n - (length ? 3 : (n >= 11 ? 11 : 3)));
+			run -= n;
+		}
+		for (; run > 0; --run)
+		{
+			rle_symbol[num_rle] = length;
+			rle_extra[num_rle++] = 0;
+		}
+	}
+	for (unsigned int i = 0; i < num_rle; ++i)
+		lengths_freqs[rle_symbol[i]]++;
+	BuildHuffman(lengths_freqs, 19, 7, lengths_code);
+	unsigned int hclen = 19;
+	while (hclen > 4 && lengths_code.length[CODE_LENGTH_ORDER[hclen - 1]] == 0)
+		hclen--;
+
+	static const unsigned char RLE_EXTRA_BITS[19] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+	size_t dynamic_bits = 3 + 14 + hclen * 3;
+	for (unsigned int i = 0; i < num_rle; ++i)
+		dynamic_bits += lengths_code.length[rle_symbol[i]] + RLE_EXTRA_BITS[rle_symbol[i]];
+	for (unsigned int s = 0; s < 286; ++s)
+		dynamic_bits += (size_t)lit_freqs[s] * (lit.length[s] + (s > 256 ? LENGTH_EXTRA[s - 257] : 0));
+	for (unsigned int s = 0; s < 30; ++s)
+		dynamic_bits += (size_t)dist_freqs[s] * (dist.length[s] + DIST_EXTRA[s]);
+	size_t stored_bits = size * 8 + (size / 65535 + 1) * 40;
+	if (stored_bits < dynamic_bits)
+	{
+		WriteStored(writer, data, size, final);
+		return;
+	}
+
+	writer.Write(final ? 1 : 0, 1);
+	writer.Write(2, 2); // Dynamic Huffman codes
+	writer.Write(hlit - 257, 5);
+	writer.Write(hdist - 1, 5);
+	writer.Write(hclen - 4, 4);
+	for (unsigned int i = 0; i < hclen; ++i)
+		writer.Write(lengths_code.length[CODE_LENGTH_ORDER[i]], 3);
+	for (unsigned int i = 0; i < num_rle; ++i)
+	{
+		writer.Write(lengths_code.code[rle_symbol[i]], lengths_code.length[rle_symbol[i]]);
+		writer.Write(rle_extra[i], RLE_EXTRA_BITS[rle_symbol[i]]);
+	}
+
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		unsigned int token = tokens[i];
+		if (token & MATCH_FLAG)
+		{
+			unsigned int length = (token >> 15) & 511, distance = (token & 32767) + 1;
+			unsigned int s = tables.length_symbol[length], d = tables.DistSymbol(distance);
+			writer.Write(lit.code[257 + s], lit.length[257 + s]);
+			writer.Write(length - LENGTH_BASE[s], LENGTH_EXTRA[s]);
+			writer.Write(dist.code[d], dist.length[d]);
+			writer.Write(distance - DIST_BASE[d], DIST_EXTRA[d]);
+		}
+		else
+			writer.Write(lit.code[token], lit.length[token]);
+	}
+	writer.Write(lit.code[256], lit.length[256]);
+}
+
+static inline unsigned int Hash(const unsigned char* p)
+{
+	unsigned int value;
+	memcpy(&value, p, 4);
+	return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Number of equal bytes at a and b (up to limit), 8 at a time
+static inline unsigned int MatchLength(const unsigned char* a, const unsigned char* b, unsigned int limit)
+{
+	unsigned int length = 0;
+	while (length + 8 <= limit)
+	{
+		unsigned long long x, y;
+		memcpy(&x, a + length, 8);
+		memcpy(&y, b + length, 8);
+		if (x != y)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward64(&index, x ^ y);
+			return length + index / 8;
+#else
+			return length + (unsigned int)__builtin_ctzll(x ^ y) / 8;
+#endif
+		}
+		length += 8;
+	}
+	while (length < limit && a[length] == b[length])
+		length++;
+	return length;
+}
+
+// Compresses data[begin, end) in deflate blocks, the matches can also use the 32KB before 'begin'.
+// The last block is final only if 'final', otherwise an empty stored block leaves the output byte aligned
+// (a zlib sync flush) so the next range can be appended to it.
+static void DeflateRange(const unsigned char* data, size_t begin, size_t end, ePNGLevel level, bool final, std::vector<unsigned char>& out)
+{
+	sBitWriter writer(out);
+	if (level == PNG_LEVEL_STORE)
+	{
+		WriteStored(writer, data + begin, end - begin, final);
+		return;
+	}
+
+	// FAST looks at the last position with the same hash only and does not add the ones inside the matches
+	const unsigned int max_chain = level == PNG_LEVEL_FAST ? 1 : (level == PNG_LEVEL_DEFAULT ? 16 : 256);
+	const unsigned int nice_length = level == PNG_LEVEL_BEST ? MAX_MATCH : NICE_MATCH;
+	const bool lazy = level == PNG_LEVEL_BEST, insert_all = level != PNG_LEVEL_FAST;
+
+	// Positions are stored relative to 'base' plus one (0 is an empty entry)
+	const size_t base = begin > WINDOW_SIZE ? begin - WINDOW_SIZE : 0;
+	std::vector<unsigned int> head(1 << HASH_BITS, 0), prev(max_chain > 1 ? WINDOW_SIZE : 0, 0);
+	auto Insert = [&](size_t p) {
+		unsigned int h = Hash(data + p);
+		if (max_chain > 1)
+			prev[p & (WINDOW_SIZE - 1)] = head[h];
+		head[h] = (unsigned int)(p - base + 1);
+	};
+	auto FindMatch = [&](size_t p, unsigned int& best_dist) {
+		unsigned int limit = (unsigned int)std::min((size_t)MAX_MATCH, end - p), best_length = 0;
+		unsigned int candidate = head[Hash(data + p)];
+		for (unsigned int chain = max_chain; candidate && chain > 0; --chain)
+		{
+			size_t c = base + candidate - 1;
+			if (p - c > WINDOW_SIZE)
+				break;
+			if (data[c + best_length] == data[p + best_length])
+			{
+				unsigned int length = MatchLength(data + c, data + p, limit);
+				if (length > best_length)
+				{
+					best_length = length;
+					best_dist = (unsigned int)(p - c);
+					if (length >= nice_length || length >= limit)
+						break;
+				}
+			}
+			if (max_chain == 1)
+				break;
+			unsigned int older = prev[c & (WINDOW_SIZE - 1)];
+			if (older >= candidate) // The entry was overwritten by a newer position
+				break;
+			candidate = older;
+		}
+		return best_length >= MIN_MATCH ? best_length : 0u;
+	};
+
+	// The dictionary
+	size_t next_insert = base;
+	auto InsertUpTo = [&](size_t p) {
+		for (; next_insert < p && next_insert + MIN_MATCH <= end; ++next_insert)
+			Insert(next_insert);
+		next_insert = std::max(next_insert, p);
+	};
+	InsertUpTo(begin);
+
+	std::vector<unsigned int> tokens;
+	tokens.reserve(BLOCK_TOKENS + 2);
+	size_t block_begin = begin, p = begin;
+	while (p < end)
+	{
+		unsigned int length = 0, dist = 0;
+		if (p + MIN_MATCH <= end)
+		{
+			InsertUpTo(p);
+			length = FindMatch(p, dist);
+			Insert(p);
+			next_insert = p + 1;
+		}
+
+		// Lazy matching: a longer match starting at the next byte wins over this one
+		while (lazy && length && length < nice_length && p + 1 + MIN_MATCH <= end)
+		{
+			unsigned int next_dist = 0, next_length = FindMatch(p + 1, next_dist);
+			Insert(p + 1);
+			next_insert = p + 2;
+			if (next_length <= length)
+				break;
+			tokens.push_back(data[p++]);
+			length = next_length;
+			dist = next_dist;
+		}
+
+		if (length)
+		{
+			tokens.push_back(MATCH_FLAG | (length << 15) | (dist - 1));
+			p += length;
+			if (!insert_all)
+				next_insert = p;
+		}
+		else
+			tokens.push_back(data[p++]);
+
+		if (tokens.size() >= BLOCK_TOKENS)
+		{
+			WriteBlock(writer, tokens, data + block_begin, p - block_begin, false);
+			tokens.clear();
+			block_begin = p;
+		}
+	}
+	WriteBlock(writer, tokens, data + block_begin, end - block_begin, final);
+
+	if (!final)
+		WriteStored(writer, NULL, 0, false);
+	writer.AlignToByte();
+}
+
+static inline unsigned char PaethPredictor(int a, int b, int c)
+{
+	// Written with selects instead of branches, the compiler turns them into conditional moves
+	int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+	int p = pb < pa ? b : a;
+	return (unsigned char)(pc < std::min(pa, pb) ? c : p);
+}
+
+// Every row gets the filter with the smallest sum of absolute values (as signed bytes), the usual heuristic.
+// Output rows start with the filter type, like in the file.
+static void FilterRows(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, bool flip_y, ePNGLevel level, unsigned int start, unsigned int end, unsigned char* filtered)
+{
+	size_t row_size = (size_t)width * channels;
+	std::vector<unsigned char> zeros(row_size, 0), candidates(row_size * 5);
+	for (unsigned int y = start; y < end; ++y)
+	{
+		const unsigned char* row = pixels + (flip_y ? height - 1 - y : y) * row_size;
+		const unsigned char* up = y == 0 ? &zeros[0] : pixels + (flip_y ? height - y : y - 1) * row_size;
+		unsigned char* dst = filtered + y * (row_size + 1);
+		if (level == PNG_LEVEL_STORE)
+		{
+			dst[0] = 0;
+			memcpy(dst + 1, row, row_size);
+			continue;
+		}
+
+		unsigned char* sub = &candidates[row_size];
+		unsigned char* vertical = sub + row_size;
+		unsigned char* average = vertical + row_size;
+		unsigned char* paeth = average + row_size;
+		memcpy(&candidates[0], row, row_size);
+
+		// The scores are added while filtering, so every candidate is only written once
+		size_t scores[5] = { 0, 0, 0, 0, 0 };
+		for (size_t i = 0; i < channels; ++i)
+		{
+			int b = up[i];
+			sub[i] = row[i];
+			vertical[i] = (unsigned char)(row[i] - b);
+			average[i] = (unsigned char)(row[i] - (b >> 1));
+			paeth[i] = (unsigned char)(row[i] - b); // The predictor is always 'b' without a left pixel
+		}
+		for (size_t i = channels; i < row_size; ++i)
+		{
+			int a = row[i - channels], b = up[i], c = up[i - channels];
+			sub[i] = (unsigned char)(row[i] - a);
+			vertical[i] = (unsigned char)(row[i] - b);
+			average[i] = (unsigned char)(row[i] - ((a + b) >> 1));
+			paeth[i] = (unsigned char)(row[i] - PaethPredictor(a, b, c));
+		}
+		for (size_t i = 0; i < row_size; ++i)
+		{
+			scores[0] += abs((signed char)row[i]);
+			scores[1] += abs((signed char)sub[i]);
+			scores[2] += abs((signed char)vertical[i]);
+			scores[3] += abs((signed char)average[i]);
+			scores[4] += abs((signed char)paeth[i]);
+		}
+
+		unsigned int best = 0;
+		for (unsigned int f = 1; f < 5; ++f)
+			if (scores[f] < scores[best])
+				best = f;
+		dst[0] = (unsigned char)best;
+		memcpy(dst + 1, &candidates[best * row_size], row_size);
+	}
+}
+
+bool EncodePNG(std::vector<unsigned char>& out, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, ePNGLevel level, bool flip_y)
+{
+	static const unsigned char COLOR_TYPES[5] = { 0, 0, 4, 2, 6 }; // Grey, grey and alpha, RGB, RGBA
+	if (width == 0 || height == 0 || channels < 1 || channels > 4)
+		return false;
+
+	// Rows are filtered and compressed in jobs of whole rows
+	size_t row_size = (size_t)width * channels + 1;
+	unsigned int rows_per_job = (unsigned int)std::max((size_t)1, PNG_BYTES_PER_JOB / row_size);
+	int num_jobs = (int)((height + rows_per_job - 1) / rows_per_job);
+
+	std::vector<unsigned char> filtered(row_size * height);
+	parallelFor(0, num_jobs, [&](int i) {
+		FilterRows(pixels, width, height, channels, flip_y, level, i * rows_per_job, std::min(height, (i + 1) * rows_per_job), &filtered[0]);
+	});
+
+	// Every job is an IDAT chunk, the first one starts with the zlib header and the last one ends with the checksum
+	static const unsigned char ZLIB_HEADERS[4][2] = { { 0x78, 0x01 }, { 0x78, 0x01 }, { 0x78, 0x9C }, { 0x78, 0xDA } };
+	std::vector< std::vector<unsigned char> > chunks(num_jobs);
+	std::vector<unsigned int> adlers(num_jobs), crcs(num_jobs);
+	parallelFor(0, num_jobs, [&](int i) {
+		size_t begin = (size_t)i * rows_per_job * row_size, end = std::min((size_t)height, (size_t)(i + 1) * rows_per_job) * row_size;
+		DeflateRange(&filtered[0], begin, end, level, i == num_jobs - 1, chunks[i]);
+		adlers[i] = Adler32(&filtered[begin], end - begin);
+
+		// Not finished yet, the last chunk still needs the checksum
+		crcs[i] = UpdateCRC(0xFFFFFFFFu, (const unsigned char*)"IDAT", 4);
+		if (i == 0)
+			crcs[i] = UpdateCRC(crcs[i], ZLIB_HEADERS[level], 2);
+		crcs[i] = UpdateCRC(crcs[i], chunks[i].empty() ? NULL : &chunks[i][0], chunks[i].size());
+	});
+	std::vector<unsigned char>().swap(filtered);
+
+	unsigned int adler = 1;
+	size_t total = 0;
+	for (int i = 0; i < num_jobs; ++i)
+	{
+		size_t begin = (size_t)i * rows_per_job * row_size, end = std::min((size_t)height, (size_t)(i + 1) * rows_per_job) * row_size;
+		adler = CombineAdler32(adler, adlers[i], end - begin);
+		total += chunks[i].size() + 12;
+	}
+	unsigned char adler_bytes[4] = { (unsigned char)(adler >> 24), (unsigned char)(adler >> 16), (unsigned char)(adler >> 8), (unsigned char)adler };
+
+	static const unsigned char SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	unsigned char header[13] = {
+		(unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+		(unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+		8, COLOR_TYPES[channels], 0, 0, 0 // 8 bits, deflate, adaptive filters, no interlace
+	};
+	out.clear();
+	out.reserve(total + 64);
+	out.insert(out.end(), SIGNATURE, SIGNATURE + 8);
+	WriteChunk(out, "IHDR", header, sizeof(header));
+	for (int i = 0; i < num_jobs; ++i)
+	{
+		bool first = i == 0, last = i == num_jobs - 1;
+		WriteBigEndian(out, (unsigned int)(chunks[i].size() + (first ? 2 : 0) + (last ? 4 : 0)));
+		out.insert(out.end(), "IDAT", "IDAT" + 4);
+		if (first)
+			out.insert(out.end(), ZLIB_HEADERS[level], ZLIB_HEADERS[level] + 2);
+		out.insert(out.end(), chunks[i].begin(), chunks[i].end());
+		if (last)
+		{
+			out.insert(out.end(), adler_bytes, adler_bytes + 4);
+			crcs[i] = UpdateCRC(crcs[i], adler_bytes, 4);
+		}
+		WriteBigEndian(out, crcs[i] ^ 0xFFFFFFFFu);
+		std::vector<unsigned char>().swap(chunks[i]);
+	}
+	WriteChunk(out, "IEND", NULL, 0);
+	return true;
+}
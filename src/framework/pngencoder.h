@@ -0,0 +1,20 @@
+/*
+	PNG encoder (8 bits per channel) with its own deflate. The rows are filtered with the usual heuristic and split
+	in chunks of about a megabyte that are compressed in parallel, each one using the end of the previous chunk as
+	its dictionary. The chunks are byte aligned, so they are joined as a single zlib stream (one IDAT chunk each).
+*/
+
+#pragma once
+
+#include <vector>
+
+enum ePNGLevel {
+	PNG_LEVEL_STORE,	// No compression, the fastest to write and the biggest file
+	PNG_LEVEL_FAST,		// Greedy matching with a single candidate per position (LZ4 style)
+	PNG_LEVEL_DEFAULT,	// Hash chains, a few candidates per position
+	PNG_LEVEL_BEST		// Long hash chains and lazy matching
+};
+
+// Encodes tightly packed rows of 1 (grey), 2 (grey and alpha), 3 (RGB) or 4 (RGBA) channels into a PNG file in 'out'.
+// With flip_y the first row of 'pixels' is the bottom one (OpenGL and Image order).
+bool EncodePNG(std::vector<unsigned char>& out, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, ePNGLevel level = PNG_LEVEL_DEFAULT, bool flip_y = false);
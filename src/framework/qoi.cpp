@@ -0,0 +1,319 @@
+#include "qoi.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_MASK 0xC0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING 8					// 7 zeros and a one at the end of the data
+#define QOI_PIXELS_MAX 400000000u		// Same limit as the reference decoder
+#define QOI_CONTAINER_HEADER_SIZE 18
+
+static const unsigned char QOI_END[QOI_PADDING] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// Pixels are kept as r | g << 8 | b << 16 | a << 24, so comparing them is a single integer compare
+static inline unsigned int Hash(unsigned int px)
+{
+	return ((px & 0xFF) * 3 + ((px >> 8) & 0xFF) * 5 + ((px >> 16) & 0xFF) * 7 + (px >> 24) * 11) & 63;
+}
+
+static inline unsigned char* Write32(unsigned char* p, unsigned int value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+	return p + 4;
+}
+
+static inline unsigned int Read32(const unsigned char* p)
+{
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static size_t GetMaxStripeSize(unsigned int width, unsigned int rows, unsigned int channels)
+{
+	return QOI_HEADER_SIZE + (size_t)width * rows * (channels + 1) + QOI_PADDING;
+}
+
+// Writes rows [start, end) of the image as a complete QOI file, returns the end of the written data.
+// The channels are a template argument so the inner loop has no branches for them
+template <unsigned int channels>
+static unsigned char* EncodeStripe(unsigned char* p, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int start, unsigned int end, bool flip_y)
+{
+	memcpy(p, "qoif", 4);
+	p = Write32(p + 4, width);
+	p = Write32(p, end - start);
+	*p++ = (unsigned char)channels;
+	*p++ = 0; // sRGB with linear alpha
+
+	unsigned int index[64] = { 0 };
+	unsigned int prev = 0xFF000000u, run = 0;
+	size_t row_size = (size_t)width * channels;
+	for (unsigned int y = start; y < end; ++y)
+	{
+		const unsigned char* src = pixels + (flip_y ? height - 1 - y : y) * row_size;
+		for (unsigned int x = 0; x < width; ++x, src += channels)
+		{
+			unsigned int px = src[0] | (src[1] << 8) | (src[2] << 16) | (channels == 4 ? (unsigned int)src[3] << 24 : 0xFF000000u);
+			if (px == prev)
+			{
+				if (++run == 62)
+				{
+					*p++ = (unsigned char)(QOI_OP_RUN | 61);
+					run = 0;
+				}
+				continue;
+			}
+			if (run)
+			{
+				*p++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			unsigned int hash = Hash(px);
+			if (index[hash] == px)
+				*p++ = (unsigned char)(QOI_OP_INDEX | hash);
+			else
+			{
+				index[hash] = px;
+				if ((px ^ prev) >> 24)
+				{
+					*p++ = QOI_OP_RGBA;
+					memcpy(p, src, 3);
+					p[3] = (unsigned char)(px >> 24);
+					p += 4;
+				}
+				else
+				{
+					// Differences wrap around like the bytes
+					signed char dr = (signed char)(px - prev), dg = (signed char)((px >> 8) - (prev >> 8)), db = (signed char)((px >> 16) - (prev >> 16));
+					signed char dr_dg = (signed char)(dr - dg), db_dg = (signed char)(db - dg);
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+						*p++ = (unsigned char)(QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+					else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+					{
+						p[0] = (unsigned char)(QOI_OP_LUMA | (dg + 32));
+						p[1] = (unsigned char)(((dr_dg + 8) << 4) | (db_dg + 8));
+						p += 2;
+					}
+					else
+					{
+						p[0] = QOI_OP_RGB;
+						memcpy(p + 1, src, 3);
+						p += 4;
+					}
+				}
+			}
+			prev = px;
+		}
+	}
+	if (run)
+		*p++ = (unsigned char)(QOI_OP_RUN | (run - 1));
+
+	memcpy(p, QOI_END, QOI_PADDING);
+	return p + QOI_PADDING;
+}
+
+static unsigned char* EncodeStripe(unsigned char* p, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int start, unsigned int end, bool flip_y)
+{
+	if (channels == 4)
+		return EncodeStripe<4>(p, pixels, width, height, start, end, flip_y);
+	return EncodeStripe<3>(p, pixels, width, height, start, end, flip_y);
+}
+
+bool EncodeQOI(std::vector<unsigned char>& out, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int stripes, bool flip_y)
+{
+	if (width == 0 || height == 0 || (channels != 3 && channels != 4) || (unsigned long long)width * height > QOI_PIXELS_MAX)
+		return false;
+
+	unsigned int rows_per_stripe = (height + std::max(1u, stripes) - 1) / std::max(1u, stripes);
+	stripes = (height + rows_per_stripe - 1) / rows_per_stripe;
+	if (stripes == 1)
+	{
+		out.resize(GetMaxStripeSize(width, height, channels));
+		out.resize(EncodeStripe(&out[0], pixels, width, height, channels, 0, height, flip_y) - &out[0]);
+		return true;
+	}
+
+	std::vector< std::vector<unsigned char> > encoded(stripes);
+	parallelFor(0, (int)stripes, [&](int i) {
+		unsigned int start = i * rows_per_stripe, end = std::min(height, start + rows_per_stripe);
+		std::vector<unsigned char>& stripe = encoded[i];
+		stripe.resize(GetMaxStripeSize(width, end - start, channels));
+		stripe.resize(EncodeStripe(&stripe[0], pixels, width, height, channels, start, end, flip_y) - &stripe[0]);
+	});
+
+	size_t total = QOI_CONTAINER_HEADER_SIZE + stripes * 4;
+	for (unsigned int i = 0; i < stripes; ++i)
+		total += encoded[i].size();
+	out.resize(total);
+
+	unsigned char* p = &out[0];
+	memcpy(p, "qoiS", 4);
+	p = Write32(p + 4, width);
+	p = Write32(p, height);
+	*p++ = (unsigned char)channels;
+	*p++ = 0;
+	p = Write32(p, stripes);
+	for (unsigned int i = 0; i < stripes; ++i)
+		p = Write32(p, (unsigned int)encoded[i].size());
+	for (unsigned int i = 0; i < stripes; ++i)
+	{
+		memcpy(p, &encoded[i][0], encoded[i].size());
+		p += encoded[i].size();
+		std::vector<unsigned char>().swap(encoded[i]);
+	}
+	return true;
+}
+
+static bool ReadHeader(const unsigned char* in, size_t size, const char* magic, unsigned int& width, unsigned int& height, unsigned int& channels)
+{
+	if (size < QOI_HEADER_SIZE || memcmp(in, magic, 4) != 0)
+		return false;
+	width = Read32(in + 4);
+	height = Read32(in + 8);
+	channels = in[12];
+	return width != 0 && height != 0 && (channels == 3 || channels == 4) && (unsigned long long)width * height <= QOI_PIXELS_MAX;
+}
+
+bool ReadQOIHeader(const unsigned char* in, size_t size, unsigned int& width, unsigned int& height, unsigned int& channels)
+{
+	return ReadHeader(in, size, "qoif", width, height, channels) || ReadHeader(in, size, "qoiS", width, height, channels);
+}
+
+// Decodes a complete QOI file, the row 'y' goes to first_row + y * stride
+template <unsigned int out_channels>
+static bool DecodeStripe(const unsigned char* in, size_t size, unsigned int width, unsigned int rows, unsigned char* first_row, ptrdiff_t stride)
+{
+	unsigned int file_width, file_rows, channels;
+	if (!ReadHeader(in, size, "qoif", file_width, file_rows, channels) || file_width != width || file_rows != rows || size < QOI_HEADER_SIZE + QOI_PADDING)
+		return false;
+
+	// The padding at the end is never read as an operation, so the longest one (5 bytes) always fits
+	const unsigned char* p = in + QOI_HEADER_SIZE;
+	const unsigned char* data_end = in + size - QOI_PADDING;
+	unsigned int index[64] = { 0 };
+	unsigned int px = 0xFF000000u, run = 0;
+	for (unsigned int y = 0; y < rows; ++y)
+	{
+		unsigned char* dst = first_row + y * stride;
+		for (unsigned int x = 0; x < width; ++x, dst += out_channels)
+		{
+			if (run)
+				--run;
+			else
+			{
+				if (p >= data_end)
+					return false;
+				unsigned int op = *p++;
+				switch (op >> 6)
+				{
+				case QOI_OP_INDEX >> 6:
+					px = index[op];
+					break;
+				case QOI_OP_DIFF >> 6:
+				{
+					unsigned int r = (px + ((op >> 4) & 3) - 2) & 0xFF;
+					unsigned int g = ((px >> 8) + ((op >> 2) & 3) - 2) & 0xFF;
+					unsigned int b = ((px >> 16) + (op & 3) - 2) & 0xFF;
+					px = (px & 0xFF000000u) | r | (g << 8) | (b << 16);
+					break;
+				}
+				case QOI_OP_LUMA >> 6:
+				{
+					int dg = (int)(op & 0x3F) - 32, dr_dg = (p[0] >> 4) - 8, db_dg = (p[0] & 0x0F) - 8;
+					++p;
+					unsigned int r = ((px & 0xFF) + dg + dr_dg) & 0xFF;
+					unsigned int g = (((px >> 8) & 0xFF) + dg) & 0xFF;
+					unsigned int b = (((px >> 16) & 0xFF) + dg + db_dg) & 0xFF;
+					px = (px & 0xFF000000u) | r | (g << 8) | (b << 16);
+					break;
+				}
+				default:
+					if (op == QOI_OP_RGB)
+					{
+						px = (px & 0xFF000000u) | p[0] | (p[1] << 8) | (p[2] << 16);
+						p += 3;
+					}
+					else if (op == QOI_OP_RGBA)
+					{
+						px = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+						p += 4;
+					}
+					else
+						run = op & 0x3F;
+				}
+				index[Hash(px)] = px;
+			}
+
+			// A single 32 bit store, with 3 channels the extra byte is written again by the next pixel of the row
+			unsigned char bytes[4] = { (unsigned char)px, (unsigned char)(px >> 8), (unsigned char)(px >> 16), (unsigned char)(px >> 24) };
+			if (out_channels == 4 || x + 1 < width)
+				memcpy(dst, bytes, 4);
+			else
+				memcpy(dst, bytes, 3);
+		}
+	}
+	return true;
+}
+
+static bool DecodeStripe(const unsigned char* in, size_t size, unsigned int width, unsigned int rows, unsigned char* first_row, ptrdiff_t stride, unsigned int out_channels)
+{
+	if (out_channels == 4)
+		return DecodeStripe<4>(in, size, width, rows, first_row, stride);
+	return DecodeStripe<3>(in, size, width, rows, first_row, stride);
+}
+
+bool DecodeQOI(const unsigned char* in, size_t size, unsigned char* out, unsigned int out_channels, bool flip_y)
+{
+	unsigned int width, height, channels;
+	if ((out_channels != 3 && out_channels != 4) || !ReadQOIHeader(in, size, width, height, channels))
+		return false;
+
+	ptrdiff_t stride = (ptrdiff_t)width * out_channels;
+	unsigned char* first_row = flip_y ? out + (height - 1) * stride : out;
+	if (flip_y)
+		stride = -stride;
+	if (in[3] == 'f')
+		return DecodeStripe(in, size, width, height, first_row, stride, out_channels);
+
+	// Container: the stripes must cover the image exactly and fit in the file
+	if (size < QOI_CONTAINER_HEADER_SIZE)
+		return false;
+	unsigned int stripes = Read32(in + 14);
+	if (stripes == 0 || stripes > height || (size - QOI_CONTAINER_HEADER_SIZE) / 4 < stripes)
+		return false;
+
+	std::vector<size_t> offsets(stripes + 1);
+	std::vector<unsigned int> starts(stripes + 1);
+	offsets[0] = QOI_CONTAINER_HEADER_SIZE + (size_t)stripes * 4;
+	starts[0] = 0;
+	for (unsigned int i = 0; i < stripes; ++i)
+	{
+		const unsigned char* stripe = in + offsets[i];
+		size_t stripe_size = Read32(in + QOI_CONTAINER_HEADER_SIZE + i * 4);
+		if (stripe_size < QOI_HEADER_SIZE || stripe_size > size - offsets[i])
+			return false;
+		offsets[i + 1] = offsets[i] + stripe_size;
+		starts[i + 1] = starts[i] + Read32(stripe + 8);
+		if (starts[i + 1] <= starts[i] || starts[i + 1] > height)
+			return false;
+	}
+	if (starts[stripes] != height)
+		return false;
+
+	std::vector<char> decoded(stripes);
+	parallelFor(0, (int)stripes, [&](int i) {
+		decoded[i] = DecodeStripe(in + offsets[i], offsets[i + 1] - offsets[i], width, starts[i + 1] - starts[i], first_row + starts[i] * stride, stride, out_channels);
+	});
+	return std::find(decoded.begin(), decoded.end(), 0) == decoded.end();
+}
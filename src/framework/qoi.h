@@ -0,0 +1,26 @@
+/*
+	QOI images (https://qoiformat.org), lossless and much faster than PNG to write and read. Meant for the images
+	dumped while debugging and for caches, not for the final assets.
+	Big images can also be written in stripes: every stripe is a complete QOI image of some rows, so they are
+	encoded and decoded in parallel. The stripes are kept in a small container that only this code reads:
+	"qoiS", width, height, channels, colorspace, number of stripes and the size of every stripe (32 bits big endian).
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Stripes of about a megabyte of RGBA are enough to keep all the threads busy
+#define QOI_PIXELS_PER_STRIPE (1 << 18)
+
+// Encodes tightly packed RGB (3 channels) or RGBA (4) rows. With flip_y the first row of 'pixels' is the bottom one.
+// A single stripe is a standard .qoi file, more stripes use the container
+bool EncodeQOI(std::vector<unsigned char>& out, const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int channels, unsigned int stripes = 1, bool flip_y = false);
+
+// Size and channels of a .qoi file or a container, false if 'in' is neither
+bool ReadQOIHeader(const unsigned char* in, size_t size, unsigned int& width, unsigned int& height, unsigned int& channels);
+
+// Decodes into 'out' (width * height * out_channels bytes, 3 or 4 channels, alpha is dropped or set to 255).
+// The stripes of a container are decoded in parallel. Returns false if the data is damaged
+bool DecodeQOI(const unsigned char* in, size_t size, unsigned char* out, unsigned int out_channels, bool flip_y = false);
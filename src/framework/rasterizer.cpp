@@ -0,0 +1,476 @@
+#include "rasterizer.h"
+
+#include <cfloat>
+#include <stdint.h>
+#include <algorithm>
+
+// Outcodes of a clip space vertex
+enum {
+	CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_BOTTOM = 4, CLIP_TOP = 8, CLIP_NEAR = 16, CLIP_FAR = 32,
+	GUARD_LEFT = 64, GUARD_RIGHT = 128, GUARD_BOTTOM = 256, GUARD_TOP = 512,
+	CLIP_VIEWPORT = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP | CLIP_NEAR | CLIP_FAR,
+	CLIP_GUARD = GUARD_LEFT | GUARD_RIGHT | GUARD_BOTTOM | GUARD_TOP
+};
+
+// Enough room for a triangle clipped by the near, far and the four guard band planes
+#define MAX_CLIPPED_VERTICES 12
+
+void Rasterizer::Resize(unsigned int width, unsigned int height)
+{
+	depth_buffer.Resize(width, height);
+	visibility_buffer.Resize(width, height);
+	Clear();
+}
+
+void Rasterizer::Clear()
+{
+	depth_buffer.Fill(FLT_MAX);
+	visibility_buffer.Fill(EMPTY_ID);
+	vertices.clear();
+	instances.clear();
+}
+
+unsigned int Rasterizer::BeginInstance(unsigned int num_vertices, const Vector3* object_vertices, const Matrix44& mvp)
+{
+	if (instances.size() >= MAX_INSTANCES || num_vertices / 3 > TRIANGLE_MASK + 1)
+	{
+		std::cerr << "Rasterizer: too many instances or triangles for the visibility buffer" << std::endl;
+		return EMPTY_ID;
+	}
+
+	sInstance instance;
+	instance.object_vertices = object_vertices;
+	instance.first = (unsigned int)vertices.size();
+	instance.mvp = mvp;
+	instances.push_back(instance);
+
+	if (!object_vertices)
+		vertices.resize(vertices.size() + (num_vertices / 3) * 3);
+	return (unsigned int)instances.size() - 1;
+}
+
+Vector4 Rasterizer::ToHomogeneousPixel(const Vector4& c) const
+{
+	return Vector4((c.x + c.w) * depth_buffer.width * 0.5f, (c.y + c.w) * depth_buffer.height * 0.5f, c.z, c.w);
+}
+
+unsigned int Rasterizer::AddInstance(const Vector4* new_vertices, unsigned int num_vertices)
+{
+	unsigned int instance = BeginInstance(num_vertices, NULL, Matrix44());
+	if (instance == EMPTY_ID)
+		return EMPTY_ID;
+
+	unsigned int first = instances[instance].first;
+	unsigned int num_triangles = num_vertices / 3;
+
+	// Back to homogeneous coordinates using w = 1 / (1/w)
+	for (unsigned int i = 0; i < num_triangles * 3; ++i)
+	{
+		const Vector4& v = new_vertices[i];
+		float w = v.w != 0.0f ? 1.0f / v.w : 1.0f;
+		vertices[first + i].Set(v.x * w, v.y * w, v.z * w, w);
+	}
+
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		const Vector4* v = &new_vertices[i * 3];
+		RasterizeTriangle(v[0], v[1], v[2], PackID(instance, i));
+	}
+
+	return instance;
+}
+
+unsigned int Rasterizer::AddInstance(const Vector3* new_vertices, unsigned int num_vertices)
+{
+	std::vector<Vector4> temp(num_vertices);
+	for (unsigned int i = 0; i < num_vertices; ++i)
+		temp[i].Set(new_vertices[i].x, new_vertices[i].y, new_vertices[i].z, 1.0f);
+	return AddInstance(temp.empty() ? NULL : &temp[0], num_vertices);
+}
+
+unsigned int Rasterizer::DrawInstance(const Vector3* object_vertices, unsigned int num_vertices, const Matrix44& mvp, bool cull_back_faces)
+{
+	unsigned int instance = BeginInstance(num_vertices, object_vertices, mvp);
+	if (instance == EMPTY_ID)
+		return EMPTY_ID;
+
+	unsigned int num_triangles = num_vertices / 3;
+
+	// Project all the vertices to clip space, once per vertex
+	clip_vertices.resize(num_triangles * 3);
+	if (num_triangles)
+		TransformPoints(mvp, object_vertices, &clip_vertices[0], num_triangles * 3);
+
+	// Batched back face culling: the sign of det[x y w] gives the facing in clip space,
+	// it is valid even when some vertices are behind the camera
+	front_triangles.clear();
+	for (unsigned int i = 0; i < num_triangles; ++i)
+	{
+		const Vector4* c = &clip_vertices[i * 3];
+		if (cull_back_faces)
+		{
+			float det = c[0].x * (c[1].y * c[2].w - c[2].y * c[1].w)
+				- c[1].x * (c[0].y * c[2].w - c[2].y * c[0].w)
+				+ c[2].x * (c[0].y * c[1].w - c[1].y * c[0].w);
+			if (det <= 0.0f)
+				continue;
+		}
+		front_triangles.push_back(i);
+	}
+
+	for (size_t i = 0; i < front_triangles.size(); ++i)
+	{
+		unsigned int triangle = front_triangles[i];
+		ClipAndRasterize(&clip_vertices[triangle * 3], PackID(instance, triangle));
+	}
+
+	return instance;
+}
+
+unsigned int Rasterizer::DrawInstanced(const Vector3* object_vertices, unsigned int num_vertices, const Matrix44* models, unsigned int count, const Matrix44& viewprojection, bool cull_back_faces)
+{
+	if (count == 0 || instances.size() + count > MAX_INSTANCES)
+	{
+		if (count)
+			std::cerr << "Rasterizer: too many instances for the visibility buffer" << std::endl;
+		return EMPTY_ID;
+	}
+
+	unsigned int first = (unsigned int)instances.size();
+	for (unsigned int i = 0; i < count; ++i)
+		DrawInstance(object_vertices, num_vertices, viewprojection * models[i], cull_back_faces);
+	return first;
+}
+
+static unsigned int ComputeOutcode(const Vector4& c, float guard_band)
+{
+	unsigned int code = 0;
+	if (c.x < -c.w) code |= CLIP_LEFT;
+	if (c.x > c.w) code |= CLIP_RIGHT;
+	if (c.y < -c.w) code |= CLIP_BOTTOM;
+	if (c.y > c.w) code |= CLIP_TOP;
+	if (c.z < -c.w) code |= CLIP_NEAR;
+	if (c.z > c.w) code |= CLIP_FAR;
+
+	float g = guard_band * c.w;
+	if (c.x < -g) code |= GUARD_LEFT;
+	if (c.x > g) code |= GUARD_RIGHT;
+	if (c.y < -g) code |= GUARD_BOTTOM;
+	if (c.y > g) code |= GUARD_TOP;
+	return code;
+}
+
+// Sutherland-Hodgman step: keeps the part of the polygon where dot(v, plane) >= 0
+static unsigned int ClipPolygon(const Vector4* in, unsigned int count, Vector4* out, const Vector4& plane)
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const Vector4& a = in[i];
+		const Vector4& b = in[(i + 1) % count];
+		float da = a.x * plane.x + a.y * plane.y + a.z * plane.z + a.w * plane.w;
+		float db = b.x * plane.x + b.y * plane.y + b.z * plane.z + b.w * plane.w;
+
+		if (da >= 0.0f)
+			out[n++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+		{
+			// Always interpolate from the inside vertex, so the two triangles sharing this edge
+			// (that walk it in opposite directions) get exactly the same new vertex
+			const Vector4& from = da >= 0.0f ? a : b;
+			const Vector4& to = da >= 0.0f ? b : a;
+			float d_from = da >= 0.0f ? da : db;
+			float d_to = da >= 0.0f ? db : da;
+			float t = d_from / (d_from - d_to);
+			out[n++] = Vector4(from.x + (to.x - from.x) * t, from.y + (to.y - from.y) * t, from.z + (to.z - from.z) * t, from.w + (to.w - from.w) * t);
+		}
+	}
+	return n;
+}
+
+void Rasterizer::ClipAndRasterize(const Vector4* clip, unsigned int id)
+{
+	unsigned int c0 = ComputeOutcode(clip[0], guard_band);
+	unsigned int c1 = ComputeOutcode(clip[1], guard_band);
+	unsigned int c2 = ComputeOutcode(clip[2], guard_band);
+
+	// All the vertices outside the same plane: nothing to draw
+	if (c0 & c1 & c2 & CLIP_VIEWPORT)
+		return;
+
+	Vector4 polygon[2][MAX_CLIPPED_VERTICES];
+	unsigned int count = 3;
+	int current = 0;
+	polygon[0][0] = clip[0]; polygon[0][1] = clip[1]; polygon[0][2] = clip[2];
+
+	// Only near and far are always clipped, the side planes just when leaving the guard band
+	unsigned int to_clip = (c0 | c1 | c2) & (CLIP_NEAR | CLIP_FAR | CLIP_GUARD);
+	if (to_clip)
+	{
+		const float g = guard_band;
+		const unsigned int plane_bits[6] = { CLIP_NEAR, CLIP_FAR, GUARD_LEFT, GUARD_RIGHT, GUARD_BOTTOM, GUARD_TOP };
+		const Vector4 planes[6] = {
+			Vector4(0, 0, 1, 1), Vector4(0, 0, -1, 1),
+			Vector4(1, 0, 0, g), Vector4(-1, 0, 0, g),
+			Vector4(0, 1, 0, g), Vector4(0, -1, 0, g)
+		};
+		for (int p = 0; p < 6 && count >= 3; ++p)
+		{
+			// The vertices created on the near and far planes get their own guard band outcodes,
+			// so a rounding error in the interpolation cannot let one reach the fixed point setup outside the band
+			if (p == 2 && (to_clip & (CLIP_NEAR | CLIP_FAR)))
+				for (unsigned int i = 0; i < count; ++i)
+					to_clip |= ComputeOutcode(polygon[current][i], g) & CLIP_GUARD;
+			if (!(to_clip & plane_bits[p]))
+				continue;
+			count = ClipPolygon(polygon[current], count, polygon[1 - current], planes[p]);
+			current = 1 - current;
+		}
+		if (count < 3)
+			return;
+	}
+
+	// Perspective divide and viewport transform
+	float half_width = depth_buffer.width * 0.5f;
+	float half_height = depth_buffer.height * 0.5f;
+	Vector4 screen[MAX_CLIPPED_VERTICES];
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const Vector4& c = polygon[current][i];
+		float inv_w = 1.0f / c.w;
+		screen[i].Set((c.x * inv_w + 1.0f) * half_width, (c.y * inv_w + 1.0f) * half_height, c.z * inv_w, inv_w);
+	}
+
+	// The clipped polygon is convex, draw it as a fan
+	for (unsigned int i = 1; i + 1 < count; ++i)
+		RasterizeTriangle(screen[0], screen[i], screen[i + 1], id);
+}
+
+// Signed doubled area of the triangle a,b,p (positive if counter clockwise)
+static inline float EdgeFunction(const Vector4& a, const Vector4& b, float px, float py)
+{
+	return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+static inline bool IsFinite(const Vector4& v)
+{
+	return std::isfinite(v.x) && std::isfinite(v.y);
+}
+
+void Rasterizer::RasterizeTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2, unsigned int id)
+{
+	// Triangles added in screen space are not clipped, a NaN or infinite position can not be converted to integers
+	if (!IsFinite(v0) || !IsFinite(v1) || !IsFinite(v2))
+		return;
+
+	if (mode == FIXED_POINT)
+	{
+		RasterizeTriangleFixed(v0, v1, v2, id);
+		return;
+	}
+
+	float area = EdgeFunction(v0, v1, v2.x, v2.y);
+	if (area == 0.0f)
+		return;
+	float inv_area = 1.0f / area;
+
+	// Bounding box of the triangle clamped to the buffer (before the casts, so huge coordinates stay in range)
+	int min_x = (int)floorf(clamp(std::min(v0.x, std::min(v1.x, v2.x)), 0.0f, (float)depth_buffer.width));
+	int min_y = (int)floorf(clamp(std::min(v0.y, std::min(v1.y, v2.y)), 0.0f, (float)depth_buffer.height));
+	int max_x = (int)ceilf(clamp(std::max(v0.x, std::max(v1.x, v2.x)), -1.0f, (float)depth_buffer.width - 1));
+	int max_y = (int)ceilf(clamp(std::max(v0.y, std::max(v1.y, v2.y)), -1.0f, (float)depth_buffer.height - 1));
+
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		float py = y + 0.5f;
+		float* depth_row = depth_buffer.pixels + y * depth_buffer.width;
+		unsigned int* id_row = visibility_buffer.pixels + y * visibility_buffer.width;
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			float px = x + 0.5f;
+			float w0 = EdgeFunction(v1, v2, px, py) * inv_area;
+			float w1 = EdgeFunction(v2, v0, px, py) * inv_area;
+			float w2 = 1.0f - w0 - w1;
+			if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+				continue;
+
+			// Screen space depth is linear, no need to correct it
+			float z = w0 * v0.z + w1 * v1.z + w2 * v2.z;
+			if (z >= depth_row[x])
+				continue;
+			depth_row[x] = z;
+			id_row[x] = id;
+		}
+	}
+}
+
+// Integer edge function a->b in fixed point: e(p) = A * p.x + B * p.y + C, positive on the left side.
+// 64 bits are needed as the products of two 28.4 coordinates inside the guard band go beyond 32 bits
+struct sFixedEdge
+{
+	int64_t A, B, C;
+	int64_t bias; // 0 if the pixels exactly on the edge belong to this triangle, -1 if not
+
+	void Setup(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+	{
+		A = ay - by;
+		B = bx - ax;
+		C = ax * by - ay * bx;
+
+		// Top-left rule (counter clockwise, y up): left edges go down, top edges go left.
+		// A shared edge is walked in opposite directions by its two triangles, so only one of them owns it
+		bool top_left = (by < ay) || (by == ay && bx < ax);
+		bias = top_left ? 0 : -1;
+	}
+
+	int64_t Evaluate(int64_t x, int64_t y) const { return A * x + B * y + C + bias; }
+};
+
+// Clamped to +-2^24 pixels, so the products of the edge setup and evaluation still fit in 64 bits
+static inline int64_t SnapToFixed(float v)
+{
+	const float limit = (float)(1 << 28);
+	return (int64_t)clamp(floorf(v * Rasterizer::SUBPIXEL_STEPS + 0.5f), -limit, limit);
+}
+
+void Rasterizer::RasterizeTriangleFixed(const Vector4& v0, const Vector4& v1, const Vector4& v2, unsigned int id)
+{
+	const int64_t one = SUBPIXEL_STEPS;
+	const int64_t half = SUBPIXEL_STEPS / 2;
+
+	int64_t x0 = SnapToFixed(v0.x), y0 = SnapToFixed(v0.y);
+	int64_t x1 = SnapToFixed(v1.x), y1 = SnapToFixed(v1.y);
+	int64_t x2 = SnapToFixed(v2.x), y2 = SnapToFixed(v2.y);
+	const Vector4* p0 = &v0;
+	const Vector4* p1 = &v1;
+	const Vector4* p2 = &v2;
+
+	// Both windings are accepted (culling is done before), make it counter clockwise
+	int64_t area = (x1 - x0) * (y2 - y0) - (y1 - y0) * (x2 - x0);
+	if (area == 0)
+		return;
+	if (area < 0)
+	{
+		std::swap(x1, x2); std::swap(y1, y2); std::swap(p1, p2);
+		area = -area;
+	}
+
+	// Edge i is the one in front of vertex i, its value is the weight of that vertex (times the area)
+	sFixedEdge edges[3];
+	edges[0].Setup(x1, y1, x2, y2);
+	edges[1].Setup(x2, y2, x0, y0);
+	edges[2].Setup(x0, y0, x1, y1);
+
+	// Bounding box of the pixel centers (x * 16 + 8) inside the triangle, clamped to the buffer
+	int64_t min_fx = std::min(x0, std::min(x1, x2)), max_fx = std::max(x0, std::max(x1, x2));
+	int64_t min_fy = std::min(y0, std::min(y1, y2)), max_fy = std::max(y0, std::max(y1, y2));
+	int min_x = (int)std::max<int64_t>(0, (min_fx - half + one - 1) / one);
+	int min_y = (int)std::max<int64_t>(0, (min_fy - half + one - 1) / one);
+	int max_x = (int)std::min<int64_t>((int64_t)depth_buffer.width - 1, (max_fx - half) >> SUBPIXEL_BITS);
+	int max_y = (int)std::min<int64_t>((int64_t)depth_buffer.height - 1, (max_fy - half) >> SUBPIXEL_BITS);
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	float inv_area = 1.0f / (float)area;
+	float z0 = p0->z, z1 = p1->z, z2 = p2->z;
+
+	// Walk the bounding box in 8x8 blocks aligned to the buffer
+	const int64_t block_step = (BLOCK_SIZE - 1) * one;
+	for (int block_y = min_y & ~(BLOCK_SIZE - 1); block_y <= max_y; block_y += BLOCK_SIZE)
+	{
+		for (int block_x = min_x & ~(BLOCK_SIZE - 1); block_x <= max_x; block_x += BLOCK_SIZE)
+		{
+			// Edge functions are linear, so their extremes in the block are at two of its corners
+			int64_t bx = block_x * one + half, by = block_y * one + half;
+			bool reject = false, accept = true;
+			for (int i = 0; i < 3 && !reject; ++i)
+			{
+				const sFixedEdge& e = edges[i];
+				int64_t origin = e.Evaluate(bx, by);
+				int64_t dx = e.A * block_step, dy = e.B * block_step;
+				int64_t emax = origin + std::max<int64_t>(dx, 0) + std::max<int64_t>(dy, 0);
+				int64_t emin = origin + std::min<int64_t>(dx, 0) + std::min<int64_t>(dy, 0);
+				if (emax < 0)
+					reject = true;
+				if (emin < 0)
+					accept = false;
+			}
+			if (reject)
+				continue;
+
+			int start_x = std::max(block_x, min_x), end_x = std::min(block_x + BLOCK_SIZE - 1, max_x);
+			int start_y = std::max(block_y, min_y), end_y = std::min(block_y + BLOCK_SIZE - 1, max_y);
+
+			// Incremental evaluation: one add per edge and pixel
+			int64_t px = start_x * one + half, py = start_y * one + half;
+			int64_t row_w0 = edges[0].Evaluate(px, py);
+			int64_t row_w1 = edges[1].Evaluate(px, py);
+			int64_t row_w2 = edges[2].Evaluate(px, py);
+			const int64_t step_x0 = edges[0].A * one, step_x1 = edges[1].A * one, step_x2 = edges[2].A * one;
+			const int64_t step_y0 = edges[0].B * one, step_y1 = edges[1].B * one, step_y2 = edges[2].B * one;
+
+			for (int y = start_y; y <= end_y; ++y)
+			{
+				float* depth_row = depth_buffer.pixels + y * depth_buffer.width;
+				unsigned int* id_row = visibility_buffer.pixels + y * visibility_buffer.width;
+				int64_t w0 = row_w0, w1 = row_w1, w2 = row_w2;
+				for (int x = start_x; x <= end_x; ++x)
+				{
+					if (accept || (w0 | w1 | w2) >= 0)
+					{
+						// The bias is removed to get the exact weights, screen space depth is linear
+						float z = ((w0 - edges[0].bias) * z0 + (w1 - edges[1].bias) * z1 + (w2 - edges[2].bias) * z2) * inv_area;
+						if (z < depth_row[x])
+						{
+							depth_row[x] = z;
+							id_row[x] = id;
+						}
+					}
+					w0 += step_x0; w1 += step_x1; w2 += step_x2;
+				}
+				row_w0 += step_y0; row_w1 += step_y1; row_w2 += step_y2;
+			}
+		}
+	}
+}
+
+bool Rasterizer::GetSample(unsigned int x, unsigned int y, sVisibilitySample& sample) const
+{
+	unsigned int id = visibility_buffer.GetPixel(x, y);
+	if (id == EMPTY_ID)
+		return false;
+
+	sample.x = x;
+	sample.y = y;
+	sample.instance = id >> TRIANGLE_BITS;
+	sample.triangle = id & TRIANGLE_MASK;
+	sample.depth = depth_buffer.GetPixel(x, y);
+
+	// Homogeneous rasterization: the weights of the pixel ray p = (px, py, 1) are
+	// adj([v0 v1 v2]) * p using the (x, y, w) of every vertex, normalized to add 1
+	const sInstance& instance = instances[sample.instance];
+	Vector4 v[3];
+	if (instance.object_vertices)
+	{
+		const Vector3* o = instance.object_vertices + sample.triangle * 3;
+		for (int i = 0; i < 3; ++i)
+			v[i] = ToHomogeneousPixel(instance.mvp * Vector4(o[i].x, o[i].y, o[i].z, 1.0f));
+	}
+	else
+	{
+		for (int i = 0; i < 3; ++i)
+			v[i] = vertices[instance.first + sample.triangle * 3 + i];
+	}
+
+	Vector3 a(v[0].x, v[0].y, v[0].w), b(v[1].x, v[1].y, v[1].w), c(v[2].x, v[2].y, v[2].w);
+	Vector3 p(x + 0.5f, y + 0.5f, 1.0f);
+	float w0 = b.Cross(c).Dot(p);
+	float w1 = c.Cross(a).Dot(p);
+	float w2 = a.Cross(b).Dot(p);
+	float sum = w0 + w1 + w2;
+	if (sum != 0.0f)
+		sample.barycentric.Set(w0 / sum, w1 / sum, w2 / sum);
+	else
+		sample.barycentric.Set(w0, w1, w2);
+	return true;
+}
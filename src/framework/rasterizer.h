@@ -0,0 +1,130 @@
+/*
+	This class renders triangles into an Image using only the CPU.
+	In visibility buffer mode the work is split in two passes: the first one only stores the depth and
+	the id of the closest triangle of every pixel, the second one shades every visible pixel exactly once.
+*/
+
+#pragma once
+
+#include <vector>
+#include "framework.h"
+#include "image.h"
+#include "utils.h"
+
+// Everything the shading callback needs to know about a visible pixel
+struct sVisibilitySample
+{
+	unsigned int x, y;			// Pixel position
+	unsigned int instance;		// Index returned by AddInstance
+	unsigned int triangle;		// Triangle inside the instance (vertices 3*triangle .. 3*triangle+2)
+	Vector3 barycentric;		// Perspective correct weights of the 3 vertices
+	float depth;
+};
+
+class Rasterizer
+{
+public:
+	// A visibility id packs the instance in the high bits and the triangle in the low ones
+	static const unsigned int TRIANGLE_BITS = 20;
+	static const unsigned int TRIANGLE_MASK = (1u << TRIANGLE_BITS) - 1;
+	static const unsigned int MAX_INSTANCES = (1u << (32 - TRIANGLE_BITS)) - 1;
+	static const unsigned int EMPTY_ID = 0xFFFFFFFF;
+
+	FloatImage depth_buffer;
+	UIntImage visibility_buffer;
+
+	// Triangles are only clipped against the side planes when they go beyond this many viewports
+	// (in NDC units). Inside the guard band the rasterizer bounding box does the clipping for free.
+	float guard_band;
+
+	// How the triangles are scanned:
+	// FIXED_POINT snaps the vertices to 1/16 of pixel (28.4) and uses integer edge functions with a top-left
+	// fill rule, so triangles sharing an edge never leave gaps or touch the same pixel twice (the default).
+	// FLOAT_EDGES evaluates the edge functions in floats, pixels on a shared edge can be lost or drawn twice.
+	enum { FIXED_POINT, FLOAT_EDGES };
+	char mode;
+
+	// Fixed point precision and size of the blocks that are accepted or rejected at once
+	static const int SUBPIXEL_BITS = 4;
+	static const int SUBPIXEL_STEPS = 1 << SUBPIXEL_BITS;
+	static const int BLOCK_SIZE = 8;
+
+	Rasterizer() { guard_band = 8.0f; mode = FIXED_POINT; }
+	Rasterizer(unsigned int width, unsigned int height) { guard_band = 8.0f; mode = FIXED_POINT; Resize(width, height); }
+
+	void Resize(unsigned int width, unsigned int height);
+
+	// Resets depth, ids and the stored instances, call it at the start of every frame
+	void Clear();
+
+	// Pass 1: rasterizes a list of triangles (3 vertices each) already in screen space:
+	// x,y in pixels, z depth (smaller is closer) and w = 1/w_clip for perspective correction (1 if unknown).
+	// Returns the instance index or EMPTY_ID if the buffer can not store more instances.
+	unsigned int AddInstance(const Vector4* vertices, unsigned int num_vertices);
+	unsigned int AddInstance(const Vector3* vertices, unsigned int num_vertices);
+
+	// Full geometry pipeline: projects the object space vertices with mvp (projection * view * model),
+	// culls back faces (counter clockwise is front), clips against the near and far planes in clip space
+	// and rejects the triangles outside the viewport. Same return value as AddInstance.
+	// The vertices are not copied, they must stay alive until the resolve pass.
+	unsigned int DrawInstance(const Vector3* vertices, unsigned int num_vertices, const Matrix44& mvp, bool cull_back_faces = true);
+
+	// Draws 'count' copies of the same vertices, one per model matrix. They get consecutive instance
+	// indices starting at the returned one, so sample.instance - first indexes per instance data (colors...).
+	unsigned int DrawInstanced(const Vector3* vertices, unsigned int num_vertices, const Matrix44* models, unsigned int count, const Matrix44& viewprojection, bool cull_back_faces = true);
+
+	static unsigned int PackID(unsigned int instance, unsigned int triangle) { return (instance << TRIANGLE_BITS) | triangle; }
+
+	// Rebuilds the sample of the pixel x,y from the visibility buffer, false if nothing covers it
+	bool GetSample(unsigned int x, unsigned int y, sVisibilitySample& sample) const;
+
+	// Pass 2: calls shade(const sVisibilitySample&) once for every covered pixel and writes the returned
+	// Color in the framebuffer. Tiles of tile_size x tile_size pixels are shaded in parallel.
+	template <typename F>
+	void Resolve(Image& framebuffer, F shade, unsigned int tile_size = 32) const;
+
+protected:
+	// Barycentrics are rebuilt from the vertices in homogeneous pixel space: screen position is (x/w, y/w),
+	// depth z/w. This also works for triangles that crossed the near plane.
+	struct sInstance
+	{
+		const Vector3* object_vertices;	// Projected again with mvp when shading, NULL if stored in 'vertices'
+		unsigned int first;				// First vertex in 'vertices'
+		Matrix44 mvp;
+	};
+	std::vector<sInstance> instances;
+	std::vector<Vector4> vertices;		// Homogeneous vertices of the instances added in screen space
+
+	// Scratch buffers of DrawInstance, kept to avoid allocations every frame
+	std::vector<Vector4> clip_vertices;
+	std::vector<unsigned int> front_triangles;
+
+	unsigned int BeginInstance(unsigned int num_vertices, const Vector3* object_vertices, const Matrix44& mvp);
+	Vector4 ToHomogeneousPixel(const Vector4& clip) const;
+	void ClipAndRasterize(const Vector4* clip, unsigned int id);
+	void RasterizeTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2, unsigned int id);
+	void RasterizeTriangleFixed(const Vector4& v0, const Vector4& v1, const Vector4& v2, unsigned int id);
+};
+
+template <typename F>
+void Rasterizer::Resolve(Image& framebuffer, F shade, unsigned int tile_size) const
+{
+	unsigned int width = std::min(framebuffer.width, visibility_buffer.width);
+	unsigned int height = std::min(framebuffer.height, visibility_buffer.height);
+	unsigned int tiles_x = (width + tile_size - 1) / tile_size;
+	unsigned int tiles_y = (height + tile_size - 1) / tile_size;
+
+	// Tiles never overlap, so every thread writes its own pixels of the framebuffer
+	parallelFor(0, (int)(tiles_x * tiles_y), [&](int tile) {
+		unsigned int start_x = (tile % tiles_x) * tile_size;
+		unsigned int start_y = (tile / tiles_x) * tile_size;
+		unsigned int end_x = std::min(start_x + tile_size, width);
+		unsigned int end_y = std::min(start_y + tile_size, height);
+
+		sVisibilitySample sample;
+		for (unsigned int y = start_y; y < end_y; ++y)
+			for (unsigned int x = start_x; x < end_x; ++x)
+				if (GetSample(x, y, sample))
+					framebuffer.SetPixelUnsafe(x, y, shade(sample));
+	});
+}
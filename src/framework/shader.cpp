@@ -418,7 +418,7 @@ int Shader::GetUniformLocation(const char* varname)
 void Shader::SetTexture(const char* varname, Texture* tex)
 {
 	glActiveTexture(GL_TEXTURE0 + last_slot);
-	glBindTexture(GL_TEXTURE_2D, tex->texture_id);
+	glBindTexture(GL_TEXTURE_2D, tex->GetId()); // Keeps it in the cache (and reloads it if it was evicted)
 	SetUniform1(varname, last_slot);
 	last_slot++;
 	glActiveTexture(GL_TEXTURE0 + last_slot);
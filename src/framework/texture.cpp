@@ -1,11 +1,21 @@
 #include "texture.h"
 #include "utils.h"
 #include "image.h"
+#include "tga.h"
+#include "../extra/picopng.h"
 
 #include <iostream> //to output
 #include <cmath>
+#include <algorithm>
 
 std::map<std::string, Texture*> Texture::s_Textures;
+size_t Texture::s_BudgetBytes = 0;
+unsigned int Texture::s_EvictAfterFrames = 60;
+size_t Texture::s_UsedBytes = 0;
+unsigned int Texture::s_Frame = 0;
+MipChain::eMipFilter Texture::s_MipmapFilter = MipChain::MIPFILTER_BOX;
+bool Texture::s_MipmapCache = false;
+bool Texture::s_CompressTextures = false;
 
 Texture::Texture()
 {
@@ -15,6 +25,10 @@ Texture::Texture()
 	wrapS = wrapT = GL_CLAMP_TO_EDGE;
 	mipmaps = false;
 	type = GL_UNSIGNED_BYTE;
+	texture_id = 0;
+	bytes = 0;
+	last_used_frame = 0;
+	evicted = false;
 }
 
 Texture* Texture::Get(const char* filename)
@@ -22,22 +36,80 @@ Texture* Texture::Get(const char* filename)
 	std::string name = std::string(filename);
 	std::map<std::string, Texture*>::iterator it = s_Textures.find(name);
 	if (it != s_Textures.end())
-		return it->second;
+	{
+		Texture* texture = it->second;
+		if (texture->evicted && !texture->Reload())
+			return NULL;
+		texture->last_used_frame = s_Frame;
+		return texture;
+	}
 
 	Texture* texture = new Texture();
 	if (!texture->Load(filename))
+	{
+		delete texture;
 		return NULL;
+	}
+	texture->name = name;
+	texture->last_used_frame = s_Frame;
 	s_Textures[name] = texture;
 	return texture;
 }
 
+bool Texture::Reload()
+{
+	evicted = !Load(name.c_str(), mipmaps);
+	if (!evicted)
+		return true;
+	std::cerr << "Error reloading evicted texture: " << name << std::endl;
+	return false;
+}
+
+void Texture::NewFrame()
+{
+	s_Frame++;
+	if (s_BudgetBytes && s_UsedBytes > s_BudgetBytes)
+		EvictUnused();
+}
+
+void Texture::EvictUnused()
+{
+	// Candidates: textures of the cache that have not been used recently, oldest first
+	std::vector<Texture*> candidates;
+	for (std::map<std::string, Texture*>::iterator it = s_Textures.begin(); it != s_Textures.end(); ++it)
+	{
+		Texture* texture = it->second;
+		if (!texture->evicted && texture->texture_id != 0 && s_Frame - texture->last_used_frame >= s_EvictAfterFrames)
+			candidates.push_back(texture);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Texture* a, const Texture* b) {
+		return a->last_used_frame < b->last_used_frame;
+	});
+
+	// Not through Clear, that disables GL_TEXTURE_2D and unbinds, and this can be called in the middle of a frame
+	for (size_t i = 0; i < candidates.size() && s_UsedBytes > s_BudgetBytes; ++i)
+	{
+		Texture* texture = candidates[i];
+		glDeleteTextures(1, &texture->texture_id);
+		texture->texture_id = 0;
+		texture->SetBytes(0);
+		texture->evicted = true;
+	}
+}
+
+void Texture::SetBytes(size_t bytes)
+{
+	s_UsedBytes = s_UsedBytes - this->bytes + bytes;
+	this->bytes = bytes;
+}
+
 void Texture::Create(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format, unsigned int wrap)
 {
 	this->width = (float)width;
 	this->height = (float)height;
 	this->format = format;
 	this->type = type;
-	this->mipmaps = mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height) && format != GL_DEPTH_COMPONENT;
+	this->mipmaps = mipmaps && format != GL_DEPTH_COMPONENT;
 	this->wrapS = this->wrapT = wrap;
 
 	//Delete previous texture and ensure that previous bounded texture_id is not of another texture type
@@ -58,47 +130,191 @@ void Texture::Create(unsigned int width, unsigned int height, unsigned int forma
 //uploads the bytes of a texture to the VRAM
 void Texture::Upload(unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 {
+	this->mipmaps = mipmaps;
+
+	// 8 bit color textures get all their levels from the CPU, the rest from the driver (GenerateMipmaps)
+	unsigned int channels = (format == GL_RGB || format == GL_BGR) ? 3 : ((format == GL_RGBA || format == GL_BGRA) ? 4 : 0);
+
+	// Block compressed on the CPU, cached next to the file it comes from
+	if (data && s_CompressTextures && type == GL_UNSIGNED_BYTE && (format == GL_RGB || format == GL_RGBA) && GLEW_EXT_texture_compression_s3tc)
+	{
+		unsigned int w = (unsigned int)width, h = (unsigned int)height;
+		std::string cache_filename = filename + ".bcn";
+		bool use_cache = !filename.empty();
+		unsigned long long key = use_cache ? hashBytes(data, w * h * channels) : 0;
+
+		CompressedChain compressed;
+		if (!use_cache || !compressed.Load(cache_filename, key) || compressed.levels[0].width != w || compressed.levels[0].height != h ||
+			compressed.format != (channels == 4 ? BLOCK_BC3 : BLOCK_BC1) || (compressed.levels.size() > 1) != mipmaps)
+		{
+			compressed.Compress(data, w, h, channels, mipmaps);
+			if (use_cache)
+				compressed.Save(cache_filename, key);
+		}
+		UploadCompressed(compressed);
+		return;
+	}
+
+	if (data && mipmaps && type == GL_UNSIGNED_BYTE && channels)
+	{
+		unsigned int w = (unsigned int)width, h = (unsigned int)height;
+		std::string cache_filename = filename + ".mips";
+		bool use_cache = s_MipmapCache && !filename.empty();
+		unsigned long long key = use_cache ? hashBytes(data, w * h * channels) : 0;
+
+		MipChain chain;
+		if (!use_cache || !chain.Load(cache_filename, key) || chain.channels != channels || chain.levels[0].width != w || chain.levels[0].height != h)
+		{
+			chain.Build(data, w, h, channels, s_MipmapFilter, true);
+			if (use_cache)
+				chain.Save(cache_filename, key);
+		}
+		UploadMipChain(chain, format, internal_format);
+		return;
+	}
+
 	glBindTexture(GL_TEXTURE_2D, texture_id);	// We activate this id to tell opengl we are going to use this texture
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);		// RGB rows are tightly packed, their size is not always a multiple of 4
 
 	glTexImage2D(GL_TEXTURE_2D, 0, internal_format == 0 ? format : internal_format, static_cast<GLsizei>(width), static_cast<GLsizei>(height), 0, format, type, data);
 
+	// Estimated from the data uploaded, the driver may pad it (RGB stored as RGBA...)
+	size_t texel_bytes = (type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT) ? 4 : (type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT || type == GL_SHORT) ? 2 : 1;
+	unsigned int components = channels ? channels : ((format == GL_RG || format == GL_LUMINANCE_ALPHA) ? 2 : 1);
+	size_t level_bytes = (size_t)width * (size_t)height * components * texel_bytes;
+	SetBytes(mipmaps ? level_bytes * 4 / 3 : level_bytes);
+
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);	//set the mag filter
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST); //set the min filter
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
 
-	if (data && this->mipmaps)
+	if (data && mipmaps)
 		GenerateMipmaps();
 
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void Texture::UploadMipChain(const MipChain& chain, unsigned int format, unsigned int internal_format)
+{
+	if (chain.levels.empty())
+		return;
+
+	width = (float)chain.levels[0].width;
+	height = (float)chain.levels[0].height;
+	mipmaps = true;
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (unsigned int l = 0; l < chain.GetNumLevels(); ++l)
+	{
+		const MipChain::sLevel& level = chain.levels[l];
+		glTexImage2D(GL_TEXTURE_2D, l, internal_format == 0 ? format : internal_format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, chain.GetLevelData(l));
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.GetNumLevels() - 1);
+	SetBytes(chain.data.size());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Texture::CreateCompressed(const CompressedChain& chain, unsigned int wrap)
+{
+	if (this->texture_id != 0)
+		Clear();
+	glGenTextures(1, &texture_id);
+
+	format = chain.format == BLOCK_BC3 ? GL_RGBA : GL_RGB;
+	type = GL_UNSIGNED_BYTE;
+	wrapS = wrapT = wrap;
+	UploadCompressed(chain);
+}
+
+void Texture::UploadCompressed(const CompressedChain& chain)
+{
+	if (chain.levels.empty())
+		return;
+
+	width = (float)chain.levels[0].width;
+	height = (float)chain.levels[0].height;
+	mipmaps = chain.levels.size() > 1;
+	unsigned int internal_format = chain.format == BLOCK_BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	for (unsigned int l = 0; l < chain.levels.size(); ++l)
+	{
+		const CompressedChain::sLevel& level = chain.levels[l];
+		glCompressedTexImage2D(GL_TEXTURE_2D, l, internal_format, level.width, level.height, 0, (GLsizei)chain.GetLevelSize(l), chain.GetLevelData(l));
+	}
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)chain.levels.size() - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+	SetBytes(chain.data.size());
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 bool Texture::Load(const char* filename, bool mipmaps)
 {
 	std::string sfullPath = absResPath(filename);
 	std::string ext = sfullPath.substr(sfullPath.size() - 4,4 );
 
 	if (ext == ".tga" || ext == ".TGA") {
-		TGAInfo* tgainfo = LoadTGA(sfullPath.c_str());
-		if (tgainfo == NULL)
+		// Uploaded as BGR(A) in the file order, plain and run length encoded files end up the same
+		std::vector<unsigned char> file_data;
+		if (!readFile(sfullPath, file_data) || file_data.empty())
 			return false;
 
-		this->filename = sfullPath;
-		Create(tgainfo->width, tgainfo->height, tgainfo->bpp == 24 ? GL_BGR : GL_BGRA, GL_UNSIGNED_BYTE, mipmaps, tgainfo->data, (tgainfo->bpp == 24 ? 3 : 4));
+		std::vector<unsigned char> data;
+		unsigned int w = 0, h = 0, channels = 0;
+		TGAHeaderCallback on_header = [&](unsigned int width, unsigned int height, unsigned int c) {
+			w = width;
+			h = height;
+			channels = c;
+			data.resize((size_t)width * height * c);
+			return true;
+		};
+		TGARowCallback on_row = [&](unsigned int y, const unsigned char* row) {
+			memcpy(&data[(size_t)y * w * channels], row, (size_t)w * channels);
+		};
+		if (!DecodeTGA(&file_data[0], file_data.size(), on_header, on_row)) {
+			std::cout << "error decoding TGA: " << sfullPath << std::endl;
+			return false;
+		}
+		std::vector<unsigned char>().swap(file_data);
 
-		delete tgainfo->data;
-		delete tgainfo;
+		this->filename = sfullPath;
+		Create(w, h, channels == 3 ? GL_BGR : GL_BGRA, GL_UNSIGNED_BYTE, mipmaps, &data[0], channels);
 		return true;
 	}
 	else if (ext == ".png" || ext == ".PNG") {
-		Image* image = new Image();
-		if (!image->LoadPNG(filename)) {
-			delete image;
+		// Decoded straight in the upload layout (RGB or RGBA, bottom row first), no intermediate Image
+		std::vector<unsigned char> file_data;
+		if (!readFile(sfullPath, file_data) || file_data.empty())
+			return false;
+
+		std::vector<unsigned char> data;
+		unsigned int w, h, channels;
+		int error = decodePNGNative(data, w, h, channels, &file_data[0], file_data.size(), true);
+		std::vector<unsigned char>().swap(file_data);
+		if (error != 0) {
+			std::cout << "error decoding PNG: " << sfullPath << " (" << error << ")" << std::endl;
 			return false;
 		}
+
 		this->filename = sfullPath;
-		Create(image->width, image->height, image->bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, mipmaps, (Uint8*)image->pixels);
+		Create(w, h, channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, mipmaps, &data[0]);
 		return true;
 	}
 	else {
@@ -109,10 +325,18 @@ bool Texture::Load(const char* filename, bool mipmaps)
 	return false;
 }
 
+GLuint Texture::GetId()
+{
+	if (evicted)
+		Reload();
+	last_used_frame = s_Frame;
+	return texture_id;
+}
+
 void Texture::Bind()
 {
 	glEnable( GL_TEXTURE_2D ); //enable the textures 
-	glBindTexture( GL_TEXTURE_2D, texture_id );	//enable the id of the texture we are going to use
+	glBindTexture( GL_TEXTURE_2D, GetId() );	//enable the id of the texture we are going to use
 }
 
 void Texture::Unbind()
@@ -126,6 +350,7 @@ void Texture::Clear()
 	Unbind();
 	glDeleteTextures(1, &texture_id);
 	texture_id = 0;
+	SetBytes(0);
 }
 
 void Texture::UnbindAll()
@@ -144,63 +369,8 @@ void Texture::GenerateMipmaps()
 		glGenerateMipmapEXT(GL_TEXTURE_2D);
 	}
 	else {
-		// Not using any older method
+		// Not using any older method, without levels the texture can not use a mipmap min filter
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	}
 }
-
-Texture::TGAInfo* Texture::LoadTGA(const char* filename)
-{
-    GLubyte TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    GLubyte TGAcompare[12];
-    GLubyte header[6];
-    GLuint bytesPerPixel;
-    GLuint imageSize;
-    GLuint type = GL_RGBA;
-
-    FILE * file = fopen(filename, "rb");
-    
-    if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-        memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-        fread(header, 1, sizeof(header), file) != sizeof(header))
-    {
-        if (file == NULL)
-            return NULL;
-        else
-        {
-            fclose(file);
-            return NULL;
-        }
-    }
-
-	TGAInfo* tgainfo = new TGAInfo;
-    
-    tgainfo->width = header[1] * 256 + header[0];
-    tgainfo->height = header[3] * 256 + header[2];
-    
-    if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
-    {
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    tgainfo->bpp = header[4];
-    bytesPerPixel = tgainfo->bpp / 8;
-    imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
-    
-    tgainfo->data = (GLubyte*)malloc(imageSize);
-    
-    if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
-    {
-        if (tgainfo->data != NULL)
-            free(tgainfo->data);
-            
-        fclose(file);
-		delete tgainfo;
-        return NULL;
-    }
-    
-    fclose(file);
-
-	return tgainfo;
-}
@@ -5,19 +5,13 @@
 #pragma once
 
 #include "main/includes.h"
+#include "mipmap.h"
+#include "dxt.h"
 #include <map>
 #include <string>
 
 class Texture
 {
-	typedef struct sTGAInfo //a general struct to store all the information about a TGA file
-	{
-		GLuint width;
-		GLuint height;
-		GLuint bpp; //bits per pixel
-		GLubyte* data; //bytes with the pixel information
-	} TGAInfo;
-
 public:
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
@@ -33,8 +27,16 @@ public:
 	unsigned int wrapS;
 	unsigned int wrapT;
 
+	// Cache bookkeeping (see Texture::Get)
+	std::string name;				// Name used to load it with Get, empty if it is not in the cache
+	size_t bytes;					// Estimated memory of the texture with all its levels
+	unsigned int last_used_frame;	// Last frame it was got, bound or given to a shader
+	bool evicted;					// Released to stay in the budget, loaded again by the next Get, Bind or GetId
+
 	Texture();
 	void Create(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0, unsigned int wrap = GL_CLAMP_TO_EDGE);
+	// Id to draw with it: loads it again if it was evicted and marks it as used in this frame
+	GLuint GetId();
 	void Bind();
 	void Unbind();
 	void Clear();
@@ -44,9 +46,38 @@ public:
 	bool Load(const char* filename, bool mipmaps = true);
 	void GenerateMipmaps();
 
+	// Uploads every level of the chain (format GL_RGB, GL_BGRA... with as many channels as the chain)
+	void UploadMipChain(const MipChain& chain, unsigned int format, unsigned int internal_format = 0);
+
+	// Mipmaps of 8 bit RGB(A) textures are built on the CPU with this filter (any size, gamma correct),
+	// the rest are left to the driver. With s_MipmapCache the chains of the textures loaded from files
+	// are saved next to them (".mips") and reused while the pixels do not change.
+	static MipChain::eMipFilter s_MipmapFilter;
+	static bool s_MipmapCache;
+
+	// Block compressed textures (BC1 for RGB, BC3 for RGBA) with all their levels, already compressed on the CPU
+	void CreateCompressed(const CompressedChain& chain, unsigned int wrap = GL_CLAMP_TO_EDGE);
+	void UploadCompressed(const CompressedChain& chain);
+
+	// When the driver supports S3TC, 8 bit RGB(A) data given to Create (and Load) is compressed on the CPU,
+	// using 6 or 4 times less memory. Textures from files cache the blocks next to them (".bcn").
+	static bool s_CompressTextures;
+
+	// Textures loaded with Get are shared and stay in s_Textures. When the cache uses more than s_BudgetBytes
+	// (0 means no limit), the least recently used ones that have not been got or bound in the last
+	// s_EvictAfterFrames frames are released. Their Texture objects stay valid and reload themselves when needed.
 	static Texture* Get(const char* filename);
 	static std::map<std::string, Texture*> s_Textures;
+	static size_t s_BudgetBytes;
+	static unsigned int s_EvictAfterFrames;
+	static size_t s_UsedBytes;		// Memory of all the textures currently created
+	static unsigned int s_Frame;
+
+	// Call once per frame (launchLoop does it), advances the frame counter and evicts if over budget
+	static void NewFrame();
+	static void EvictUnused();
 
 protected:
-	TGAInfo* LoadTGA(const char* filename);
+	void SetBytes(size_t bytes);
+	bool Reload();
 };
\ No newline at end of file
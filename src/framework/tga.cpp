@@ -0,0 +1,201 @@
+#include "tga.h"
+#include "framework.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+bool DecodeTGA(const unsigned char* in, size_t size, const TGAHeaderCallback& on_header, const TGARowCallback& on_row)
+{
+	// Header: id length, color map type, image type, color map (5 bytes), origin (4 bytes), width, height, bits and descriptor
+	if (size < 18 || in[1] != 0 || (in[2] != 2 && in[2] != 10))
+		return false;
+	unsigned int width = in[12] | (in[13] << 8), height = in[14] | (in[15] << 8), bits = in[16];
+	if (width == 0 || height == 0 || (bits != 24 && bits != 32))
+		return false;
+	unsigned int channels = bits / 8;
+	if (!on_header(width, height, channels))
+		return false;
+
+	size_t row_size = (size_t)width * channels, pos = 18 + in[0];
+	if (in[2] == 2)
+	{
+		// Uncompressed, the rows are given straight from the file
+		if (pos > size || (size - pos) / row_size < height)
+			return false;
+		for (unsigned int y = 0; y < height; ++y, pos += row_size)
+			on_row(y, in + pos);
+		return true;
+	}
+
+	// Packets can cross rows in old files, so a packet that does not fit is carried over to the next row
+	std::vector<unsigned char> row(row_size);
+	unsigned int repeat = 0, raw = 0;	// Pixels left in the current packet
+	unsigned char pixel[4] = { 0, 0, 0, 0 };
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		unsigned char* dst = &row[0];
+		unsigned int x = 0;
+		while (x < width)
+		{
+			if (repeat == 0 && raw == 0)
+			{
+				if (pos >= size)
+					return false;
+				unsigned char packet = in[pos++];
+				unsigned int count = (packet & 0x7F) + 1;
+				if (packet & 0x80)
+				{
+					if (size - pos < channels)
+						return false;
+					memcpy(pixel, in + pos, channels);
+					pos += channels;
+					repeat = count;
+				}
+				else
+					raw = count;
+			}
+
+			unsigned int n = std::min(width - x, repeat ? repeat : raw);
+			if (repeat)
+			{
+				for (unsigned int i = 0; i < n; ++i, dst += channels)
+					memcpy(dst, pixel, channels);
+				repeat -= n;
+			}
+			else
+			{
+				size_t bytes = (size_t)n * channels;
+				if (size - pos < bytes)
+					return false;
+				memcpy(dst, in + pos, bytes);
+				dst += bytes;
+				pos += bytes;
+				raw -= n;
+			}
+			x += n;
+		}
+		on_row(y, &row[0]);
+	}
+	return true;
+}
+
+void WriteTGAHeader(unsigned char header[18], unsigned int width, unsigned int height, unsigned int channels, bool rle)
+{
+	memset(header, 0, 18);
+	header[2] = rle ? 10 : 2;
+	header[12] = (unsigned char)width;
+	header[13] = (unsigned char)(width >> 8);
+	header[14] = (unsigned char)height;
+	header[15] = (unsigned char)(height >> 8);
+	header[16] = (unsigned char)(channels * 8);
+	header[17] = channels == 4 ? 8 : 0; // Bits of alpha
+}
+
+static inline bool SamePixel(const unsigned char* a, const unsigned char* b, unsigned int channels)
+{
+	return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && (channels == 3 || a[3] == b[3]);
+}
+
+size_t EncodeTGARowRLE(unsigned char* out, const unsigned char* row, unsigned int width, unsigned int channels)
+{
+	unsigned char* start = out;
+	unsigned int x = 0;
+	while (x < width)
+	{
+		const unsigned char* pixel = row + (size_t)x * channels;
+
+		// Two equal pixels are already shorter as a run packet
+		unsigned int run = 1;
+		while (x + run < width && run < 128 && SamePixel(pixel, pixel + run * channels, channels))
+			++run;
+		if (run > 1)
+		{
+			*out++ = (unsigned char)(0x80 | (run - 1));
+			memcpy(out, pixel, channels);
+			out += channels;
+			x += run;
+			continue;
+		}
+
+		// Raw packet until the next run starts
+		unsigned int count = 1;
+		while (x + count < width && count < 128 && !(x + count + 1 < width && SamePixel(pixel + count * channels, pixel + (count + 1) * channels, channels)))
+			++count;
+		*out++ = (unsigned char)(count - 1);
+		memcpy(out, pixel, (size_t)count * channels);
+		out += (size_t)count * channels;
+		x += count;
+	}
+	return out - start;
+}
+
+void SwizzleRGB(unsigned char* dst, const unsigned char* src, unsigned int count)
+{
+	unsigned int i = 0;
+#if defined(USE_SSE2)
+	// 5 pixels (15 bytes) per step, moving the bytes two positions to the left or right. The 16th byte
+	// written is wrong but the next step (or the scalar loop) writes it again
+	const __m128i green = _mm_setr_epi8(0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0);
+	const __m128i first = _mm_setr_epi8(-1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, 0);
+	const __m128i third = _mm_setr_epi8(0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0, 0, -1, 0);
+	for (; i + 6 <= count; i += 5)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 3));
+		__m128i swapped = _mm_or_si128(_mm_and_si128(v, green),
+			_mm_or_si128(_mm_and_si128(_mm_srli_si128(v, 2), first), _mm_and_si128(_mm_slli_si128(v, 2), third)));
+		_mm_storeu_si128((__m128i*)(dst + i * 3), swapped);
+	}
+#elif defined(USE_NEON)
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16x3_t v = vld3q_u8(src + i * 3);
+		uint8x16_t first = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = first;
+		vst3q_u8(dst + i * 3, v);
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		dst[i * 3] = src[i * 3 + 2];
+		dst[i * 3 + 1] = src[i * 3 + 1];
+		dst[i * 3 + 2] = src[i * 3];
+	}
+}
+
+void SwizzleBGRAToRGB(unsigned char* dst, const unsigned char* src, unsigned int count)
+{
+	unsigned int i = 0;
+#if defined(USE_SSE2)
+	// 4 pixels per step: R G B 0 in every 32 bit lane, then two pixels at the bottom of every 64 bit lane.
+	// Both halves are stored with 8 bytes, the last 2 are written again by the next step
+	const __m128i low = _mm_set1_epi32(0xFF), middle = _mm_set1_epi32(0xFF00);
+	const __m128i pixel0 = _mm_set1_epi64x(0xFFFFFF), pixel1 = _mm_set1_epi64x(0xFFFFFF000000LL);
+	for (; i + 5 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i rgb = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low), _mm_and_si128(v, middle)),
+			_mm_slli_epi32(_mm_and_si128(v, low), 16));
+		__m128i packed = _mm_or_si128(_mm_and_si128(rgb, pixel0), _mm_and_si128(_mm_srli_epi64(rgb, 8), pixel1));
+		_mm_storel_epi64((__m128i*)(dst + i * 3), packed);
+		_mm_storel_epi64((__m128i*)(dst + i * 3 + 6), _mm_unpackhi_epi64(packed, packed));
+	}
+#elif defined(USE_NEON)
+	for (; i + 16 <= count; i += 16)
+	{
+		uint8x16x4_t v = vld4q_u8(src + i * 4);
+		uint8x16x3_t rgb;
+		rgb.val[0] = v.val[2];
+		rgb.val[1] = v.val[1];
+		rgb.val[2] = v.val[0];
+		vst3q_u8(dst + i * 3, rgb);
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		dst[i * 3] = src[i * 4 + 2];
+		dst[i * 3 + 1] = src[i * 4 + 1];
+		dst[i * 3 + 2] = src[i * 4];
+	}
+}
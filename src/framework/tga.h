@@ -0,0 +1,29 @@
+/*
+	TGA files: true color images of 24 or 32 bits, uncompressed (type 2) or run length encoded (type 10).
+	Rows are read and written one at a time in the file order and layout (BGR or BGRA), the swizzles convert
+	whole rows from and to the RGB order of Color.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+typedef std::function<bool(unsigned int width, unsigned int height, unsigned int channels)> TGAHeaderCallback;	// Returns false to stop
+typedef std::function<void(unsigned int y, const unsigned char* row)> TGARowCallback;
+
+// Decodes 'in' (the whole file) calling on_row for every row from the first one in the file, with 3 (BGR) or 4 (BGRA) channels.
+// The row pointer is only valid during the call. Returns false if the file is not supported or is truncated
+bool DecodeTGA(const unsigned char* in, size_t size, const TGAHeaderCallback& on_header, const TGARowCallback& on_row);
+
+// The 18 bytes of the header of a 24 or 32 bits file, with the first row at the bottom
+void WriteTGAHeader(unsigned char header[18], unsigned int width, unsigned int height, unsigned int channels, bool rle);
+
+// Run length encodes one row, packets never cross rows. 'out' needs room for the worst case (GetTGARowRLESize), returns the bytes used
+size_t EncodeTGARowRLE(unsigned char* out, const unsigned char* row, unsigned int width, unsigned int channels);
+inline size_t GetTGARowRLESize(unsigned int width, unsigned int channels) { return (size_t)width * channels + (width + 127) / 128; }
+
+// Swaps the first and third bytes of 'count' pixels of 3 bytes (BGR to RGB or back). 'dst' and 'src' must not overlap
+void SwizzleRGB(unsigned char* dst, const unsigned char* src, unsigned int count);
+// BGRA to RGB, the alpha is dropped. 'dst' and 'src' must not overlap
+void SwizzleBGRAToRGB(unsigned char* dst, const unsigned char* src, unsigned int count);
@@ -13,6 +13,9 @@
 
 #else
 	#include <sys/time.h>
+	#include <sys/stat.h>
+	#include <dirent.h>
+	#include <errno.h>
 
 #if defined(__linux__)
 	#include <limits.h>
@@ -26,6 +29,13 @@
 #include "main/includes.h"
 #include "application.h"
 #include "image.h"
+#include "texture.h"
+#include "../extra/picopng.h"
+
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 
 std::string absResPath( const std::string& p_sFile )
 {
@@ -159,6 +169,9 @@ void launchLoop(Application* app)
 		// Clear the window and the depth buffer
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		// Frame counter of the texture cache, evicts the textures not used lately if it is over budget
+		Texture::NewFrame();
+
 		// Render frame
 		app->Render();
 
@@ -224,6 +237,427 @@ void launchLoop(Application* app)
 	return;
 }
 
+bool readFile(const std::string& filename, std::vector<unsigned char>& buffer)
+{
+	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.good())
+		return false;
+
+	std::streamsize size = file.tellg();
+	if (size <= 0)
+		return false;
+	file.seekg(0, std::ios::beg);
+
+	buffer.resize((size_t)size);
+	file.read((char*)&buffer[0], size);
+	return file.good();
+}
+
+bool benchmarkPNGDecode(const char* filename, int runs)
+{
+	// The SIMD unfiltering is checked against the byte by byte code before timing anything
+	bool unfilter_ok = checkPNGUnfilter();
+	std::cout << "PNG unfiltering check (filters 0 to 4, 1 to 8 bytes per pixel): " << (unfilter_ok ? "passed" : "FAILED") << std::endl;
+
+	std::vector<unsigned char> file;
+	if (!readFile(absResPath(filename), file))
+	{
+		std::cerr << "Benchmark: can not read " << filename << std::endl;
+		return false;
+	}
+
+	runs = std::max(1, runs);
+
+	// Whole image (decodePNGNative) and row by row (decodePNGStream, used by Image::LoadPNG)
+	std::vector<unsigned char> pixels;
+	unsigned int width = 0, height = 0, channels = 0;
+	double best[2] = { 1e30, 1e30 }, total[2] = { 0.0, 0.0 };
+	for (int i = 0; i < runs; ++i)
+	{
+		for (int mode = 0; mode < 2; ++mode)
+		{
+			auto start = std::chrono::steady_clock::now();
+			int error;
+			if (mode == 0)
+				error = decodePNGNative(pixels, width, height, channels, &file[0], file.size());
+			else
+				error = decodePNGStream(width, height, channels, &file[0], file.size(),
+					[](unsigned int, unsigned int, unsigned int) { return true; }, [](unsigned int, const unsigned char*) {});
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (error)
+			{
+				std::cerr << "Benchmark: error " << error << " decoding " << filename << std::endl;
+				return false;
+			}
+			best[mode] = std::min(best[mode], ms);
+			total[mode] += ms;
+		}
+	}
+
+	double megabytes = (double)width * height * channels / (1024.0 * 1024.0);
+	std::cout << filename << ": " << width << "x" << height << ", " << channels << " channels, " << file.size() / 1024 << " KB, " << runs << " runs" << std::endl;
+	const char* names[2] = { "whole ", "stream" };
+	for (int mode = 0; mode < 2; ++mode)
+		std::cout << "  " << names[mode] << " best " << best[mode] << " ms, average " << total[mode] / runs << " ms, " << megabytes * 1000.0 / best[mode] << " MB/s" << std::endl;
+	return unfilter_ok;
+}
+
+// Best time in milliseconds of 'runs' calls of job()
+template <typename F>
+static double bestTime(int runs, F job)
+{
+	double best = 1e30;
+	for (int i = 0; i < runs; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		job();
+		best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+// ||M * inverse - I|| / (||M|| ||inverse||) with the largest element as norm, so it does not grow with the scale
+static double inverseError(const Matrix44& matrix, const Matrix44& inverse)
+{
+	Matrix44 product = matrix * inverse;
+	double error = 0.0, norm = 0.0, inverse_norm = 0.0;
+	for (int i = 0; i < 16; ++i)
+	{
+		error = std::max(error, (double)fabsf(product.m[i] - (i % 5 == 0 ? 1.0f : 0.0f)));
+		norm = std::max(norm, (double)fabsf(matrix.m[i]));
+		inverse_norm = std::max(inverse_norm, (double)fabsf(inverse.m[i]));
+	}
+	return error / (norm * inverse_norm);
+}
+
+// A particle update with the inline Vector3 operators and a color fade with the Color ones, against the same loops
+// written by hand with floats and bytes. If the operators are inlined both take the same time
+static bool benchmarkVectorLoops(int runs)
+{
+	const int COUNT = 1 << 16;
+	std::mt19937 generator(4321);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	std::vector<Vector3> position(COUNT), velocity(COUNT), normal(COUNT);
+	std::vector<Color> color(COUNT), fade(COUNT);
+	for (int i = 0; i < COUNT; ++i)
+	{
+		position[i].Set(random(generator) * 10.0f, random(generator) * 10.0f, random(generator) * 10.0f);
+		velocity[i].Set(random(generator), random(generator), random(generator));
+		color[i] = Color((random(generator) + 1.0f) * 127.0f, (random(generator) + 1.0f) * 127.0f, (random(generator) + 1.0f) * 127.0f);
+	}
+	const Vector3 gravity(0.0f, -9.8f, 0.0f), center(1.0f, 2.0f, 3.0f), axis(0.0f, 0.0f, 1.0f);
+	const Color tint(20, 10, 5);
+	const float dt = 0.016f, damping = 0.99f, pull = 4.0f, fade_factor = 0.9f;
+
+	std::vector<Vector3> operators_position(COUNT), operators_normal(COUNT), floats_position(COUNT), floats_normal(COUNT);
+	double operators = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+		{
+			Vector3 v = (velocity[i] + gravity * dt) * damping;
+			Vector3 p = position[i] + v * dt;
+			Vector3 to_center = center - p;
+			v = v + to_center * (pull / (to_center.Dot(to_center) + 1.0f));
+			operators_position[i] = p;
+			operators_normal[i] = v.Cross(axis);
+		}
+	});
+	double floats = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+		{
+			const Vector3& v0 = velocity[i];
+			float vx = (v0.x + gravity.x * dt) * damping, vy = (v0.y + gravity.y * dt) * damping, vz = (v0.z + gravity.z * dt) * damping;
+			float px = position[i].x + vx * dt, py = position[i].y + vy * dt, pz = position[i].z + vz * dt;
+			float cx = center.x - px, cy = center.y - py, cz = center.z - pz;
+			float k = pull / (cx * cx + cy * cy + cz * cz + 1.0f);
+			vx = vx + cx * k; vy = vy + cy * k; vz = vz + cz * k;
+			floats_position[i].Set(px, py, pz);
+			floats_normal[i].Set(vy * axis.z - vz * axis.y, vz * axis.x - vx * axis.z, vx * axis.y - vy * axis.x);
+		}
+	});
+
+	std::vector<Color> operators_color(COUNT), bytes_color(COUNT);
+	double color_operators = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+			operators_color[i] = color[i] * fade_factor + tint;
+	});
+	double color_bytes = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+		{
+			// Same arithmetic as the operators: scaled in floats, then a saturated add
+			const Color& c = color[i];
+			int r = (unsigned char)clamp(c.r * fade_factor, 0.0f, 255.0f) + tint.r;
+			int g = (unsigned char)clamp(c.g * fade_factor, 0.0f, 255.0f) + tint.g;
+			int b = (unsigned char)clamp(c.b * fade_factor, 0.0f, 255.0f) + tint.b;
+			bytes_color[i].r = (unsigned char)(r > 255 ? 255.0f : (float)r);
+			bytes_color[i].g = (unsigned char)(g > 255 ? 255.0f : (float)g);
+			bytes_color[i].b = (unsigned char)(b > 255 ? 255.0f : (float)b);
+		}
+	});
+
+	// Same operations in the same order, the results must be equal
+	bool same = memcmp(&operators_position[0], &floats_position[0], COUNT * sizeof(Vector3)) == 0 &&
+		memcmp(&operators_normal[0], &floats_normal[0], COUNT * sizeof(Vector3)) == 0 &&
+		memcmp(&operators_color[0], &bytes_color[0], COUNT * sizeof(Color)) == 0;
+
+	double to_ns = 1e6 / COUNT;
+	std::cout << "Vector loops, ns per element (best of " << runs << "):" << std::endl;
+	std::cout << "  particles: operators " << operators * to_ns << ", floats " << floats * to_ns << std::endl;
+	std::cout << "  colors:    operators " << color_operators * to_ns << ", bytes " << color_bytes * to_ns << std::endl;
+	if (!same)
+		std::cerr << "  FAILED: the operators and the hand written loops give different results" << std::endl;
+	return same;
+}
+
+bool benchmarkMath(int runs)
+{
+	runs = std::max(1, runs);
+
+	// Affine matrices like the model and view matrices (rotation, scale and translation), and general
+	// ones with a big diagonal so they are well conditioned
+	const int COUNT = 4096;
+	const double MAX_ERROR = 1e-6;
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> random(-1.0f, 1.0f);
+	std::vector<Matrix44> affine(COUNT), general(COUNT);
+	for (int i = 0; i < COUNT; ++i)
+	{
+		affine[i].SetRotation(random(generator) * (float)PI, Vector3(random(generator), random(generator), random(generator) + 2.0f).Normalize());
+		float scale = powf(2.0f, random(generator) * 2.0f);
+		for (int j = 0; j < 12; ++j)
+			affine[i].m[j] *= scale;
+		affine[i].m[12] = random(generator) * 10.0f;
+		affine[i].m[13] = random(generator) * 10.0f;
+		affine[i].m[14] = random(generator) * 10.0f;
+		for (int j = 0; j < 16; ++j)
+			general[i].m[j] = random(generator) + (j % 5 == 0 ? 2.0f : 0.0f);
+	}
+
+	// Every inverse against the Gaussian elimination, and matrices with a repeated column must fail in both
+	double worst[3] = { 0.0, 0.0, 0.0 };
+	int failures = 0;
+	for (int i = 0; i < COUNT; ++i)
+	{
+		const Matrix44* sources[2] = { &affine[i], &general[i] };
+		for (int k = 0; k < 2; ++k)
+		{
+			Matrix44 simd = *sources[k], gaussian = *sources[k];
+			bool ok = simd.Inverse();
+			ok = gaussian.InverseGaussian() && ok;
+			worst[0] = std::max(worst[0], inverseError(*sources[k], simd));
+			worst[1] = std::max(worst[1], inverseError(*sources[k], gaussian));
+			if (k == 0)
+			{
+				Matrix44 fast = affine[i];
+				ok = ok && fast.InverseAffine();
+				worst[2] = std::max(worst[2], inverseError(affine[i], fast));
+			}
+			if (!ok)
+				++failures;
+		}
+
+		Matrix44 singular = general[i];
+		memcpy(singular.m + 8, singular.m + (i % 2) * 4, 4 * sizeof(float));
+		Matrix44 gaussian = singular;
+		if (singular.Inverse() || gaussian.InverseGaussian())
+			++failures;
+	}
+
+	std::cout << "Matrix44 inverse check, " << COUNT << " affine and " << COUNT << " general matrices:" << std::endl;
+	std::cout << "  |M*inv(M) - I| / (|M| |inv(M)|): Inverse " << worst[0] << ", InverseGaussian " << worst[1] << ", InverseAffine " << worst[2] << std::endl;
+	bool passed = failures == 0 && std::max(worst[0], std::max(worst[1], worst[2])) <= MAX_ERROR;
+	if (!passed)
+		std::cerr << "  FAILED: errors above " << MAX_ERROR << " or " << failures << " wrong results (inverse refused, or singular matrix inverted)" << std::endl;
+
+	// Times per call, a result is read into 'sink' so the loops are not optimized away
+	std::vector<Matrix44> results(COUNT);
+	volatile float sink = 0.0f;
+	double multiply = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+			results[i] = affine[i] * general[i];
+		sink = results[COUNT - 1].m[0];
+	});
+	double inverse = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+			(results[i] = general[i]).Inverse();
+		sink = results[COUNT - 1].m[0];
+	});
+	double gaussian = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+			(results[i] = general[i]).InverseGaussian();
+		sink = results[COUNT - 1].m[0];
+	});
+	double inverse_affine = bestTime(runs, [&]() {
+		for (int i = 0; i < COUNT; ++i)
+			(results[i] = affine[i]).InverseAffine();
+		sink = results[COUNT - 1].m[0];
+	});
+
+	double to_ns = 1e6 / COUNT;
+	std::cout << "Matrix44, ns per call (best of " << runs << "):" << std::endl;
+	std::cout << "  multiply " << multiply * to_ns << ", Inverse " << inverse * to_ns << ", InverseGaussian " << gaussian * to_ns
+		<< ", InverseAffine " << inverse_affine * to_ns << std::endl;
+
+	passed = benchmarkVectorLoops(runs) && passed;
+	return passed;
+}
+
+// A rotated copy of a size x size image: every row of the result walks the source along the rotated direction
+template <typename T>
+static void renderRotated(const T& source, unsigned int size, float angle, Color* result)
+{
+	float c = cosf(angle * DEG2RAD), s = sinf(angle * DEG2RAD), inv_size = 1.0f / size;
+	for (unsigned int y = 0; y < size; ++y)
+	{
+		float dy = y - size * 0.5f;
+		for (unsigned int x = 0; x < size; ++x)
+		{
+			float dx = x - size * 0.5f;
+			result[y * size + x] = source.SampleBilinear((dx * c - dy * s) * inv_size + 0.5f, (dx * s + dy * c) * inv_size + 0.5f);
+		}
+	}
+}
+
+bool benchmarkSampling(unsigned int size, int runs)
+{
+	runs = std::max(1, runs);
+	size = std::max(16u, size);
+
+	// Noise, so the samples can not be predicted and both layouts must give the same colors
+	std::mt19937 generator(99);
+	Image image(size, size);
+	for (unsigned int i = 0; i < size * size; ++i)
+	{
+		unsigned int bits = generator();
+		image.pixels[i] = Color((float)(bits & 255), (float)((bits >> 8) & 255), (float)((bits >> 16) & 255));
+	}
+
+	TiledImage tiled;
+	Image back;
+	double from_image = bestTime(runs, [&]() { tiled.FromImage(image); });
+	double to_image = bestTime(runs, [&]() { tiled.ToImage(back); });
+	bool same = memcmp(back.pixels, image.pixels, size * size * sizeof(Color)) == 0;
+
+	std::cout << "Bilinear sampling of a " << size << "x" << size << " image, linear and tiled layouts (best of " << runs << "):" << std::endl;
+	std::cout << "  conversion: FromImage " << from_image << " ms, ToImage " << to_image << " ms" << std::endl;
+
+	std::vector<Color> linear_result(size * size), tiled_result(size * size);
+	const int angles[] = { 0, 30, 45, 60, 90 };
+	for (int angle : angles)
+	{
+		double linear = bestTime(runs, [&]() { renderRotated(image, size, (float)angle, &linear_result[0]); });
+		double tiled_time = bestTime(runs, [&]() { renderRotated(tiled, size, (float)angle, &tiled_result[0]); });
+		same = same && memcmp(&linear_result[0], &tiled_result[0], size * size * sizeof(Color)) == 0;
+
+		double to_ns = 1e6 / ((double)size * size);
+		std::cout << "  " << angle << " degrees: linear " << linear * to_ns << " ns, tiled " << tiled_time * to_ns << " ns per sample (" << linear / tiled_time << "x)" << std::endl;
+	}
+
+	if (!same)
+		std::cerr << "  FAILED: the tiled layout gives different colors" << std::endl;
+	return same;
+}
+
+bool benchmarkImageFormats(const char* filename, int runs)
+{
+	runs = std::max(1, runs);
+	Image image;
+	if (!image.LoadPNG(filename))
+	{
+		std::cerr << "Benchmark: can not load " << filename << std::endl;
+		return false;
+	}
+
+	// Saved to res and loaded back through the Image methods, the files are removed at the end.
+	// (SaveTGA writes the bottom row first but LoadTGA puts it at the top unless it flips)
+	struct sFormat
+	{
+		const char* name;
+		const char* file;
+		std::function<bool(Image&, const char*)> save, load;
+	};
+	const sFormat formats[] = {
+		{ "QOI        ", "bench_formats.qoi", [](Image& i, const char* f) { return i.SaveQOI(f); }, [](Image& i, const char* f) { return i.LoadQOI(f); } },
+		{ "QOI striped", "bench_formats_striped.qoi", [](Image& i, const char* f) { return i.SaveQOI(f, true); }, [](Image& i, const char* f) { return i.LoadQOI(f); } },
+		{ "TGA        ", "bench_formats.tga", [](Image& i, const char* f) { return i.SaveTGA(f); }, [](Image& i, const char* f) { return i.LoadTGA(f, true); } },
+		{ "TGA RLE    ", "bench_formats_rle.tga", [](Image& i, const char* f) { return i.SaveTGA(f, true); }, [](Image& i, const char* f) { return i.LoadTGA(f, true); } },
+		{ "PNG fast   ", "bench_formats_fast.png", [](Image& i, const char* f) { return i.SavePNG(f, PNG_LEVEL_FAST); }, [](Image& i, const char* f) { return i.LoadPNG(f); } },
+		{ "PNG        ", "bench_formats.png", [](Image& i, const char* f) { return i.SavePNG(f); }, [](Image& i, const char* f) { return i.LoadPNG(f); } }
+	};
+
+	std::cout << filename << ": " << image.width << "x" << image.height << ", save and load through Image (best of " << runs << "):" << std::endl;
+	bool passed = true;
+	for (const sFormat& format : formats)
+	{
+		bool ok = true;
+		Image loaded;
+		double save = bestTime(runs, [&]() { ok = format.save(image, format.file) && ok; });
+		double load = bestTime(runs, [&]() { ok = format.load(loaded, format.file) && ok; });
+		ok = ok && loaded.width == image.width && loaded.height == image.height &&
+			memcmp(loaded.pixels, image.pixels, image.width * image.height * sizeof(Color)) == 0;
+
+		std::string path = absResPath(format.file);
+		std::vector<unsigned char> file;
+		readFile(path, file);
+		remove(path.c_str());
+
+		std::cout << "  " << format.name << " " << file.size() / 1024 << " KB, save " << save << " ms, load " << load << " ms" << std::endl;
+		if (!ok)
+		{
+			std::cerr << "  FAILED: " << format.file << " could not be saved or does not load back the same" << std::endl;
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+unsigned long long hashBytes(const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+bool listFiles(const std::string& directory, const std::string& extension, std::vector<std::string>& files)
+{
+	files.clear();
+#ifdef WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((directory + "\\*" + extension).c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(data.cFileName);
+	} while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL)
+		return false;
+	while (dirent* entry = readdir(dir))
+	{
+		std::string name = entry->d_name;
+		if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+			files.push_back(name);
+	}
+	closedir(dir);
+#endif
+	// The order of the system is not always the same
+	std::sort(files.begin(), files.end());
+	return true;
+}
+
+bool makeDirectory(const std::string& directory)
+{
+#ifdef WIN32
+	return CreateDirectoryA(directory.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+	return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings)
 {
 	std::vector<std::string> tokens;
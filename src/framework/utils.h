@@ -7,6 +7,8 @@
 #include "framework.h"
 #include "SDL.h"
 #include <string>
+#include <thread>
+#include <atomic>
 
 //General functions **************
 class Application;
@@ -31,6 +33,46 @@ inline unsigned long frand(void) {          //period 2^96-1
 inline bool isPowerOfTwo(int n) { return (n & (n - 1)) == 0; }
 inline float randomValue() { return (frand() % 10000) / 10000.0f; }
 std::string absResPath(const std::string& p_sFile);
+bool readFile(const std::string& filename, std::vector<unsigned char>& buffer); // Whole file in binary, false if it can not be read
+unsigned long long hashBytes(const void* data, size_t size); // FNV-1a 64 bits, to detect changes in files or buffers
+bool listFiles(const std::string& directory, const std::string& extension, std::vector<std::string>& files); // Names (sorted, no path) ending with extension
+bool makeDirectory(const std::string& directory); // Creates the directory (not its parents), true if it exists after the call
+bool benchmarkPNGDecode(const char* filename, int runs); // Checks the PNG unfiltering and times the decoding of a PNG in res, false if it fails
+bool benchmarkMath(int runs); // Checks the SIMD Matrix44 inverses against the Gaussian elimination, times the matrix operations and vector loops
+bool benchmarkSampling(unsigned int size, int runs); // Times the bilinear sampling of rotated images in the linear and the tiled layouts
+bool benchmarkImageFormats(const char* filename, int runs); // Times saving and loading a PNG in res as QOI, TGA and PNG, false if a round trip fails
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings = false);
 Vector2 parseVector2(const char* text);
-Vector3 parseVector3(const char* text, const char separator);
\ No newline at end of file
+Vector3 parseVector3(const char* text, const char separator);
+
+// Runs callback(i) for every i in [begin, end) using all the hardware threads.
+// Indices are handed out dynamically, so callbacks must not depend on the execution order.
+template <typename F>
+void parallelFor(int begin, int end, F callback)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+
+	int num_threads = (int)std::thread::hardware_concurrency();
+	if (num_threads > count)
+		num_threads = count;
+	if (num_threads <= 1) {
+		for (int i = begin; i < end; ++i)
+			callback(i);
+		return;
+	}
+
+	std::atomic<int> next(begin);
+	auto worker = [&]() {
+		for (int i = next++; i < end; i = next++)
+			callback(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < num_threads; ++t)
+		threads.push_back(std::thread(worker));
+	worker(); // The calling thread also does its share
+	for (size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+}
@@ -3,6 +3,19 @@
 
 int main(int argc, char **argv)
 {
+	// "--bench-png [file in res] [runs]" checks the PNG unfiltering, times the decoder and exits without opening a window
+	if (argc > 1 && strcmp(argv[1], "--bench-png") == 0)
+		return benchmarkPNGDecode(argc > 2 ? argv[2] : "images/fruits.png", argc > 3 ? atoi(argv[3]) : 20) ? 0 : 1;
+	// "--bench-math [runs]" checks and times the matrix operations
+	if (argc > 1 && strcmp(argv[1], "--bench-math") == 0)
+		return benchmarkMath(argc > 2 ? atoi(argv[2]) : 20) ? 0 : 1;
+	// "--bench-sampling [size] [runs]" times the bilinear sampling of Image and TiledImage
+	if (argc > 1 && strcmp(argv[1], "--bench-sampling") == 0)
+		return benchmarkSampling(argc > 2 ? atoi(argv[2]) : 2048, argc > 3 ? atoi(argv[3]) : 5) ? 0 : 1;
+	// "--bench-formats [png file in res] [runs]" times saving and loading QOI, TGA and PNG files
+	if (argc > 1 && strcmp(argv[1], "--bench-formats") == 0)
+		return benchmarkImageFormats(argc > 2 ? argv[2] : "images/fruits.png", argc > 3 ? atoi(argv[3]) : 5) ? 0 : 1;
+
 	// Launch the app (app is a global variable)
 	Application* app = new Application( "Computer Graphics", 1280, 720);
 	app->Init();